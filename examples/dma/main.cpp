@@ -1,5 +1,7 @@
 #include "sd_raw.h"
 #include "sd_raw_dma.h"
+#include "fkfs.h"
+#include "fkfs_device_dma.h"
 #undef LOW
 #undef HIGH
 #undef min
@@ -96,14 +98,14 @@ void setup() {
 
     sd_raw_dma_t sd_dma = { 0 };
 
-    if (!sd_raw_dma_initialize(&sd_dma, &sd, source_memory, destination_memory, 512)) {
+    if (!sd_raw_dma_initialize(&sd_dma, &sd)) {
         Serial.println("sd_raw_dma_initialize failed");
         while (true) {
             delay(100);
         }
     }
 
-    status = sd_raw_dma_read_block(&sd_dma, block);
+    status = sd_raw_dma_read_block(&sd_dma, block, destination_memory);
     if (!status) {
         Serial.println("dma_read_block failed");
     }
@@ -117,7 +119,7 @@ void setup() {
         destination_memory[i] = i;
     }
 
-    status = sd_raw_dma_write_block(&sd_dma, block);
+    status = sd_raw_dma_write_block(&sd_dma, block, source_memory);
     if (!status) {
         Serial.println("dma_write_block failed");
     }
@@ -127,7 +129,7 @@ void setup() {
             destination_memory[i] = 0;
         }
 
-        status = sd_raw_dma_read_block(&sd_dma, block);
+        status = sd_raw_dma_read_block(&sd_dma, block, destination_memory);
         if (!status) {
             Serial.println("dma_read_block failed");
         }
@@ -137,6 +139,42 @@ void setup() {
         }
     }
 
+    // Appends go on while the previous commit is transferred and programmed.
+    fkfs_t fs;
+    fkfs_create(&fs);
+    fkfs_device_dma_open(&fs.device, &sd_dma);
+    fs.asynchronous = true;
+
+    fkfs_initialize_file(&fs, FKFS_FILE_LOG, FKFS_FILE_PRIORITY_LOWEST, false, "FK.LOG");
+    fkfs_initialize_file(&fs, FKFS_FILE_DATA, FKFS_FILE_PRIORITY_HIGHEST, false, "DATA.BIN");
+
+    if (!fkfs_initialize(&fs, true)) {
+        Serial.println("fkfs_initialize failed");
+    }
+    else {
+        uint32_t polls = 0;
+        for (uint32_t i = 0; i < 100; ++i) {
+            if (!fkfs_file_append(&fs, FKFS_FILE_DATA, 100, source_memory)) {
+                Serial.println("fkfs_file_append failed");
+                break;
+            }
+            if ((i % 10) == 0 && !fkfs_flush(&fs)) {
+                Serial.println("fkfs_flush failed");
+                break;
+            }
+            // Sampling would happen here, between polls.
+            if (fkfs_poll(&fs) == FKFS_PENDING) {
+                polls++;
+            }
+        }
+
+        while (fkfs_poll(&fs) == FKFS_PENDING) {
+        }
+
+        Serial.print("fkfs appends done, polls: ");
+        Serial.println(polls);
+    }
+
     Serial.println("done");
 
     while (true) {
@@ -19,8 +19,15 @@ size_t fkfs_printf(const char *f, ...) {
 static size_t (*fkfs_log_function_ptr)(const char *f, ...) = fkfs_printf;
 
 #define FKFS_FIRST_BLOCK           8000
+#define FKFS_HEADER_FIRST_BLOCK    1
 #define FKFS_SEEK_BLOCKS_MAX       5
 
+#define FKFS_TRAILER_CRC_SEED      7331
+#define FKFS_INLINE_CRC_SEED       4217
+#define FKFS_REGION_CRC_SEED       2718
+
+static_assert(FKFS_HEADER_FIRST_BLOCK + FKFS_HEADER_BLOCKS <= FKFS_FIRST_BLOCK, "Error: FKFS_HEADER_BLOCKS overlaps the data region.");
+
 // This is for testing wrap around.
 #define FKFS_TESTING_LAST_BLOCK    UINT32_MAX
 
@@ -73,13 +80,66 @@ static uint8_t fkfs_header_crc_update(fkfs_header_t *header) {
     return actual;
 }
 
+// Blocks are stamped as the head moves onto them, so the blocks written since
+// a header was committed carry the stamps that follow its head's.
+static void fkfs_block_stamp(uint8_t *buffer, uint32_t stamp) {
+    fkfs_block_trailer_t *trailer = (fkfs_block_trailer_t *)(buffer + FKFS_BLOCK_DATA_SIZE);
+    trailer->stamp = stamp;
+    trailer->crc = crc16_update(FKFS_TRAILER_CRC_SEED, (uint8_t *)&trailer->stamp, sizeof(trailer->stamp));
+}
+
+static uint8_t fkfs_block_stamped(uint8_t *buffer, uint32_t *stamp) {
+    fkfs_block_trailer_t *trailer = (fkfs_block_trailer_t *)(buffer + FKFS_BLOCK_DATA_SIZE);
+    if (trailer->crc != crc16_update(FKFS_TRAILER_CRC_SEED, (uint8_t *)&trailer->stamp, sizeof(trailer->stamp))) {
+        return false;
+    }
+    *stamp = trailer->stamp;
+    return true;
+}
+
+static uint16_t fkfs_region_crc(fkfs_region_t *region) {
+    return crc16_update(FKFS_REGION_CRC_SEED, (uint8_t *)region, offsetof(fkfs_region_t, crc));
+}
+
+static void fkfs_region_fill(fkfs_t *fs, uint8_t *block) {
+    fkfs_region_t *region = (fkfs_region_t *)(block + FKFS_REGION_OFFSET);
+    region->firstBlock = fs->firstBlock;
+    region->endBlock = fs->endBlock;
+    region->stamp = fs->stamp;
+    region->crc = fkfs_region_crc(region);
+}
+
+// The head's stamp as the header's block has it, headers from before regions
+// were kept don't.
+static uint8_t fkfs_region_stamp(fkfs_t *fs, uint32_t *stamp) {
+    fkfs_region_t *region = (fkfs_region_t *)(fs->headerBlock + FKFS_REGION_OFFSET);
+    if (region->crc != fkfs_region_crc(region)) {
+        return false;
+    }
+    *stamp = region->stamp;
+    return true;
+}
+
 void fkfs_statistics_zero(fkfs_statistics_t *fks) {
     fks->blockReads = 0;
     fks->blockWrites = 0;
+    fks->burstWrites = 0;
+    fks->burstReads = 0;
+    fks->partialReads = 0;
+    fks->partialBytes = 0;
+    fks->busyPolls = 0;
     fks->iterateCalls = 0;
     fks->iterateTime = 0;
     fks->writeTime = 0;
     fks->readTime = 0;
+    fks->erasedBlocks = 0;
+    fks->preservedBlocks = 0;
+    fks->erasedWrites = 0;
+    fks->cacheHits = 0;
+    fks->cacheMisses = 0;
+    fks->cacheWritebacks = 0;
+    fks->recoveredEntries = 0;
+    fks->inlineCommits = 0;
 }
 
 uint8_t fkfs_configure_logging(size_t (*log_function_ptr)(const char *f, ...)) {
@@ -90,23 +150,36 @@ uint8_t fkfs_configure_logging(size_t (*log_function_ptr)(const char *f, ...)) {
 uint8_t fkfs_create(fkfs_t *fs) {
     memzero(fs, sizeof(fkfs_t));
 
+    // The default region, until fkfs_initialize has the card's.
+    fs->firstBlock = FKFS_FIRST_BLOCK;
+
     return true;
 }
 
 uint8_t fkfs_initialize_file(fkfs_t *fs, uint8_t fileNumber, uint8_t priority, uint8_t sync, const char *name) {
     fs->files[fileNumber].sync = sync;
     fs->files[fileNumber].priority = priority;
+    fs->files[fileNumber].syncBytes = 0;
+    fs->files[fileNumber].syncInterval = 0;
 
     fkfs_file_t *file = &fs->header.files[fileNumber];
     strncpy(file->name, name, sizeof(file->name));
     file->version = random(UINT16_MAX);
-    file->startBlock = FKFS_FIRST_BLOCK;
+    file->startBlock = fs->firstBlock;
     file->startOffset = 0;
     file->endOffset = 0;
 
     return true;
 }
 
+uint8_t fkfs_file_sync_policy(fkfs_t *fs, uint8_t fileNumber, uint32_t syncBytes, uint32_t syncInterval) {
+    fs->files[fileNumber].sync = true;
+    fs->files[fileNumber].syncBytes = syncBytes;
+    fs->files[fileNumber].syncInterval = syncInterval;
+
+    return true;
+}
+
 uint8_t fkfs_number_of_files(fkfs_t *fs) {
     for (uint8_t counter = 0; counter < FKFS_FILES_MAX; ++counter) {
         fkfs_file_t *file = &fs->header.files[counter];
@@ -126,204 +199,1351 @@ uint8_t fkfs_get_file(fkfs_t *fs, uint8_t fileNumber, fkfs_file_info_t *info) {
     info->version = file->version;;
     info->size = file->size;
 
-    return true;
-}
+    return true;
+}
+
+// Blocks are queued in one write behind queue while the other is being
+// written by a commit that's underway. With only one queue they're the same,
+// and queueing waits for the commit.
+static fkfs_write_behind_t *fkfs_write_behind_filling(fkfs_t *fs) {
+    return &fs->writeBehind[fs->filling];
+}
+
+static fkfs_write_behind_t *fkfs_write_behind_inflight(fkfs_t *fs) {
+    return &fs->writeBehind[(fs->filling + 1) % FKFS_WRITE_BEHIND_QUEUES];
+}
+
+// A block can be in both queues, the filling one has the newer copy.
+static uint8_t *fkfs_write_behind_find(fkfs_t *fs, uint32_t block) {
+    for (uint8_t i = 0; i < FKFS_WRITE_BEHIND_QUEUES; ++i) {
+        fkfs_write_behind_t *wb = &fs->writeBehind[(fs->filling + i) % FKFS_WRITE_BEHIND_QUEUES];
+        if (wb->number > 0 && block >= wb->block && block < wb->block + wb->number) {
+            return wb->buffer[block - wb->block];
+        }
+    }
+
+    return nullptr;
+}
+
+static uint8_t fkfs_read_block(fkfs_t *fs, uint32_t block, uint8_t *buffer) {
+    // Blocks waiting to be written are newer than what's on the card.
+    auto queued = fkfs_write_behind_find(fs, block);
+    if (queued != nullptr) {
+        memcpy(buffer, queued, SD_RAW_BLOCK_SIZE);
+        return true;
+    }
+
+    fs->statistics.blockReads++;
+
+    fkfs_log("fkfs: read block %d (%x)", block, buffer);
+
+    auto started = millis();
+    auto status = true;
+    if (!fkfs_device_read_block(&fs->device, block, (uint8_t *)buffer)) {
+        status = false;
+    }
+
+    fs->statistics.readTime += millis() - started;
+
+    return status;
+}
+
+static uint8_t fkfs_write_block(fkfs_t *fs, uint32_t block, uint8_t *buffer) {
+    fs->statistics.blockWrites++;
+
+    auto started = millis();
+    auto status = true;
+    if (!fkfs_device_write_block(&fs->device, block, (uint8_t *)buffer)) {
+        status = false;
+    }
+
+    fs->statistics.writeTime += millis() - started;
+
+    return status;
+}
+
+constexpr uint8_t FKFS_PENDING_NONE = 0;
+constexpr uint8_t FKFS_PENDING_DATA = 1;
+constexpr uint8_t FKFS_PENDING_HEADER = 2;
+constexpr uint8_t FKFS_PENDING_DONE = 3;
+
+static uint8_t fkfs_wait(fkfs_t *fs);
+
+static uint8_t fkfs_fsync(fkfs_t *fs);
+
+static uint8_t fkfs_sync(fkfs_t *fs);
+
+static uint8_t fkfs_recover(fkfs_t *fs, uint8_t *buffer);
+
+static uint8_t fkfs_head_queue(fkfs_t *fs);
+
+static void fkfs_inline_fill(fkfs_t *fs, uint8_t *block);
+
+#if FKFS_READ_AHEAD_BLOCKS > 0
+// Blocks read ahead are dropped when any of them change on the card.
+static void fkfs_read_ahead_drop(fkfs_t *fs, uint32_t block, uint32_t number) {
+    fkfs_read_ahead_t *ra = &fs->readAhead;
+    if (ra->number > 0 && ra->block < block + number && block < ra->block + ra->number) {
+        ra->number = 0;
+    }
+}
+
+static uint8_t *fkfs_read_ahead_find(fkfs_t *fs, uint32_t block) {
+    fkfs_read_ahead_t *ra = &fs->readAhead;
+    if (ra->number > 0 && block >= ra->block && block < ra->block + ra->number) {
+        return ra->buffer[block - ra->block];
+    }
+    return nullptr;
+}
+#else
+static void fkfs_read_ahead_drop(fkfs_t *fs, uint32_t block, uint32_t number) {
+}
+
+static uint8_t *fkfs_read_ahead_find(fkfs_t *fs, uint32_t block) {
+    return nullptr;
+}
+#endif
+
+static void fkfs_write_behind_written(fkfs_t *fs, fkfs_write_behind_t *wb) {
+    // Anything read ahead of these blocks is stale now.
+    fkfs_read_ahead_drop(fs, wb->block, wb->number);
+
+    fkfs_log_verbose("fkfs: write behind %d (%d)", wb->block, wb->number);
+    wb->number = 0;
+}
+
+static uint8_t fkfs_write_behind_write(fkfs_t *fs, fkfs_write_behind_t *wb) {
+    if (wb->number == 0) {
+        return true;
+    }
+
+    fs->statistics.blockWrites += wb->number;
+    fs->statistics.burstWrites++;
+
+    auto started = millis();
+    auto status = true;
+    if (!fkfs_device_write_blocks(&fs->device, wb->block, wb->number, (uint8_t *)wb->buffer)) {
+        status = false;
+    }
+
+    fs->statistics.writeTime += millis() - started;
+
+    // On failure the blocks stay queued, so a later flush can try again.
+    if (status) {
+        fkfs_write_behind_written(fs, wb);
+    }
+
+    return status;
+}
+
+static uint8_t fkfs_write_behind_flush(fkfs_t *fs) {
+    if (!fkfs_wait(fs)) {
+        return false;
+    }
+
+    // Blocks left over from a failed commit go first, they're older.
+    if (!fkfs_write_behind_write(fs, fkfs_write_behind_inflight(fs))) {
+        return false;
+    }
+
+    return fkfs_write_behind_write(fs, fkfs_write_behind_filling(fs));
+}
+
+static uint8_t fkfs_write_behind_append(fkfs_t *fs, uint32_t block, uint8_t *buffer) {
+    fkfs_write_behind_t *wb = fkfs_write_behind_filling(fs);
+
+    // The only queue may still be going out with a commit.
+    if (FKFS_WRITE_BEHIND_QUEUES == 1 && !fkfs_wait(fs)) {
+        return false;
+    }
+
+    // Only runs of consecutive blocks can go out together.
+    if (wb->number > 0 && (block != wb->block + wb->number || wb->number == FKFS_WRITE_BEHIND_BLOCKS)) {
+        if (!fkfs_write_behind_flush(fs)) {
+            return false;
+        }
+    }
+
+    if (wb->number == 0) {
+        wb->block = block;
+    }
+
+    memcpy(wb->buffer[wb->number], buffer, SD_RAW_BLOCK_SIZE);
+    wb->number++;
+
+    return true;
+}
+
+// Each generation of the header goes in the next block of the ring, so
+// commits never rewrite the same block twice in a row.
+static uint32_t fkfs_header_location(uint32_t generation) {
+    return FKFS_HEADER_FIRST_BLOCK + generation % FKFS_HEADER_BLOCKS;
+}
+
+// Puts header, the region and any appends inlineSync is holding, in our copy
+// of the header block and copies the block to buffer for writing. Header blocks are
+// only read back by fkfs_initialize.
+static void fkfs_header_block(fkfs_t *fs, fkfs_header_t *header, uint8_t *buffer) {
+    memcpy(fs->headerBlock, (void *)header, sizeof(fkfs_header_t));
+
+    fkfs_region_fill(fs, fs->headerBlock);
+    fkfs_inline_fill(fs, fs->headerBlock);
+
+    if (buffer != fs->headerBlock) {
+        memcpy(buffer, fs->headerBlock, SD_RAW_BLOCK_SIZE);
+    }
+}
+
+static uint8_t fkfs_header_write(fkfs_t *fs) {
+    // Headers can never reference data that isn't on the card yet. Devices
+    // that queue writes may reorder them, flushing keeps the header behind.
+    if (!fkfs_write_behind_flush(fs)) {
+        return false;
+    }
+
+    if (!fkfs_device_flush(&fs->device)) {
+        return false;
+    }
+
+    fkfs_header_crc_update(&fs->header);
+
+    fkfs_header_block(fs, &fs->header, fs->headerBlock);
+
+    if (!fkfs_write_block(fs, fkfs_header_location(fs->header.generation), fs->headerBlock)) {
+        return false;
+    }
+
+    return fkfs_device_flush(&fs->device);
+}
+
+// Clears block 0 and the ring, so nothing from before is taken for a header.
+static uint8_t fkfs_header_wipe(fkfs_t *fs) {
+    memset(fs->headerBlock, 0, SD_RAW_BLOCK_SIZE);
+
+    for (uint32_t block = 0; block < FKFS_HEADER_FIRST_BLOCK + FKFS_HEADER_BLOCKS; ++block) {
+        if (!fkfs_write_block(fs, block, fs->headerBlock)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_header_read(fkfs_t *fs, uint32_t index, fkfs_header_t *header, uint8_t *buffer) {
+    if (!fkfs_read_block(fs, FKFS_HEADER_FIRST_BLOCK + index, buffer)) {
+        return false;
+    }
+
+    memcpy((void *)header, buffer, sizeof(fkfs_header_t));
+
+    return fkfs_header_crc_valid(header);
+}
+
+// Finds the newest header. The ring holds a run of consecutive generations
+// starting at its first block followed by the rest of the previous lap, so
+// the end of the run is found by binary search. Cards that have never had a
+// ring fall back to the pair of headers in block 0.
+static uint8_t fkfs_header_find(fkfs_t *fs, fkfs_header_t *header, uint8_t *buffer) {
+    fkfs_header_t first;
+    fkfs_header_t candidate;
+
+    if (fkfs_header_read(fs, 0, &first, buffer)) {
+        memcpy((void *)header, (void *)&first, sizeof(fkfs_header_t));
+        memcpy(fs->headerBlock, buffer, SD_RAW_BLOCK_SIZE);
+
+        uint32_t low = 0;
+        uint32_t high = FKFS_HEADER_BLOCKS - 1;
+        while (low < high) {
+            uint32_t middle = (low + high + 1) / 2;
+            if (fkfs_header_read(fs, middle, &candidate, buffer) && candidate.generation == first.generation + middle) {
+                memcpy((void *)header, (void *)&candidate, sizeof(fkfs_header_t));
+                memcpy(fs->headerBlock, buffer, SD_RAW_BLOCK_SIZE);
+                low = middle;
+            }
+            else {
+                high = middle - 1;
+            }
+        }
+
+        return true;
+    }
+
+    // The first block of a new lap was being written, the last block of the
+    // previous one is the newest.
+    if (fkfs_header_read(fs, FKFS_HEADER_BLOCKS - 1, header, buffer)) {
+        memcpy(fs->headerBlock, buffer, SD_RAW_BLOCK_SIZE);
+        return true;
+    }
+
+    if (!fkfs_read_block(fs, 0, buffer)) {
+        return false;
+    }
+
+    fkfs_header_t *headers = (fkfs_header_t *)buffer;
+    auto valid0 = fkfs_header_crc_valid(&headers[0]);
+    auto valid1 = fkfs_header_crc_valid(&headers[1]);
+    if (!valid0 && !valid1) {
+        return false;
+    }
+
+    auto index = (!valid1 || (valid0 && headers[0].generation > headers[1].generation)) ? 0 : 1;
+    memcpy((void *)header, (void *)&headers[index], sizeof(fkfs_header_t));
+
+    fkfs_log("fkfs: moving headers out of block 0 (%d)", header->generation);
+
+    // Start the ring from its first block.
+    header->generation += FKFS_HEADER_BLOCKS - 1 - header->generation % FKFS_HEADER_BLOCKS;
+
+    return true;
+}
+
+// Windows start over once their appends are durable. Asynchronous commits
+// take them along until they're done.
+static void fkfs_windows_close(fkfs_t *fs) {
+    for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
+        fs->files[i].unsynced = 0;
+    }
+}
+
+static void fkfs_windows_take(fkfs_t *fs) {
+    for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
+        fs->pending.unsynced[i] = fs->files[i].unsynced;
+        fs->pending.unsyncedSince[i] = fs->files[i].unsyncedSince;
+    }
+    fkfs_windows_close(fs);
+}
+
+// The appends a failed commit took are still to be committed, and their
+// windows began before any since.
+static void fkfs_windows_return(fkfs_t *fs) {
+    for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
+        if (fs->pending.unsynced[i] > 0) {
+            fs->files[i].unsynced += fs->pending.unsynced[i];
+            fs->files[i].unsyncedSince = fs->pending.unsyncedSince[i];
+            fs->pending.unsynced[i] = 0;
+        }
+    }
+}
+
+static uint8_t fkfs_pending_failed(fkfs_t *fs) {
+    fkfs_log("fkfs: commit failed (%d)", fs->pending.state);
+    fs->pending.state = FKFS_PENDING_NONE;
+    fkfs_windows_return(fs);
+    return false;
+}
+
+uint8_t fkfs_poll(fkfs_t *fs) {
+    fkfs_pending_t *pending = &fs->pending;
+    fkfs_write_behind_t *wb = fkfs_write_behind_inflight(fs);
+
+    while (pending->state != FKFS_PENDING_NONE) {
+        // Nothing's been started when a commit begins, a failure the device
+        // still has is from a commit that's already been given up on.
+        if (pending->state != FKFS_PENDING_DATA) {
+            auto status = fkfs_device_poll(&fs->device);
+            if (status == FKFS_DEVICE_BUSY) {
+                fs->statistics.busyPolls++;
+                return FKFS_PENDING;
+            }
+            if (status == FKFS_DEVICE_FAILED) {
+                // Blocks that didn't make it stay queued for the next commit.
+                return fkfs_pending_failed(fs);
+            }
+        }
+
+        switch (pending->state) {
+        case FKFS_PENDING_DATA: {
+            if (wb->number > 0) {
+                fs->statistics.blockWrites += wb->number;
+                fs->statistics.burstWrites++;
+
+                if (!fkfs_device_write_start(&fs->device, wb->block, wb->number, (uint8_t *)wb->buffer)) {
+                    return fkfs_pending_failed(fs);
+                }
+                pending->state = FKFS_PENDING_HEADER;
+                break;
+            }
+            pending->state = FKFS_PENDING_HEADER;
+            // Fall through, the header's all there is to write.
+        }
+        case FKFS_PENDING_HEADER: {
+            // The data is on the card, so now the header can refer to it.
+            fkfs_write_behind_written(fs, wb);
+
+            if (!fkfs_device_flush(&fs->device)) {
+                return fkfs_pending_failed(fs);
+            }
+
+            fs->statistics.blockWrites++;
+
+            if (!fkfs_device_write_start(&fs->device, fkfs_header_location(pending->header.generation), 1, pending->block)) {
+                return fkfs_pending_failed(fs);
+            }
+            pending->state = FKFS_PENDING_DONE;
+            break;
+        }
+        default: {
+            if (!fkfs_device_flush(&fs->device)) {
+                return fkfs_pending_failed(fs);
+            }
+
+            fkfs_log_verbose("fkfs: commit done (%d)", pending->header.generation);
+            fs->durable = pending->sequence;
+            pending->state = FKFS_PENDING_NONE;
+            break;
+        }
+        }
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_wait(fkfs_t *fs) {
+    uint8_t status;
+    while ((status = fkfs_poll(fs)) == FKFS_PENDING) {
+    }
+    return status;
+}
+
+static void fkfs_cache_drop(fkfs_cache_entry_t *entry) {
+    entry->block = UINT32_MAX;
+    entry->dirty = false;
+    entry->used = 0;
+}
+
+static fkfs_cache_entry_t *fkfs_cache_find(fkfs_t *fs, uint32_t block) {
+    for (uint8_t i = 0; i < FKFS_CACHE_BLOCKS; ++i) {
+        fkfs_cache_entry_t *entry = &fs->cache[i];
+        if (entry->block == block) {
+            entry->used = ++fs->cacheClock;
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+// The head's entry, while it has appends that haven't been queued.
+static fkfs_cache_entry_t *fkfs_cache_dirty(fkfs_t *fs) {
+    for (uint8_t i = 0; i < FKFS_CACHE_BLOCKS; ++i) {
+        if (fs->cache[i].dirty) {
+            return &fs->cache[i];
+        }
+    }
+    return nullptr;
+}
+
+// Makes room for block in the least recently used entry. The only dirty
+// block is the head, it's queued to be written like a sealed one would be.
+// Readers pass clean and leave the head alone, unless it's the only entry.
+static fkfs_cache_entry_t *fkfs_cache_evict(fkfs_t *fs, uint32_t block, uint8_t clean) {
+    fkfs_cache_entry_t *entry = nullptr;
+    for (uint8_t i = 0; i < FKFS_CACHE_BLOCKS; ++i) {
+        if (FKFS_CACHE_BLOCKS > 1 && clean && fs->cache[i].dirty) {
+            continue;
+        }
+        if (entry == nullptr || fs->cache[i].used < entry->used) {
+            entry = &fs->cache[i];
+        }
+    }
+
+    if (entry->dirty) {
+        fs->statistics.cacheWritebacks++;
+        if (!fkfs_write_behind_append(fs, entry->block, entry->buffer)) {
+            return nullptr;
+        }
+        fs->inlineFrom = FKFS_BLOCK_DATA_SIZE;
+    }
+
+    entry->block = block;
+    entry->dirty = false;
+    entry->used = ++fs->cacheClock;
+
+    return entry;
+}
+
+// Iterators pass reader so that they never push out the head's appends.
+static fkfs_cache_entry_t *fkfs_block_ensure(fkfs_t *fs, uint32_t block, uint8_t reader) {
+    auto entry = fkfs_cache_find(fs, block);
+    if (entry != nullptr) {
+        fs->statistics.cacheHits++;
+        return entry;
+    }
+
+    fs->statistics.cacheMisses++;
+
+    entry = fkfs_cache_evict(fs, block, reader);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+
+    if (!fkfs_read_block(fs, block, entry->buffer)) {
+        fkfs_cache_drop(entry);
+        return nullptr;
+    }
+
+    return entry;
+}
+
+#if FKFS_READ_AHEAD_BLOCKS > 0
+// Like fkfs_block_ensure, only reading up to FKFS_READ_AHEAD_BLOCKS at once
+// for sequential readers. Runs stop short of the head and any blocks that are
+// waiting to be written, those are still changing.
+static fkfs_cache_entry_t *fkfs_block_ensure_ahead(fkfs_t *fs, uint32_t block, uint32_t lastBlock) {
+    fkfs_read_ahead_t *ra = &fs->readAhead;
+
+    auto entry = fkfs_cache_find(fs, block);
+    if (entry != nullptr) {
+        fs->statistics.cacheHits++;
+        return entry;
+    }
+
+    if (ra->number == 0 || block < ra->block || block >= ra->block + ra->number) {
+        uint32_t end = lastBlock >= block ? lastBlock + 1 : UINT32_MAX;
+        if (block < fs->header.block && fs->header.block < end) {
+            end = fs->header.block;
+        }
+        for (uint8_t i = 0; i < FKFS_WRITE_BEHIND_QUEUES; ++i) {
+            fkfs_write_behind_t *wb = &fs->writeBehind[i];
+            if (wb->number > 0 && block < wb->block && wb->block < end) {
+                end = wb->block;
+            }
+        }
+        if (end > fs->endBlock) {
+            end = fs->endBlock;
+        }
+
+        uint32_t number = end > block ? end - block : 0;
+        if (number > FKFS_READ_AHEAD_BLOCKS) {
+            number = FKFS_READ_AHEAD_BLOCKS;
+        }
+
+        if (number <= 1 || block == fs->header.block) {
+            return fkfs_block_ensure(fs, block, true);
+        }
+
+        fs->statistics.blockReads += number;
+        fs->statistics.burstReads++;
+
+        fkfs_log("fkfs: read ahead %d (%d)", block, number);
+
+        ra->number = 0;
+
+        auto started = millis();
+        auto status = fkfs_device_read_blocks(&fs->device, block, number, (uint8_t *)ra->buffer);
+
+        fs->statistics.readTime += millis() - started;
+
+        if (!status) {
+            return nullptr;
+        }
+
+        ra->block = block;
+        ra->number = number;
+    }
+
+    fs->statistics.cacheMisses++;
+
+    entry = fkfs_cache_evict(fs, block, true);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(entry->buffer, ra->buffer[block - ra->block], SD_RAW_BLOCK_SIZE);
+
+    return entry;
+}
+#else
+static fkfs_cache_entry_t *fkfs_block_ensure_ahead(fkfs_t *fs, uint32_t block, uint32_t lastBlock) {
+    return fkfs_block_ensure(fs, block, true);
+}
+#endif
+
+// The head while inlineSync can carry its appends since it was last queued in
+// the header's block instead.
+static fkfs_cache_entry_t *fkfs_inline_head(fkfs_t *fs) {
+    if (!fs->inlineSync || !fs->stamped || fs->inlineFrom >= fs->header.offset || fs->header.offset - fs->inlineFrom > FKFS_INLINE_SIZE) {
+        return nullptr;
+    }
+
+    auto head = fkfs_cache_dirty(fs);
+    if (head == nullptr || head->block != fs->header.block) {
+        return nullptr;
+    }
+
+    return head;
+}
+
+static uint16_t fkfs_inline_crc(fkfs_inline_t *tail) {
+    uint16_t crc = crc16_update(FKFS_INLINE_CRC_SEED, (uint8_t *)tail, offsetof(fkfs_inline_t, crc));
+    return crc16_update(crc, (uint8_t *)(tail + 1), tail->size);
+}
+
+// Fills in what follows the header in block, which is empty unless the head
+// is being held back.
+static void fkfs_inline_fill(fkfs_t *fs, uint8_t *block) {
+    fkfs_inline_t *tail = (fkfs_inline_t *)(block + FKFS_INLINE_OFFSET);
+
+    memzero(tail, sizeof(fkfs_inline_t));
+
+    auto head = fkfs_inline_head(fs);
+    if (head == nullptr) {
+        return;
+    }
+
+    tail->block = head->block;
+    tail->stamp = fs->stamp;
+    tail->offset = fs->inlineFrom;
+    tail->size = fs->header.offset - fs->inlineFrom;
+    memcpy((uint8_t *)(tail + 1), head->buffer + tail->offset, tail->size);
+    tail->crc = fkfs_inline_crc(tail);
+}
+
+// Puts what the header's block carried for the head into buffer, the head
+// as it is on the card. Returns whether that changed anything.
+static uint8_t fkfs_inline_replay(fkfs_t *fs, uint8_t *buffer) {
+    fkfs_inline_t *tail = (fkfs_inline_t *)(fs->headerBlock + FKFS_INLINE_OFFSET);
+    uint8_t *data = (uint8_t *)(tail + 1);
+
+    if (tail->size == 0 || tail->size > FKFS_INLINE_SIZE || tail->crc != fkfs_inline_crc(tail)) {
+        return false;
+    }
+    if (tail->block != fs->header.block || tail->offset + tail->size != fs->header.offset) {
+        return false;
+    }
+
+    uint32_t stamp;
+    if (fkfs_block_stamped(buffer, &stamp) && stamp == tail->stamp && memcmp(buffer + tail->offset, data, tail->size) == 0) {
+        return false;
+    }
+
+    fkfs_log("fkfs: inline replay %d (%d, %d)", tail->block, tail->offset, tail->size);
+
+    memcpy(buffer + tail->offset, data, tail->size);
+    fkfs_block_stamp(buffer, tail->stamp);
+
+    return true;
+}
+
+// Lines the data region up with the card's allocation units, so the log
+// fills whole units one after another and wraps at the end of one. Devices
+// that don't know (or units too large for the device) get the defaults. This
+// is only for new cards, after that the region comes from the header. Devices
+// too small to have any blocks in the region can't be used.
+static uint8_t fkfs_initialize_region(fkfs_t *fs) {
+    uint32_t au = fkfs_device_allocation_unit(&fs->device);
+
+    fs->firstBlock = FKFS_FIRST_BLOCK;
+    fs->endBlock = fs->numberOfBlocks > 2 ? fs->numberOfBlocks - 2 : 0;
+
+    if (au > 1) {
+        uint32_t first = (FKFS_FIRST_BLOCK + au - 1) / au * au;
+        uint32_t end = fs->endBlock / au * au;
+        if (first < end) {
+            fs->firstBlock = first;
+            fs->endBlock = end;
+        }
+    }
+
+    fkfs_log("fkfs: region %d - %d (au %d)", fs->firstBlock, fs->endBlock, au);
+
+    return fs->firstBlock < fs->endBlock;
+}
+
+// Takes the region from the header's block. Headers from before regions were
+// kept don't have one, those cards were written with the default bounds.
+static uint8_t fkfs_region_load(fkfs_t *fs) {
+    fkfs_region_t *region = (fkfs_region_t *)(fs->headerBlock + FKFS_REGION_OFFSET);
+
+    if (region->crc == fkfs_region_crc(region) && region->firstBlock >= FKFS_HEADER_FIRST_BLOCK + FKFS_HEADER_BLOCKS &&
+        region->firstBlock < region->endBlock && region->endBlock <= fs->numberOfBlocks) {
+        fs->firstBlock = region->firstBlock;
+        fs->endBlock = region->endBlock;
+    }
+    else {
+        fs->firstBlock = FKFS_FIRST_BLOCK;
+        fs->endBlock = fs->numberOfBlocks > 2 ? fs->numberOfBlocks - 2 : 0;
+    }
+
+    fkfs_log("fkfs: region %d - %d", fs->firstBlock, fs->endBlock);
+
+    return fs->firstBlock < fs->endBlock;
+}
+
+// A head outside the region would never wrap, so the log starts over at the
+// region's first block. Files that aren't inside it any more are emptied.
+static void fkfs_region_clamp(fkfs_t *fs) {
+    if (fs->header.block >= fs->firstBlock && fs->header.block < fs->endBlock) {
+        return;
+    }
+
+    fkfs_log("fkfs: head %d outside region %d - %d", fs->header.block, fs->firstBlock, fs->endBlock);
+
+    fs->header.block = fs->firstBlock;
+    fs->header.offset = 0;
+
+    for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
+        fkfs_file_t *file = &fs->header.files[i];
+        if (file->startBlock < fs->firstBlock || file->startBlock >= fs->endBlock ||
+            file->endBlock < fs->firstBlock || file->endBlock >= fs->endBlock) {
+            file->version++;
+            file->startBlock = fs->header.block;
+            file->startOffset = 0;
+            file->endBlock = fs->header.block;
+            file->endOffset = 0;
+            file->size = 0;
+        }
+    }
+}
+
+// The block after this one, wrapping around the data region.
+static uint32_t fkfs_block_next(fkfs_t *fs, uint32_t block) {
+    block++;
+    if (block == fs->endBlock) {
+        return fs->firstBlock;
+    }
+    return block;
+}
+
+uint8_t fkfs_initialize(fkfs_t *fs, bool wipe) {
+    // Default to the SD card on hardware, hosts have to choose a device.
+    if (fs->device.ops == nullptr) {
+#ifdef ARDUINO
+        fkfs_device_sd_open(&fs->device, &fs->sd);
+#else
+        fkfs_log("fkfs: no device");
+        return false;
+#endif
+    }
+
+    fs->numberOfBlocks = fkfs_device_size(&fs->device);
+    for (uint8_t i = 0; i < FKFS_CACHE_BLOCKS; ++i) {
+        fkfs_cache_drop(&fs->cache[i]);
+    }
+    fs->cacheClock = 0;
+    for (uint8_t i = 0; i < FKFS_WRITE_BEHIND_QUEUES; ++i) {
+        fs->writeBehind[i].number = 0;
+    }
+    fs->filling = 0;
+    fkfs_read_ahead_drop(fs, 0, UINT32_MAX);
+    fs->pending.state = FKFS_PENDING_NONE;
+    fs->sequence = 0;
+    fs->durable = 0;
+    fs->stamp = 0;
+    fs->inlineFrom = FKFS_BLOCK_DATA_SIZE;
+    for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
+        fs->files[i].unsynced = 0;
+    }
+
+    fkfs_statistics_zero(&fs->statistics);
+
+    uint8_t buffer[SD_RAW_BLOCK_SIZE];
+    fkfs_header_t found;
+
+    memset(fs->headerBlock, 0, SD_RAW_BLOCK_SIZE);
+
+    auto existing = fkfs_header_find(fs, &found, buffer);
+
+    // If there's no valid header, then we're on a new card.
+    if (fs->readOnly && (wipe || !existing)) {
+        fkfs_log("fkfs: no header (read only)");
+        return false;
+    }
+    if (wipe || !existing) {
+        fkfs_log("fkfs: initialize/wipe");
+
+        if (!fkfs_initialize_region(fs)) {
+            return false;
+        }
+
+        fs->header.block = fs->firstBlock;
+        fs->header.offset = 0;
+        fs->header.generation = 0;
+
+        // New filesystem... initialize a blank header and new versions of all
+        // files. Versions always change on a wipe, so that fkfs_recover can't
+        // take what was there before for new entries.
+        for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
+            fs->header.files[i].version = existing ? found.files[i].version + 1 : random(UINT16_MAX);
+            fs->header.files[i].size = 0;
+            fs->header.files[i].startBlock = fs->header.block;
+            fs->header.files[i].startOffset = 0;
+            fs->header.files[i].endBlock = fs->header.block;
+            fs->header.files[i].endOffset = 0;
+
+            fkfs_log("file[%d] sync=%d pri=%d sb=%d eb=%d version=%d size=%d '%s'", i,
+                     fs->files[i].sync,
+                     fs->files[i].priority,
+                     fs->header.files[i].startBlock,
+                     fs->header.files[i].endBlock,
+                     fs->header.files[i].version,
+                     fs->header.files[i].size,
+                     fs->header.files[i].name);
+        }
+
+        // Stamps carry on from before the wipe, past anything that could have
+        // been written, so old blocks never pass for new ones.
+        fs->stamp = 0;
+        if (existing) {
+            uint32_t previous;
+            auto known = fkfs_region_stamp(fs, &previous);
+            if (!known) {
+                if (!fkfs_read_block(fs, found.block, buffer)) {
+                    return false;
+                }
+                known = fkfs_block_stamped(buffer, &previous);
+            }
+            if (known) {
+                fs->stamp = previous + 2 * (fs->endBlock - fs->firstBlock);
+            }
+        }
+
+        if (!fkfs_header_wipe(fs)) {
+            return false;
+        }
+
+        // The head starts out empty and stamped, whatever was there before.
+        memset(buffer, 0, SD_RAW_BLOCK_SIZE);
+        fkfs_block_stamp(buffer, fs->stamp);
+        fs->stamped = true;
+        if (!fkfs_write_block(fs, fs->header.block, buffer)) {
+            return false;
+        }
+
+        if (!fkfs_header_write(fs)) {
+            return false;
+        }
+    }
+    else {
+        for (auto i = 0; i < FKFS_FILES_MAX; ++i) {
+            strncpy(found.files[i].name, fs->header.files[i].name, sizeof(found.files[i].name));
+        }
+
+        memcpy((void *)&fs->header, (void *)&found, sizeof(fkfs_header_t));
+
+        if (!fkfs_region_load(fs)) {
+            return false;
+        }
+        fkfs_region_clamp(fs);
+
+        if (!fkfs_recover(fs, buffer)) {
+            return false;
+        }
+    }
+
+    // Nothing's known to be erased until fkfs_idle has been over it.
+    fs->erasedUntil = fkfs_block_next(fs, fs->header.block);
+
+    return true;
+}
+
+static uint16_t fkfs_block_crc(fkfs_t *fs, fkfs_file_t *file, fkfs_entry_t *entry, uint8_t *data) {
+    uint16_t crc = file->version;
+
+    crc = crc16_update(crc, (uint8_t *)entry, FKFS_ENTRY_SIZE_MINUS_CRC);
+    crc = crc16_update(crc, (uint8_t *)data, entry->size);
+
+    return crc;
+}
+
+#define FKFS_OFFSET_SEARCH_STATUS_GOOD      0
+#define FKFS_OFFSET_SEARCH_STATUS_SIZE      1
+#define FKFS_OFFSET_SEARCH_STATUS_CRC       2
+#define FKFS_OFFSET_SEARCH_STATUS_PRIORITY  3
+#define FKFS_OFFSET_SEARCH_STATUS_EOB       4
+
+static const char *block_check_str(uint8_t check) {
+    switch (check) {
+    case FKFS_OFFSET_SEARCH_STATUS_GOOD: return "good";
+    case FKFS_OFFSET_SEARCH_STATUS_SIZE: return "size";
+    case FKFS_OFFSET_SEARCH_STATUS_CRC: return "crc";
+    case FKFS_OFFSET_SEARCH_STATUS_PRIORITY: return "priority";
+    case FKFS_OFFSET_SEARCH_STATUS_EOB: return "eob";
+    default:
+        return "unknown";
+    }
+}
+
+typedef struct fkfs_offset_search_t {
+    uint16_t offset;
+    uint8_t status;
+} fkfs_offset_search_t;
+
+static uint8_t fkfs_block_check(fkfs_t *fs, uint8_t *ptr) {
+    fkfs_entry_t *entry = (fkfs_entry_t *)ptr;
+
+    if (entry->file >= FKFS_FILES_MAX) {
+        return FKFS_OFFSET_SEARCH_STATUS_SIZE;
+    }
+
+    // TODO: This should really compare to the header adjusted lengths....
+    if (entry->size == 0 || entry->size >= SD_RAW_BLOCK_SIZE ||
+        entry->available == 0 || entry->available >= SD_RAW_BLOCK_SIZE) {
+        return FKFS_OFFSET_SEARCH_STATUS_SIZE;
+    }
+
+    fkfs_file_t *blockFile = &fs->header.files[entry->file];
+    uint8_t *data = ptr + sizeof(fkfs_entry_t);
+    uint16_t expected = fkfs_block_crc(fs, blockFile, entry, data);
+    if (entry->crc != expected) {
+        return FKFS_OFFSET_SEARCH_STATUS_CRC;
+    }
+
+    return FKFS_OFFSET_SEARCH_STATUS_GOOD;
+}
+
+// Like fkfs_block_check, for the entry at offset in a block that was read
+// from the card and can hold anything. Entries that would run past the end of
+// the block are never read.
+static uint8_t fkfs_block_check_at(fkfs_t *fs, uint8_t *buffer, uint16_t offset) {
+    if (offset + sizeof(fkfs_entry_t) > SD_RAW_BLOCK_SIZE) {
+        return FKFS_OFFSET_SEARCH_STATUS_SIZE;
+    }
+
+    auto entry = (fkfs_entry_t *)(buffer + offset);
+    if (offset + sizeof(fkfs_entry_t) + entry->size > SD_RAW_BLOCK_SIZE) {
+        return FKFS_OFFSET_SEARCH_STATUS_SIZE;
+    }
+
+    return fkfs_block_check(fs, buffer + offset);
+}
+
+// Whether buffer has room for a trailer after the entries the allocator would
+// keep. Blocks written before trailers may not, and are never stamped.
+static uint8_t fkfs_block_stampable(fkfs_t *fs, uint8_t *buffer) {
+    uint16_t offset = 0;
+
+    while (fkfs_block_check_at(fs, buffer, offset) == FKFS_OFFSET_SEARCH_STATUS_GOOD) {
+        auto entry = (fkfs_entry_t *)(buffer + offset);
+        offset += sizeof(fkfs_entry_t) + entry->available;
+    }
+
+    return offset <= FKFS_BLOCK_DATA_SIZE;
+}
+
+// Number of blocks from one block forward to another, around the data region.
+static uint32_t fkfs_block_distance(fkfs_t *fs, uint32_t from, uint32_t to) {
+    if (to >= from) {
+        return to - from;
+    }
+    return (fs->endBlock - from) + (to - fs->firstBlock);
+}
+
+// Whether the entry at block/offset is one the committed header already has,
+// left over from before the log wrapped around.
+static uint8_t fkfs_recover_committed(fkfs_t *fs, fkfs_file_t *file, uint32_t block, uint16_t offset) {
+    if (block == file->endBlock) {
+        return offset < file->endOffset;
+    }
+    return fkfs_block_distance(fs, file->startBlock, block) < fkfs_block_distance(fs, file->startBlock, file->endBlock);
+}
+
+static uint32_t fkfs_block_forward(fkfs_t *fs, uint32_t block, uint32_t distance) {
+    return fs->firstBlock + (block - fs->firstBlock + distance) % (fs->endBlock - fs->firstBlock);
+}
+
+// Takes in the entries in buffer from offset on that the committed header
+// doesn't have. Entries ahead of the head can be older ones the allocator
+// kept, those are told apart by the files' committed ranges.
+static void fkfs_recover_block(fkfs_t *fs, fkfs_header_t *committed, uint32_t block, uint16_t offset, uint8_t *buffer) {
+    while (offset + sizeof(fkfs_entry_t) < FKFS_BLOCK_DATA_SIZE) {
+        if (fkfs_block_check_at(fs, buffer, offset) != FKFS_OFFSET_SEARCH_STATUS_GOOD) {
+            break;
+        }
+
+        auto entry = (fkfs_entry_t *)(buffer + offset);
+        auto committedEntry = fkfs_recover_committed(fs, &committed->files[entry->file], block, offset);
+
+        offset += sizeof(fkfs_entry_t) + entry->available;
+
+        if (!committedEntry) {
+            fkfs_file_t *file = &fs->header.files[entry->file];
+            file->endBlock = block;
+            file->endOffset = offset;
+            file->size += entry->size;
+
+            fs->header.block = block;
+            fs->header.offset = offset;
+            fs->statistics.recoveredEntries++;
+        }
+    }
+}
+
+// Whether the block distance ahead of head was written after the header was
+// committed. Blocks with no room for a stamp can't say, so the first block
+// after them that can answers for them. The allocator gives up after
+// FKFS_SEEK_BLOCKS_MAX blocks, so the head never moves past more of them than
+// that in a row.
+static uint8_t fkfs_recover_written(fkfs_t *fs, uint32_t head, uint32_t stamp, uint32_t distance, uint8_t *buffer, uint8_t *written) {
+    uint32_t region = fs->endBlock - fs->firstBlock;
+
+    *written = false;
+
+    for (uint32_t i = 0; i < FKFS_SEEK_BLOCKS_MAX && distance + i < region; ++i) {
+        if (!fkfs_read_block(fs, fkfs_block_forward(fs, head, distance + i), buffer)) {
+            return false;
+        }
+
+        uint32_t found;
+        if (fkfs_block_stamped(buffer, &found)) {
+            *written = found == stamp + distance + i;
+            break;
+        }
+
+        if (fkfs_block_stampable(fs, buffer)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+// Without a stamp for the head, goes on from it through blocks that have new
+// entries, at most FKFS_RECOVER_BLOCKS of them.
+static uint8_t fkfs_recover_scan(fkfs_t *fs, fkfs_header_t *committed, uint8_t *buffer) {
+    uint32_t block = fs->header.block;
+
+    fkfs_recover_block(fs, committed, block, fs->header.offset, buffer);
+
+    for (uint32_t i = 1; i < FKFS_RECOVER_BLOCKS; ++i) {
+        auto recovered = fs->statistics.recoveredEntries;
+
+        block = fkfs_block_next(fs, block);
+
+        if (!fkfs_read_block(fs, block, buffer)) {
+            return false;
+        }
+
+        fkfs_recover_block(fs, committed, block, 0, buffer);
+
+        // Past the head, a block with nothing new is where writing stopped.
+        if (fs->statistics.recoveredEntries == recovered) {
+            break;
+        }
+
+        fs->stamped = fkfs_block_stampable(fs, buffer);
+    }
+
+    if (fs->statistics.recoveredEntries > 0) {
+        fkfs_log("fkfs: recovered %d entries (%d, %d)", fs->statistics.recoveredEntries, fs->header.block, fs->header.offset);
+    }
+
+    return true;
+}
+
+// Rolls the header forward over entries that were written after it was
+// committed. The last block written is found from the stamps by galloping
+// ahead of the head and then a binary search, so only the blocks with new
+// entries are read through.
+static uint8_t fkfs_recover(fkfs_t *fs, uint8_t *buffer) {
+    fkfs_header_t committed;
+    memcpy((void *)&committed, (void *)&fs->header, sizeof(fkfs_header_t));
+
+    uint32_t head = fs->header.block;
+    uint32_t stamp;
+    uint32_t trailer;
+
+    auto known = fkfs_region_stamp(fs, &stamp);
+
+    if (!fkfs_read_block(fs, head, buffer)) {
+        return false;
+    }
+
+    // Appends the last commit only had in the header's block go to the head
+    // now, before anything can be written after them. The head is only
+    // changed in the cache, it's written with whatever's appended next.
+    if (fkfs_inline_replay(fs, buffer)) {
+        auto entry = fkfs_cache_evict(fs, head, false);
+        if (entry == nullptr) {
+            return false;
+        }
+        memcpy(entry->buffer, buffer, SD_RAW_BLOCK_SIZE);
+        entry->dirty = true;
+    }
+
+    fs->stamped = fkfs_block_stampable(fs, buffer);
+
+    if (!known && fkfs_block_stamped(buffer, &trailer)) {
+        stamp = trailer;
+        known = true;
+    }
+
+    // Written before blocks were stamped.
+    if (!known) {
+        return fkfs_recover_scan(fs, &committed, buffer);
+    }
+
+    fkfs_recover_block(fs, &committed, head, fs->header.offset, buffer);
+
+    uint32_t region = fs->endBlock - fs->firstBlock;
+    uint32_t low = 0;
+    uint32_t high = 1;
+    uint8_t written = false;
+
+    while (high < region) {
+        if (!fkfs_recover_written(fs, head, stamp, high, buffer, &written)) {
+            return false;
+        }
+        if (!written) {
+            break;
+        }
+        low = high;
+        high = high * 2;
+    }
+
+    if (high > region) {
+        high = region;
+    }
+
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (!fkfs_recover_written(fs, head, stamp, middle, buffer, &written)) {
+            return false;
+        }
+        if (written) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    for (uint32_t i = 1; i <= low; ++i) {
+        uint32_t block = fkfs_block_forward(fs, head, i);
+
+        if (!fkfs_read_block(fs, block, buffer)) {
+            return false;
+        }
+
+        fkfs_recover_block(fs, &committed, block, 0, buffer);
+    }
+
+    // The head had moved on to the last block even if it has nothing new.
+    // Being written makes it stamped. A replayed head is queued behind it.
+    if (low > 0) {
+        if (!fkfs_head_queue(fs)) {
+            return false;
+        }
+        if (fs->header.block != fkfs_block_forward(fs, head, low)) {
+            fs->header.block = fkfs_block_forward(fs, head, low);
+            fs->header.offset = 0;
+        }
+        fs->stamped = true;
+    }
+
+    fs->stamp = stamp + low;
 
-static uint8_t fkfs_read_block(fkfs_t *fs, uint32_t block, uint8_t *buffer) {
-    fs->statistics.blockReads++;
+    if (fs->statistics.recoveredEntries > 0 || low > 0) {
+        fkfs_log("fkfs: recovered %d entries (%d blocks, %d, %d)", fs->statistics.recoveredEntries, low, fs->header.block, fs->header.offset);
+    }
 
-    fkfs_log("fkfs: read block %d (%x)", block, buffer);
+    return true;
+}
 
-    auto started = millis();
-    auto status = true;
-    if (!sd_raw_read_block(&fs->sd, block, (uint8_t *)buffer)) {
-        status = false;
+// Blocks we're holding on to are at least as new as the ones on the card.
+static uint8_t *fkfs_block_memory(fkfs_t *fs, uint32_t block) {
+    auto entry = fkfs_cache_find(fs, block);
+    if (entry != nullptr) {
+        return entry->buffer;
+    }
+    auto queued = fkfs_write_behind_find(fs, block);
+    if (queued != nullptr) {
+        return queued;
     }
 
-    fs->statistics.readTime += millis() - started;
-
-    return status;
+    return fkfs_read_ahead_find(fs, block);
 }
 
-static uint8_t fkfs_write_block(fkfs_t *fs, uint32_t block, uint8_t *buffer) {
-    fs->statistics.blockWrites++;
+static uint8_t fkfs_read_partial(fkfs_t *fs, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    auto memory = fkfs_block_memory(fs, block);
+    if (memory != nullptr) {
+        memcpy(destiny, memory + offset, size);
+        return true;
+    }
+
+    fs->statistics.partialReads++;
+    fs->statistics.partialBytes += size;
 
     auto started = millis();
-    auto status = true;
-    if (!sd_raw_write_block(&fs->sd, block, (uint8_t *)buffer)) {
-        status = false;
-    }
+    auto status = fkfs_device_read_partial(&fs->device, block, offset, size, destiny);
 
-    fs->statistics.writeTime += millis() - started;
+    fs->statistics.readTime += millis() - started;
 
     return status;
 }
 
-static uint8_t fkfs_header_write(fkfs_t *fs, bool wipe) {
-    uint8_t buffer[SD_RAW_BLOCK_SIZE] = { 0 };
+// Like fkfs_block_check, only reading the entry header and, if the entry
+// belongs to the given file, the data into buffer. Entries of other files
+// are taken as they are, iterators only need to know how far to skip.
+static uint8_t fkfs_block_check_partial(fkfs_t *fs, uint32_t block, uint16_t offset, uint8_t file, uint8_t *buffer, uint16_t bufferSize, fkfs_entry_t *entry, uint8_t *check) {
+    if (offset + sizeof(fkfs_entry_t) > SD_RAW_BLOCK_SIZE) {
+        *check = FKFS_OFFSET_SEARCH_STATUS_SIZE;
+        return true;
+    }
 
-    if (!wipe) {
-        if (!fkfs_read_block(fs, 0, (uint8_t *)buffer)) {
-            return false;
-        }
+    if (!fkfs_read_partial(fs, block, offset, sizeof(fkfs_entry_t), (uint8_t *)entry)) {
+        return false;
     }
 
-    fkfs_header_t *headers = (fkfs_header_t *)buffer;
+    if (entry->file >= FKFS_FILES_MAX ||
+        entry->size == 0 || entry->size >= SD_RAW_BLOCK_SIZE ||
+        entry->available == 0 || entry->available >= SD_RAW_BLOCK_SIZE ||
+        offset + sizeof(fkfs_entry_t) + entry->size > SD_RAW_BLOCK_SIZE) {
+        *check = FKFS_OFFSET_SEARCH_STATUS_SIZE;
+        return true;
+    }
 
-    fkfs_header_crc_update(&fs->header);
+    if (entry->file != file) {
+        *check = FKFS_OFFSET_SEARCH_STATUS_GOOD;
+        return true;
+    }
 
-    memcpy((void *)&headers[fs->headerIndex], (void *)&fs->header, sizeof(fkfs_header_t));
+    if (entry->size > bufferSize) {
+        fkfs_log("fkfs: entry too large for buffer (%d > %d)", entry->size, bufferSize);
+        return false;
+    }
 
-    if (!fkfs_write_block(fs, 0, (uint8_t *)buffer)) {
+    if (!fkfs_read_partial(fs, block, offset + sizeof(fkfs_entry_t), entry->size, buffer)) {
         return false;
     }
 
+    uint16_t expected = fkfs_block_crc(fs, &fs->header.files[entry->file], entry, buffer);
+    *check = entry->crc == expected ? FKFS_OFFSET_SEARCH_STATUS_GOOD : FKFS_OFFSET_SEARCH_STATUS_CRC;
+
     return true;
 }
 
-static uint8_t fkfs_block_ensure(fkfs_t *fs, uint32_t block) {
-    if (fs->cachedBlockNumber != block) {
-        if (!fkfs_read_block(fs, block, (uint8_t *)fs->buffer)) {
-            return false;
-        }
-        fs->cachedBlockNumber = block;
-        fs->cachedBlockDirty = false;
+uint32_t fkfs_erased_ahead(fkfs_t *fs) {
+    uint32_t next = fkfs_block_next(fs, fs->header.block);
+    if (fs->erasedUntil >= next) {
+        return fs->erasedUntil - next;
     }
-    return true;
+    return (fs->endBlock - next) + (fs->erasedUntil - fs->firstBlock);
 }
 
-uint8_t fkfs_initialize(fkfs_t *fs, bool wipe) {
-    fs->numberOfBlocks = sd_raw_card_size(&fs->sd);
+// Called as the head moves onto a block, which may be one fkfs_idle erased.
+static void fkfs_erase_advance(fkfs_t *fs) {
+    if (fs->erasedUntil != fs->header.block) {
+        fs->statistics.erasedWrites++;
+    }
+    else {
+        fs->erasedUntil = fkfs_block_next(fs, fs->header.block);
+    }
+}
 
-    memzero(fs->buffer, sizeof(SD_RAW_BLOCK_SIZE));
+static uint8_t fkfs_erase_run(fkfs_t *fs, uint32_t first, uint32_t number) {
+    if (number == 0) {
+        return true;
+    }
 
-    fkfs_statistics_zero(&fs->statistics);
+    fkfs_log_verbose("fkfs: erase %d (%d)", first, number);
 
-    if (!fkfs_read_block(fs, 0, (uint8_t *)fs->buffer)) {
+    if (!fkfs_device_erase(&fs->device, first, first + number - 1)) {
         return false;
     }
 
-    fkfs_header_t *headers = (fkfs_header_t *)fs->buffer;
-
-    // If both checksums fail, then we're on a new card.
-    // TODO: May want to make this configurable?
-    if (wipe || (!fkfs_header_crc_valid(&headers[0]) && !fkfs_header_crc_valid(&headers[1]))) {
-        fkfs_log("fkfs: initialize/wipe");
-
-        fs->header.block = FKFS_FIRST_BLOCK;
-        fs->header.generation = 0;
-
-        // New filesystem... initialize a blank header and new versions of all files.
-        for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
-            fs->header.files[i].version = random(UINT16_MAX);
-            fs->header.files[i].size = 0;
-            fs->header.files[i].startBlock = fs->header.block;
-            fs->header.files[i].startOffset = 0;
-            fs->header.files[i].endBlock = fs->header.block;
-            fs->header.files[i].endOffset = 0;
-
-            fkfs_log("file[%d] sync=%d pri=%d sb=%d eb=%d version=%d size=%d '%s'", i,
-                     fs->files[i].sync,
-                     fs->files[i].priority,
-                     fs->header.files[i].startBlock,
-                     fs->header.files[i].endBlock,
-                     fs->header.files[i].version,
-                     fs->header.files[i].size,
-                     fs->header.files[i].name);
-        }
-
-        memcpy((void *)&headers[fs->headerIndex], (void *)&fs->header, sizeof(fkfs_header_t));
+    fs->statistics.erasedBlocks += number;
 
-        if (!fkfs_header_write(fs, true)) {
-            return false;
+    // Only an iterator's blocks could be cached here, the head never is.
+    for (uint8_t i = 0; i < FKFS_CACHE_BLOCKS; ++i) {
+        fkfs_cache_entry_t *entry = &fs->cache[i];
+        if (!entry->dirty && entry->block >= first && entry->block < first + number) {
+            fkfs_cache_drop(entry);
         }
+    }
+    fkfs_read_ahead_drop(fs, first, number);
 
-        fs->header.generation = 1;
-        fs->headerIndex = 1;
+    return true;
+}
 
-        memcpy((void *)&headers[fs->headerIndex], (void *)&fs->header, sizeof(fkfs_header_t));
+// Whether any sync file has gone past its window since the last commit.
+static uint8_t fkfs_sync_due(fkfs_t *fs) {
+    auto now = millis();
 
-        if (!fkfs_header_write(fs, false)) {
-            return false;
-        }
-    }
-    else {
-        if (!fkfs_header_crc_valid(&headers[1])) {
-            fs->headerIndex = 0;
-        }
-        else if (!fkfs_header_crc_valid(&headers[0])) {
-            fs->headerIndex = 1;
+    for (uint8_t i = 0; i < FKFS_FILES_MAX; ++i) {
+        fkfs_file_runtime_settings_t *settings = &fs->files[i];
+        if (!settings->sync || settings->unsynced == 0) {
+            continue;
         }
-        else if (headers[0].generation > headers[1].generation) {
-            fs->headerIndex = 0;
+        if (settings->syncBytes == 0 && settings->syncInterval == 0) {
+            return true;
         }
-        else {
-            fs->headerIndex = 1;
+        if (settings->syncBytes > 0 && settings->unsynced >= settings->syncBytes) {
+            return true;
         }
-
-        for (auto i = 0; i < FKFS_FILES_MAX; ++i) {
-            strncpy(headers[fs->headerIndex].files[i].name, fs->header.files[i].name, sizeof(headers[fs->headerIndex].files[i].name));
+        if (settings->syncInterval > 0 && now - settings->unsyncedSince >= settings->syncInterval) {
+            return true;
         }
-
-        memcpy((void *)&fs->header, (void *)&headers[fs->headerIndex], sizeof(fkfs_header_t));
     }
 
-    return true;
+    return false;
 }
 
-static uint16_t fkfs_block_crc(fkfs_t *fs, fkfs_file_t *file, fkfs_entry_t *entry, uint8_t *data) {
-    uint16_t crc = file->version;
-
-    crc = crc16_update(crc, (uint8_t *)entry, FKFS_ENTRY_SIZE_MINUS_CRC);
-    crc = crc16_update(crc, (uint8_t *)data, entry->size);
+uint32_t fkfs_sequence(fkfs_t *fs) {
+    return fs->sequence;
+}
 
-    return crc;
+uint32_t fkfs_durable(fkfs_t *fs) {
+    return fs->durable;
 }
 
-#define FKFS_OFFSET_SEARCH_STATUS_GOOD      0
-#define FKFS_OFFSET_SEARCH_STATUS_SIZE      1
-#define FKFS_OFFSET_SEARCH_STATUS_CRC       2
-#define FKFS_OFFSET_SEARCH_STATUS_PRIORITY  3
-#define FKFS_OFFSET_SEARCH_STATUS_EOB       4
+uint8_t fkfs_idle(fkfs_t *fs) {
+    uint8_t buffer[SD_RAW_BLOCK_SIZE];
 
-static const char *block_check_str(uint8_t check) {
-    switch (check) {
-    case FKFS_OFFSET_SEARCH_STATUS_GOOD: return "good";
-    case FKFS_OFFSET_SEARCH_STATUS_SIZE: return "size";
-    case FKFS_OFFSET_SEARCH_STATUS_CRC: return "crc";
-    case FKFS_OFFSET_SEARCH_STATUS_PRIORITY: return "priority";
-    case FKFS_OFFSET_SEARCH_STATUS_EOB: return "eob";
-    default:
-        return "unknown";
+    if (fs->pending.state != FKFS_PENDING_NONE) {
+        return fkfs_poll(fs);
     }
-}
 
-typedef struct fkfs_offset_search_t {
-    uint16_t offset;
-    uint8_t status;
-} fkfs_offset_search_t;
+    // Sync files with a time window still commit when appends stop.
+    if (fkfs_sync_due(fs)) {
+        return fkfs_sync(fs);
+    }
 
-static uint8_t fkfs_block_check(fkfs_t *fs, uint8_t *ptr) {
-    fkfs_entry_t *entry = (fkfs_entry_t *)ptr;
+    uint32_t block = fs->erasedUntil;
+    uint32_t first = block;
+    uint32_t number = 0;
 
-    if (entry->file >= FKFS_FILES_MAX) {
-        return FKFS_OFFSET_SEARCH_STATUS_SIZE;
-    }
+    for (uint32_t i = 0; i < FKFS_ERASE_BLOCKS && fkfs_erased_ahead(fs) + number < fs->eraseAhead; ++i) {
+        // Never go all the way around to the head and what's waiting behind it.
+        if (block == fs->header.block || fkfs_write_behind_find(fs, block) != nullptr) {
+            break;
+        }
 
-    // TODO: This should really compare to the header adjusted lengths....
-    if (entry->size == 0 || entry->size >= SD_RAW_BLOCK_SIZE ||
-        entry->available == 0 || entry->available >= SD_RAW_BLOCK_SIZE) {
-        return FKFS_OFFSET_SEARCH_STATUS_SIZE;
+        if (!fkfs_read_block(fs, block, buffer)) {
+            return false;
+        }
+
+        // The allocator writes over blocks that don't start with a valid entry.
+        auto erasable = fkfs_block_check_at(fs, buffer, 0) != FKFS_OFFSET_SEARCH_STATUS_GOOD;
+
+        if (!erasable || (number > 0 && block != first + number)) {
+            if (!fkfs_erase_run(fs, first, number)) {
+                return false;
+            }
+            fs->erasedUntil = block;
+            number = 0;
+        }
+
+        if (erasable) {
+            if (number == 0) {
+                first = block;
+            }
+            number++;
+        }
+        else {
+            fs->statistics.preservedBlocks++;
+            fs->erasedUntil = fkfs_block_next(fs, block);
+        }
+
+        block = fkfs_block_next(fs, block);
     }
 
-    fkfs_file_t *blockFile = &fs->header.files[entry->file];
-    uint8_t *data = ptr + sizeof(fkfs_entry_t);
-    uint16_t expected = fkfs_block_crc(fs, blockFile, entry, data);
-    if (entry->crc != expected) {
-        return FKFS_OFFSET_SEARCH_STATUS_CRC;
+    if (!fkfs_erase_run(fs, first, number)) {
+        return false;
     }
 
-    return FKFS_OFFSET_SEARCH_STATUS_GOOD;
+    fs->erasedUntil = block;
+
+    return true;
 }
 
 static uint8_t fkfs_block_available_offset(fkfs_t *fs, fkfs_file_t *file, uint8_t priority, uint16_t required, uint8_t *buffer, fkfs_offset_search_t *search) {
@@ -367,7 +1587,7 @@ static uint8_t fkfs_block_available_offset(fkfs_t *fs, fkfs_file_t *file, uint8_
         iter = buffer + search->offset;
         entry = (fkfs_entry_t *)iter;
     }
-    while (search->offset + required < SD_RAW_BLOCK_SIZE);
+    while (search->offset + required < FKFS_BLOCK_DATA_SIZE);
 
     search->status = FKFS_OFFSET_SEARCH_STATUS_EOB;
 
@@ -385,69 +1605,171 @@ static uint8_t fkfs_block_available_offset(fkfs_t *fs, fkfs_file_t *file, uint8_
     return false;
 }
 
-static uint8_t fkfs_fsync(fkfs_t *fs) {
-    if (fs->cachedBlockDirty) {
-        if (!fkfs_write_block(fs, fs->header.block, (uint8_t *)fs->buffer)) {
+static uint8_t fkfs_header_commit(fkfs_t *fs) {
+    fs->header.generation++;
+
+    if (!fkfs_header_write(fs)) {
+        return false;
+    }
+
+    fs->durable = fs->sequence;
+
+    return true;
+}
+
+// Writes the queued blocks and then the header. Asynchronously this only
+// starts the commit, using a snapshot of the header, and fkfs_poll does the
+// rest.
+static uint8_t fkfs_commit(fkfs_t *fs) {
+    // Every file's appends go out together, so all their windows start over
+    // once they're committed.
+    if (!fs->asynchronous) {
+        if (!fkfs_header_commit(fs)) {
             return false;
         }
-        fs->cachedBlockNumber = UINT32_MAX;
-        fs->cachedBlockDirty = false;
+        fkfs_windows_close(fs);
+        return true;
     }
-    else {
+
+    if (!fkfs_wait(fs)) {
+        return false;
+    }
+
+    // Retry anything a failed commit left behind before it's overtaken. With
+    // one queue it's still there, it goes out with this commit.
+    if (FKFS_WRITE_BEHIND_QUEUES > 1) {
+        if (!fkfs_write_behind_write(fs, fkfs_write_behind_inflight(fs))) {
+            return false;
+        }
+    }
+
+    // The queue that's been filling goes out and the other one takes over.
+    fs->filling = (fs->filling + 1) % FKFS_WRITE_BEHIND_QUEUES;
+
+    fs->header.generation++;
+
+    fkfs_header_crc_update(&fs->header);
+
+    memcpy((void *)&fs->pending.header, (void *)&fs->header, sizeof(fkfs_header_t));
+    fkfs_header_block(fs, &fs->pending.header, fs->pending.block);
+    fs->pending.sequence = fs->sequence;
+    fs->pending.state = FKFS_PENDING_DATA;
+    fkfs_windows_take(fs);
+
+    return fkfs_poll(fs);
+}
+
+// The head block goes out with any sealed blocks ahead of it when they're
+// contiguous.
+static uint8_t fkfs_head_queue(fkfs_t *fs) {
+    auto head = fkfs_cache_dirty(fs);
+    if (head == nullptr) {
+        return true;
+    }
+
+    if (!fkfs_write_behind_append(fs, head->block, head->buffer)) {
+        return false;
+    }
+
+    // The queued copy is the same, so the entry stays.
+    head->dirty = false;
+    fs->inlineFrom = FKFS_BLOCK_DATA_SIZE;
+
+    return true;
+}
+
+// Nothing to write when there are no appends since the last commit, blocks a
+// failed commit left behind included.
+static uint8_t fkfs_clean(fkfs_t *fs) {
+    if (fkfs_cache_dirty(fs) != nullptr || fkfs_write_behind_filling(fs)->number > 0) {
+        return false;
+    }
+    return fs->pending.state != FKFS_PENDING_NONE || fkfs_write_behind_inflight(fs)->number == 0;
+}
+
+static uint8_t fkfs_fsync(fkfs_t *fs) {
+    if (fkfs_clean(fs)) {
         // No reason to write anything if there's nothing dirty.
         fkfs_log_verbose("fkfs: sync (ignored)");
         return true;
     }
 
-    fs->header.generation++;
-    fs->headerIndex = (fs->headerIndex + 1) % 2;
-
-    if (!fkfs_header_write(fs, false)) {
+    if (!fkfs_head_queue(fs)) {
         return false;
     }
 
-    fs->cachedBlockNumber = UINT32_MAX;
-    fs->cachedBlockDirty = false;
+    auto status = fkfs_commit(fs);
+    if (!status) {
+        return false;
+    }
 
     fkfs_log_verbose("fkfs: sync!");
 
-    return true;
+    return status;
 }
 
-uint8_t fkfs_touch(fkfs_t *fs, uint32_t time) {
-    fs->header.time = time;
+// Sync files' windows are committed through here. With inlineSync, when all
+// there is to write is a few appends to the head, the commit is just the
+// header's block carrying them.
+static uint8_t fkfs_sync(fkfs_t *fs) {
+    if (fs->inlineSync) {
+        if (!fkfs_wait(fs)) {
+            return false;
+        }
 
-    if (!fkfs_header_write(fs, false)) {
-        return false;
+        if (fkfs_write_behind_filling(fs)->number == 0 && fkfs_write_behind_inflight(fs)->number == 0 && fkfs_inline_head(fs) != nullptr) {
+            fs->statistics.inlineCommits++;
+            return fkfs_commit(fs);
+        }
     }
 
-    return true;
+    return fkfs_fsync(fs);
 }
 
-uint8_t fkfs_flush(fkfs_t *fs) {
-    if (!fkfs_touch(fs, millis())) {
-        return false;
+// Called as the head moves past a block. The block is queued and the header is
+// committed once there's a full run of blocks to write.
+static uint8_t fkfs_seal(fkfs_t *fs) {
+    if (fkfs_cache_dirty(fs) == nullptr) {
+        return true;
     }
 
-    if (!fkfs_fsync(fs)) {
+    if (!fkfs_head_queue(fs)) {
         return false;
     }
 
+    if (fkfs_write_behind_filling(fs)->number == FKFS_WRITE_BEHIND_BLOCKS) {
+        return fkfs_commit(fs);
+    }
+
+    return true;
+}
+
+uint8_t fkfs_touch(fkfs_t *fs, uint32_t time) {
+    // Goes out with the next commit.
+    fs->header.time = time;
+
     return true;
 }
 
+uint8_t fkfs_flush(fkfs_t *fs) {
+    fs->header.time = millis();
+
+    return fkfs_fsync(fs);
+}
+
 static uint8_t fkfs_file_allocate_block(fkfs_t *fs, uint8_t fileNumber, uint16_t required, uint16_t size, fkfs_entry_t *entry) {
     fkfs_file_t *file = &fs->header.files[fileNumber];
     uint16_t newOffset = fs->header.offset;
     uint16_t visitedBlocks = 0;
+    uint8_t moved = false;
 
     fkfs_log_verbose("fkfs: file_allocate_block(%d, %d) (block=%d, offset=%d)", fileNumber, required, fs->header.block, newOffset);
 
     do {
         // If we can't fit in the remainder of this block, we gotta move on.
-        if (required + newOffset > SD_RAW_BLOCK_SIZE) {
-            // Flush any cached block before we move onto a new block.
-            if (!fkfs_fsync(fs)) {
+        if (required + newOffset > FKFS_BLOCK_DATA_SIZE) {
+            // Seal any cached block before we move onto a new block.
+            if (!fkfs_seal(fs)) {
                 return false;
             }
 
@@ -460,27 +1782,41 @@ static uint8_t fkfs_file_allocate_block(fkfs_t *fs, uint8_t fileNumber, uint16_t
 
             // Wrap around logic, back to the beginning of the SD. It will now
             // be important to look at priority and for old files.
-            if (fs->header.block == fs->numberOfBlocks - 2 || fs->header.block == FKFS_TESTING_LAST_BLOCK) {
-                fs->header.block = FKFS_FIRST_BLOCK;
+            if (fs->header.block >= fs->endBlock || fs->header.block == FKFS_TESTING_LAST_BLOCK) {
+                fs->header.block = fs->firstBlock;
                 fkfs_log_verbose("fkfs: file_allocate_block(%d, %d) (wrap around %d)", fileNumber, required, fs->header.block);
             }
+
+            fkfs_erase_advance(fs);
+
+            moved = true;
         }
 
-        // If this isn't the block we have cached then read the block, this is
+        // If this isn't a block we have cached then read the block, this is
         // for when we've moved to a new block or were just opened.
-        if (fs->cachedBlockNumber != fs->header.block) {
-            if (!fkfs_read_block(fs, fs->header.block, (uint8_t *)fs->buffer)) {
-                return false;
+        auto head = fkfs_block_ensure(fs, fs->header.block, false);
+        if (head == nullptr) {
+            return false;
+        }
+
+        // Every block the head moves onto is stamped and written, even one
+        // it moves straight past, so stamps run on without gaps. Blocks that
+        // can't be stamped still take their number, and stay as they are.
+        if (moved) {
+            fs->stamp++;
+            fs->stamped = fkfs_block_stampable(fs, head->buffer);
+            if (fs->stamped) {
+                fkfs_block_stamp(head->buffer, fs->stamp);
+                head->dirty = true;
             }
-            fs->cachedBlockNumber = fs->header.block;
-            fs->cachedBlockDirty = false;
+            moved = false;
         }
 
         // See if we can find a place for ourselves in the block. This involves
         // looping over the existing chain of blocks.
         fkfs_offset_search_t search = { 0 };
         search.offset = newOffset;
-        if (fkfs_block_available_offset(fs, file, fs->files[fileNumber].priority, required, fs->buffer, &search)) {
+        if (fkfs_block_available_offset(fs, file, fs->files[fileNumber].priority, required, head->buffer, &search)) {
             // We found a place to store the data.
             fs->header.offset = search.offset;
             return true;
@@ -501,7 +1837,7 @@ uint8_t fkfs_file_append(fkfs_t *fs, uint8_t fileNumber, uint16_t size, uint8_t
     // Just fail if we'll never be able to store this block. The upper layers
     // should never allow this.
     uint16_t required = sizeof(fkfs_entry_t) + size;
-    if (size == 0 || required > SD_RAW_BLOCK_SIZE) {
+    if (size == 0 || required > FKFS_BLOCK_DATA_SIZE) {
         return false;
     }
 
@@ -517,34 +1853,62 @@ uint8_t fkfs_file_append(fkfs_t *fs, uint8_t fileNumber, uint16_t size, uint8_t
              fileNumber, fs->header.block,
              fs->header.offset, fs->header.offset + required,
              size, required,
-             SD_RAW_BLOCK_SIZE - (fs->header.offset + required));
+             FKFS_BLOCK_DATA_SIZE - (fs->header.offset + required));
 
     entry.file = fileNumber;
     entry.size = size;
     entry.available = size;
     entry.crc = fkfs_block_crc(fs, file, &entry, data);
 
+    auto head = fkfs_cache_find(fs, fs->header.block);
+    if (head == nullptr) {
+        return false;
+    }
+
     // TODO: Maybe just cast the buffer to this?
-    memcpy(((uint8_t *)fs->buffer) + fs->header.offset, (uint8_t *)&entry, sizeof(fkfs_entry_t));
-    memcpy(((uint8_t *)fs->buffer) + fs->header.offset + sizeof(fkfs_entry_t), data, size);
+    memcpy(head->buffer + fs->header.offset, (uint8_t *)&entry, sizeof(fkfs_entry_t));
+    memcpy(head->buffer + fs->header.offset + sizeof(fkfs_entry_t), data, size);
+
+    // A block that couldn't be stamped is written now, so it's stamped if the
+    // entry cut short what ran into the trailer.
+    if (!fs->stamped) {
+        fs->stamped = fkfs_block_stampable(fs, head->buffer);
+    }
+    if (fs->stamped) {
+        fkfs_block_stamp(head->buffer, fs->stamp);
+    }
 
-    fs->cachedBlockDirty = true;
+    head->dirty = true;
+    if (fs->header.offset < fs->inlineFrom) {
+        fs->inlineFrom = fs->header.offset;
+    }
     fs->header.offset += required;
     fs->header.files[fileNumber].endBlock = fs->header.block;
     fs->header.files[fileNumber].endOffset = fs->header.offset;
     fs->header.files[fileNumber].size += size;
 
-    // If this file is configured to be fsync'd after every write that go ahead
-    // and do that here. Otherwise this will happen later, either manually or
-    // when we need to seek to a new block.
-    if (fs->files[fileNumber].sync) {
-        if (!fkfs_fsync(fs)) {
+    fkfs_file_runtime_settings_t *settings = &fs->files[fileNumber];
+    if (settings->unsynced == 0) {
+        settings->unsyncedSince = millis();
+    }
+    settings->unsynced += size;
+    fs->sequence++;
+
+    // Sync files are committed here once their window is up, along with
+    // anything else that's been appended. Otherwise this will happen later,
+    // either manually or when we need to seek to a new block.
+    if (fkfs_sync_due(fs)) {
+        if (!fkfs_sync(fs)) {
             return false;
         }
 
         fkfs_log_verbose("fkfs: done, synced");
     } else {
-        fkfs_log_verbose("fkfs: done, file is no-sync");
+        fkfs_log_verbose("fkfs: done, not syncing");
+    }
+
+    if (fs->pending.state != FKFS_PENDING_NONE) {
+        return FKFS_PENDING;
     }
 
     return true;
@@ -664,7 +2028,12 @@ uint8_t fkfs_file_iterator_move_end(fkfs_t *fs, fkfs_file_iter_t *iter) {
 }
 
 uint8_t fkfs_file_iterate_move(fkfs_t *fs, bool checkBlock, fkfs_file_iter_t *iter) {
-    auto ptr = fs->buffer + iter->token.offset;
+    auto cached = fkfs_cache_find(fs, iter->token.block);
+    if (cached == nullptr) {
+        return false;
+    }
+
+    auto ptr = cached->buffer + iter->token.offset;
     if (checkBlock) {
         auto check = fkfs_block_check(fs, ptr);
         if (check != FKFS_OFFSET_SEARCH_STATUS_CRC && check != FKFS_OFFSET_SEARCH_STATUS_GOOD) {
@@ -679,11 +2048,11 @@ uint8_t fkfs_file_iterate_move(fkfs_t *fs, bool checkBlock, fkfs_file_iter_t *it
 }
 
 uint8_t fkfs_file_iterator_ensure(fkfs_t *fs, fkfs_file_iter_t *iter) {
-    if (fs->cachedBlockNumber == iter->token.block) {
+    if (fkfs_cache_find(fs, iter->token.block) != nullptr) {
         return FKFS_ENSURE_NOOP;
     }
 
-    if (!fkfs_block_ensure(fs, iter->token.block)) {
+    if (fkfs_block_ensure(fs, iter->token.block, true) == nullptr) {
         fkfs_log("fkfs: unable to ensure block %d", iter->token.block);
         return FKFS_ENSURE_FAILED;
     }
@@ -707,28 +2076,54 @@ uint8_t fkfs_file_iterate(fkfs_t *fs, fkfs_iterator_config_t *config, fkfs_file_
 
     fkfs_log_verbose("fkfs: scanning: resuming (%d, %d)", iter->token.block, iter->token.offset);
 
+    if (config->partialReads && (config->buffer == nullptr || config->manualNext)) {
+        fkfs_log("fkfs: scanning: partial reads need a buffer");
+        return false;
+    }
+
     auto started = millis();
     auto lastStatus = started;
     auto maxBlocks = config->maxBlocks;
     auto success = false;
 
     do {
-        // Make sure the block is loaded up into the cache.
-        if (!fkfs_block_ensure(fs, iter->token.block)) {
-            fkfs_log("fkfs: unable to ensure block %d", iter->token.block);
-            break;
+        fkfs_entry_t partial;
+        fkfs_entry_t *entry;
+        uint8_t *data;
+        uint8_t check;
+
+        if (config->partialReads) {
+            if (!fkfs_block_check_partial(fs, iter->token.block, iter->token.offset, iter->token.file, config->buffer, config->bufferSize, &partial, &check)) {
+                fkfs_log("fkfs: unable to read entry (%d, %d)", iter->token.block, iter->token.offset);
+                break;
+            }
+
+            entry = &partial;
+            data = config->buffer;
+        }
+        else {
+            // Make sure the block is loaded up into the cache.
+            auto loaded = config->readAhead ?
+                          fkfs_block_ensure_ahead(fs, iter->token.block, iter->token.lastBlock) :
+                          fkfs_block_ensure(fs, iter->token.block, true);
+            if (loaded == nullptr) {
+                fkfs_log("fkfs: unable to ensure block %d", iter->token.block);
+                break;
+            }
+
+            // Find the next block of the file in the cached memory block.
+            auto ptr = loaded->buffer + iter->token.offset;
+            check = fkfs_block_check(fs, ptr);
+            entry = (fkfs_entry_t *)ptr;
+            data = ptr + sizeof(fkfs_entry_t);
         }
 
-        // Find the next block of the file in the cached memory block.
-        auto ptr = fs->buffer + iter->token.offset;
-        auto check = fkfs_block_check(fs, ptr);
         if (check == FKFS_OFFSET_SEARCH_STATUS_CRC || check == FKFS_OFFSET_SEARCH_STATUS_GOOD) {
-            auto entry = (fkfs_entry_t *)ptr;
             if (check == FKFS_OFFSET_SEARCH_STATUS_GOOD) {
                 if (entry->file == iter->token.file) {
                     fkfs_log("fkfs: scanning: DATA (%d, %3d) %d", iter->token.block, iter->token.offset, entry->size);
                     iter->size = entry->size;
-                    iter->data = ptr + sizeof(fkfs_entry_t);
+                    iter->data = data;
                     iter->iterated += entry->size;
                     if (!config->manualNext) {
                         iter->token.offset += entry->available + sizeof(fkfs_entry_t);
@@ -764,8 +2159,8 @@ uint8_t fkfs_file_iterate(fkfs_t *fs, fkfs_iterator_config_t *config, fkfs_file_
 
             // Wrap around logic, back to the beginning of the SD. It will now
             // be important to look at priority and for old files.
-            if (iter->token.block == fs->numberOfBlocks - 2 || iter->token.block == FKFS_TESTING_LAST_BLOCK) {
-                iter->token.block = FKFS_FIRST_BLOCK;
+            if (iter->token.block == fs->endBlock || iter->token.block == FKFS_TESTING_LAST_BLOCK) {
+                iter->token.block = fs->firstBlock;
             }
 
             // See if our self imposed ending terms have been reached.
@@ -784,14 +2179,19 @@ uint8_t fkfs_file_iterate(fkfs_t *fs, fkfs_iterator_config_t *config, fkfs_file_
     }
     while (true);
 
+    // Partial reads may have left a block open on the device.
+    if (config->partialReads) {
+        fkfs_device_read_end(&fs->device);
+    }
+
     fs->statistics.iterateTime += millis() - started;
 
     return success;
 }
 
 uint8_t fkfs_log_statistics(fkfs_t *fs) {
-    fkfs_log("fkfs: index=%d gen=%d block=%d offset=%d",
-             fs->headerIndex, fs->header.generation,
+    fkfs_log("fkfs: header=%d gen=%d block=%d offset=%d",
+             fkfs_header_location(fs->header.generation), fs->header.generation,
              fs->header.block, fs->header.offset);
 
     for (uint8_t counter = 0; counter < FKFS_FILES_MAX; ++counter) {
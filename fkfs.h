@@ -5,10 +5,56 @@
 #include <stdint.h>
 
 #include "sd_raw.h"
+#include "fkfs_device.h"
 
 #define memzero(ptr, sz)          memset(ptr, 0, sz)
 
 constexpr uint16_t FKFS_FILES_MAX = 4;
+
+// Number of sealed blocks held back so they can be written in a single
+// multiple block write. One writes every block as soon as it's sealed.
+#ifndef FKFS_WRITE_BEHIND_BLOCKS
+#define FKFS_WRITE_BEHIND_BLOCKS   4
+#endif
+
+// Number of write behind queues. With two, blocks sealed while an
+// asynchronous commit is underway go in the other queue instead of waiting
+// for the commit.
+#ifndef FKFS_WRITE_BEHIND_QUEUES
+#define FKFS_WRITE_BEHIND_QUEUES   1
+#endif
+
+// Number of blocks kept in memory: the head being appended to and the blocks
+// iterators are reading. With more than one, iterators never take the head's
+// entry, so there's always at least one for them. With one, iterators and the
+// head share it, reading queues the head's appends to be written first.
+#ifndef FKFS_CACHE_BLOCKS
+#define FKFS_CACHE_BLOCKS          2
+#endif
+
+// Most blocks fkfs_initialize looks through past the committed head for
+// entries that made it to the card before their header did, when the head
+// has no stamp to go on. Commits leave at most the write behind queues and
+// the head written ahead of the header.
+#ifndef FKFS_RECOVER_BLOCKS
+#define FKFS_RECOVER_BLOCKS        (FKFS_WRITE_BEHIND_BLOCKS * FKFS_WRITE_BEHIND_QUEUES + 1)
+#endif
+
+// Number of blocks after block 0 the header goes round, a block per commit.
+#ifndef FKFS_HEADER_BLOCKS
+#define FKFS_HEADER_BLOCKS         64
+#endif
+
+// Most blocks fkfs_idle will look at (and erase) in one call.
+#ifndef FKFS_ERASE_BLOCKS
+#define FKFS_ERASE_BLOCKS          64
+#endif
+
+// Number of blocks iterators read at once when read ahead is enabled. Zero
+// leaves read ahead out, iterators that ask for it read a block at a time.
+#ifndef FKFS_READ_AHEAD_BLOCKS
+#define FKFS_READ_AHEAD_BLOCKS     0
+#endif
 constexpr uint8_t FKFS_FILE_NAME_MAX = 12;
 
 typedef struct fkfs_file_t {
@@ -38,9 +84,52 @@ typedef struct fkfs_entry_t {
     uint16_t crc;
 } __attribute__((packed)) fkfs_entry_t;
 
+/**
+ * The end of every data block, stamped with a number that goes up by one each
+ * time the head moves onto a new block. Stamps let fkfs_initialize find where
+ * writing stopped without a scan. Blocks from before stamps can keep entries
+ * that run into the trailer, those are left unstamped.
+ */
+typedef struct fkfs_block_trailer_t {
+    uint32_t stamp;
+    uint16_t crc;
+} __attribute__((packed)) fkfs_block_trailer_t;
+
+/**
+ * Follows the header in its block. The data region is chosen when the card is
+ * wiped, from the device's allocation units, and kept with every header so
+ * the card is always wrapped at the same block whatever reads or writes it.
+ * The head's stamp goes with it, the head may be a block that can't be
+ * stamped (see fkfs_block_trailer_t).
+ */
+typedef struct fkfs_region_t {
+    uint32_t firstBlock;
+    uint32_t endBlock;
+    uint32_t stamp;
+    uint16_t crc;
+} __attribute__((packed)) fkfs_region_t;
+
+/**
+ * Follows the region in the header's block when a sync commit carries the head's
+ * latest appends there instead of writing the head, see inlineSync. The size
+ * bytes that follow go at offset in block, which is stamped with stamp.
+ */
+typedef struct fkfs_inline_t {
+    uint32_t block;
+    uint32_t stamp;
+    uint16_t offset;
+    uint16_t size;
+    uint16_t crc;
+} __attribute__((packed)) fkfs_inline_t;
+
 typedef struct fkfs_file_runtime_settings_t {
     uint8_t sync;
     uint8_t priority;
+    uint32_t syncBytes;
+    uint32_t syncInterval;
+    // Appended since the last commit, and when the first of those was.
+    uint32_t unsynced;
+    uint32_t unsyncedSince;
 } fkfs_file_runtime_settings_t;
 
 typedef struct fkfs_file_info_t {
@@ -54,23 +143,101 @@ typedef struct fkfs_file_info_t {
 typedef struct fkfs_statistics_t {
     uint32_t blockReads;
     uint32_t blockWrites;
+    uint32_t burstWrites;
+    uint32_t burstReads;
+    uint32_t partialReads;
+    uint32_t partialBytes;
+    uint32_t busyPolls;
     uint32_t iterateCalls;
     uint32_t iterateTime;
     uint32_t writeTime;
     uint32_t readTime;
+    uint32_t erasedBlocks;
+    uint32_t preservedBlocks;
+    uint32_t erasedWrites;
+    uint32_t cacheHits;
+    uint32_t cacheMisses;
+    uint32_t cacheWritebacks;
+    uint32_t recoveredEntries;
+    uint32_t inlineCommits;
 } fkfs_statistics_t;
 
 void fkfs_statistics_zero(fkfs_statistics_t *fks);
 
+typedef struct fkfs_write_behind_t {
+    uint32_t block;
+    uint8_t number;
+    uint8_t buffer[FKFS_WRITE_BEHIND_BLOCKS][SD_RAW_BLOCK_SIZE];
+} fkfs_write_behind_t;
+
+typedef struct fkfs_cache_entry_t {
+    uint32_t block;
+    uint8_t dirty;
+    uint32_t used;
+    uint8_t buffer[SD_RAW_BLOCK_SIZE];
+} fkfs_cache_entry_t;
+
+#if FKFS_READ_AHEAD_BLOCKS > 0
+typedef struct fkfs_read_ahead_t {
+    uint32_t block;
+    uint8_t number;
+    uint8_t buffer[FKFS_READ_AHEAD_BLOCKS][SD_RAW_BLOCK_SIZE];
+} fkfs_read_ahead_t;
+#endif
+
+/**
+ * A commit that's underway, the queued blocks followed by a snapshot of the
+ * header taken when the commit began. Devices may go on reading the blocks
+ * being written until they're done, so the header is written from block. The
+ * sync files' windows go with it, and back to the files if it fails.
+ */
+typedef struct fkfs_pending_t {
+    uint8_t state;
+    uint32_t sequence;
+    fkfs_header_t header;
+    uint8_t block[SD_RAW_BLOCK_SIZE];
+    uint32_t unsynced[FKFS_FILES_MAX];
+    uint32_t unsyncedSince[FKFS_FILES_MAX];
+} fkfs_pending_t;
+
 typedef struct fkfs_t {
-    uint8_t headerIndex;
-    uint8_t cachedBlockDirty;
-    uint32_t cachedBlockNumber;
+    uint8_t asynchronous;
+    // Sync commits with only a few appends to the head, FKFS_INLINE_SIZE
+    // (347) bytes at most, carry them in the header's block and skip writing
+    // the head until it's sealed or fkfs_flush. One write per commit, not two.
+    uint8_t inlineSync;
+    // Mounts without writing to the card, for tools that only read it. Cards
+    // with no header aren't wiped, fkfs_initialize fails instead.
+    uint8_t readOnly;
     uint32_t numberOfBlocks;
+    // The data region, header.block wraps back to firstBlock at endBlock.
+    uint32_t firstBlock;
+    uint32_t endBlock;
+    // Blocks to keep erased ahead of the head, see fkfs_idle.
+    uint32_t eraseAhead;
+    uint32_t erasedUntil;
     fkfs_header_t header;
+    // The header's block as it was last written.
+    uint8_t headerBlock[SD_RAW_BLOCK_SIZE];
     sd_raw_t sd;
-    uint8_t buffer[SD_RAW_BLOCK_SIZE];
+    fkfs_device_t device;
+    fkfs_cache_entry_t cache[FKFS_CACHE_BLOCKS];
+    uint32_t cacheClock;
     fkfs_file_runtime_settings_t files[FKFS_FILES_MAX];
+    uint8_t filling;
+    fkfs_write_behind_t writeBehind[FKFS_WRITE_BEHIND_QUEUES];
+#if FKFS_READ_AHEAD_BLOCKS > 0
+    fkfs_read_ahead_t readAhead;
+#endif
+    fkfs_pending_t pending;
+    // Appends so far and how many of those have been committed.
+    uint32_t sequence;
+    uint32_t durable;
+    // The head block's stamp, and whether the block has room to carry it.
+    uint32_t stamp;
+    uint8_t stamped;
+    // Where the head's appends since it was last queued begin.
+    uint16_t inlineFrom;
     fkfs_statistics_t statistics;
 } fkfs_t;
 
@@ -85,10 +252,20 @@ typedef struct fkfs_iterator_token_t {
 
 #define fkfs_token_empty    { 0, 0, 0, 0, 0, 0 }
 
+/**
+ * With partialReads set only the entry headers are read while walking a block
+ * and the data of the iterated file is read into buffer, which needs room for
+ * the largest entry. The cached block is left alone and so iter->data points
+ * into buffer. Can't be combined with manualNext.
+ */
 typedef struct fkfs_iterator_config_t {
     uint32_t maxBlocks;
     uint32_t maxTime;
     uint8_t manualNext;
+    uint8_t readAhead;
+    uint8_t partialReads;
+    uint8_t *buffer;
+    uint16_t bufferSize;
 } fkfs_iterator_config_t;
 
 typedef struct fkfs_file_iter_t {
@@ -99,21 +276,87 @@ typedef struct fkfs_file_iter_t {
 } fkfs_file_iter_t;
 
 static_assert(sizeof(fkfs_header_t) * 2 <= SD_RAW_BLOCK_SIZE, "Error: fkfs header too large for SD block.");
+static_assert(FKFS_WRITE_BEHIND_BLOCKS > 0 && FKFS_WRITE_BEHIND_BLOCKS <= UINT8_MAX, "Error: FKFS_WRITE_BEHIND_BLOCKS out of range.");
+static_assert(FKFS_HEADER_BLOCKS > 1, "Error: FKFS_HEADER_BLOCKS out of range.");
+static_assert(FKFS_WRITE_BEHIND_QUEUES == 1 || FKFS_WRITE_BEHIND_QUEUES == 2, "Error: FKFS_WRITE_BEHIND_QUEUES out of range.");
+static_assert(FKFS_CACHE_BLOCKS > 0 && FKFS_CACHE_BLOCKS <= UINT8_MAX, "Error: FKFS_CACHE_BLOCKS out of range.");
+static_assert(FKFS_READ_AHEAD_BLOCKS >= 0 && FKFS_READ_AHEAD_BLOCKS <= UINT8_MAX, "Error: FKFS_READ_AHEAD_BLOCKS out of range.");
 
 constexpr uint16_t FKFS_ENTRY_SIZE_MINUS_CRC = offsetof(fkfs_entry_t, crc);
 constexpr uint16_t FKFS_HEADER_SIZE_MINUS_CRC = offsetof(fkfs_header_t, crc);
-constexpr uint16_t FKFS_MAXIMUM_BLOCK_SIZE = SD_RAW_BLOCK_SIZE - sizeof(fkfs_entry_t);
+constexpr uint16_t FKFS_BLOCK_DATA_SIZE = SD_RAW_BLOCK_SIZE - sizeof(fkfs_block_trailer_t);
+constexpr uint16_t FKFS_MAXIMUM_BLOCK_SIZE = FKFS_BLOCK_DATA_SIZE - sizeof(fkfs_entry_t);
+constexpr uint16_t FKFS_REGION_OFFSET = sizeof(fkfs_header_t);
+constexpr uint16_t FKFS_INLINE_OFFSET = FKFS_REGION_OFFSET + sizeof(fkfs_region_t);
+// What's left of the header's block after the header, region and inline
+// tail, 347 bytes.
+constexpr uint16_t FKFS_INLINE_SIZE = SD_RAW_BLOCK_SIZE - FKFS_INLINE_OFFSET - sizeof(fkfs_inline_t);
 
 uint8_t fkfs_configure_logging(size_t (*log_function_ptr)(const char *f, ...));
 
 uint8_t fkfs_create(fkfs_t *fs);
 
+/**
+ * Sets the header's time, which is written with the next commit rather than
+ * on its own.
+ */
 uint8_t fkfs_touch(fkfs_t *fs, uint32_t time);
 
+/**
+ * When asynchronous is set fkfs_flush and fkfs_file_append only start writing
+ * to the device and return FKFS_PENDING while it's busy. fkfs_poll moves the
+ * commit along and returns true once it's complete. Starting another commit
+ * waits for the one underway.
+ */
+constexpr uint8_t FKFS_PENDING = 2;
+
+/**
+ * Commits the head block and anything queued behind it along with the header,
+ * stamped with the time. Does nothing when there's nothing new to write.
+ * Appends that inlineSync left in the header's block go to the head then.
+ */
 uint8_t fkfs_flush(fkfs_t *fs);
 
+uint8_t fkfs_poll(fkfs_t *fs);
+
+/**
+ * For the application to call when it has nothing to write. Erases up to
+ * FKFS_ERASE_BLOCKS blocks at a time until eraseAhead blocks ahead of the head
+ * are erased, so once the log has wrapped writes go to erased flash. Blocks
+ * that start with a valid entry are left alone, the allocator may need to
+ * keep them (see fkfs_block_available_offset). While a commit is underway
+ * this only polls it.
+ */
+uint8_t fkfs_idle(fkfs_t *fs);
+
+/**
+ * The number of blocks ahead of the head that fkfs_idle has gone over.
+ */
+uint32_t fkfs_erased_ahead(fkfs_t *fs);
+
+/**
+ * Appends are numbered from 1 after fkfs_initialize, fkfs_sequence is the
+ * latest and fkfs_durable the latest that's been committed to the card.
+ */
+uint32_t fkfs_sequence(fkfs_t *fs);
+
+uint32_t fkfs_durable(fkfs_t *fs);
+
+/**
+ * Sync files are committed after every append, unless fkfs_file_sync_policy
+ * gives them a window. Others wait for fkfs_flush or for enough full blocks.
+ */
 uint8_t fkfs_initialize_file(fkfs_t *fs, uint8_t fileNumber, uint8_t priority, uint8_t sync, const char *name);
 
+/**
+ * Makes fileNumber a sync file that's committed once syncBytes have been
+ * appended or syncInterval ms after the first append, whichever's first. Zero
+ * leaves either out, both zero commits every append. Commits take every
+ * file's appends with them, and fkfs_idle commits windows that run out
+ * between appends.
+ */
+uint8_t fkfs_file_sync_policy(fkfs_t *fs, uint8_t fileNumber, uint32_t syncBytes, uint32_t syncInterval);
+
 uint8_t fkfs_initialize(fkfs_t *fs, bool wipe);
 
 uint8_t fkfs_number_of_files(fkfs_t *fs);
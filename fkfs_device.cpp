@@ -0,0 +1,246 @@
+#include <string.h>
+
+#include "fkfs_device.h"
+
+uint8_t fkfs_device_read_block(fkfs_device_t *dev, uint32_t block, uint8_t *destiny) {
+    return dev->ops->read_block(dev->ctx, block, destiny);
+}
+
+uint8_t fkfs_device_write_block(fkfs_device_t *dev, uint32_t block, const uint8_t *source) {
+    return dev->ops->write_block(dev->ctx, block, source);
+}
+
+uint8_t fkfs_device_read_blocks(fkfs_device_t *dev, uint32_t block, uint32_t number, uint8_t *destiny) {
+    if (dev->ops->read_blocks != nullptr) {
+        return dev->ops->read_blocks(dev->ctx, block, number, destiny);
+    }
+
+    for (uint32_t i = 0; i < number; ++i) {
+        if (!dev->ops->read_block(dev->ctx, block + i, destiny + i * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint8_t fkfs_device_write_blocks(fkfs_device_t *dev, uint32_t block, uint32_t number, const uint8_t *source) {
+    if (dev->ops->write_blocks != nullptr) {
+        return dev->ops->write_blocks(dev->ctx, block, number, source);
+    }
+
+    for (uint32_t i = 0; i < number; ++i) {
+        if (!dev->ops->write_block(dev->ctx, block + i, source + i * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint8_t fkfs_device_read_partial(fkfs_device_t *dev, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    if (offset + size > SD_RAW_BLOCK_SIZE) {
+        return false;
+    }
+
+    if (dev->ops->read_partial != nullptr) {
+        return dev->ops->read_partial(dev->ctx, block, offset, size, destiny);
+    }
+
+    uint8_t buffer[SD_RAW_BLOCK_SIZE];
+    if (!dev->ops->read_block(dev->ctx, block, buffer)) {
+        return false;
+    }
+
+    memcpy(destiny, buffer + offset, size);
+
+    return true;
+}
+
+uint8_t fkfs_device_read_end(fkfs_device_t *dev) {
+    if (dev->ops->read_end == nullptr) {
+        return true;
+    }
+    return dev->ops->read_end(dev->ctx);
+}
+
+uint8_t fkfs_device_write_start(fkfs_device_t *dev, uint32_t block, uint32_t number, const uint8_t *source) {
+    if (dev->ops->write_start == nullptr) {
+        return fkfs_device_write_blocks(dev, block, number, source);
+    }
+    return dev->ops->write_start(dev->ctx, block, number, source);
+}
+
+uint8_t fkfs_device_poll(fkfs_device_t *dev) {
+    if (dev->ops->poll == nullptr) {
+        return FKFS_DEVICE_READY;
+    }
+    return dev->ops->poll(dev->ctx);
+}
+
+uint8_t fkfs_device_erase(fkfs_device_t *dev, uint32_t firstBlock, uint32_t lastBlock) {
+    if (dev->ops->erase == nullptr) {
+        return false;
+    }
+    return dev->ops->erase(dev->ctx, firstBlock, lastBlock);
+}
+
+uint32_t fkfs_device_size(fkfs_device_t *dev) {
+    return dev->ops->size(dev->ctx);
+}
+
+uint8_t fkfs_device_flush(fkfs_device_t *dev) {
+    if (dev->ops->flush == nullptr) {
+        return true;
+    }
+    return dev->ops->flush(dev->ctx);
+}
+
+uint32_t fkfs_device_allocation_unit(fkfs_device_t *dev) {
+    if (dev->ops->allocation_unit == nullptr) {
+        return 0;
+    }
+    return dev->ops->allocation_unit(dev->ctx);
+}
+
+static uint8_t *fkfs_device_ram_block(fkfs_device_ram_t *ram, uint32_t block) {
+    if (block >= ram->numberOfBlocks) {
+        return nullptr;
+    }
+    return ram->memory + (size_t)block * SD_RAW_BLOCK_SIZE;
+}
+
+static uint8_t fkfs_device_ram_complete(fkfs_device_ram_t *ram) {
+    if (ram->number > 0) {
+        memcpy(fkfs_device_ram_block(ram, ram->block), ram->source, (size_t)ram->number * SD_RAW_BLOCK_SIZE);
+        ram->number = 0;
+    }
+    return FKFS_DEVICE_READY;
+}
+
+// Anything touching the memory waits out a simulated write.
+static void fkfs_device_ram_wait(fkfs_device_ram_t *ram) {
+    if (ram->busy > 0) {
+        ram->stalls++;
+        ram->stallPolls += ram->busy;
+        ram->busy = 0;
+    }
+    fkfs_device_ram_complete(ram);
+}
+
+static uint8_t fkfs_device_ram_read_blocks(void *ctx, uint32_t block, uint32_t number, uint8_t *destiny) {
+    auto ram = (fkfs_device_ram_t *)ctx;
+    fkfs_device_ram_wait(ram);
+    if (block + number > ram->numberOfBlocks) {
+        return false;
+    }
+    memcpy(destiny, fkfs_device_ram_block(ram, block), (size_t)number * SD_RAW_BLOCK_SIZE);
+    return true;
+}
+
+static uint8_t fkfs_device_ram_write_blocks(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    auto ram = (fkfs_device_ram_t *)ctx;
+    fkfs_device_ram_wait(ram);
+    if (block + number > ram->numberOfBlocks) {
+        return false;
+    }
+    memcpy(fkfs_device_ram_block(ram, block), source, (size_t)number * SD_RAW_BLOCK_SIZE);
+    // Synchronous writes sit out the whole busy period.
+    if (ram->busyPolls > 0) {
+        ram->stalls++;
+        ram->stallPolls += ram->busyPolls;
+    }
+    return true;
+}
+
+static uint8_t fkfs_device_ram_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    return fkfs_device_ram_read_blocks(ctx, block, 1, destiny);
+}
+
+static uint8_t fkfs_device_ram_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    return fkfs_device_ram_write_blocks(ctx, block, 1, source);
+}
+
+static uint8_t fkfs_device_ram_read_partial(void *ctx, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    auto ram = (fkfs_device_ram_t *)ctx;
+    fkfs_device_ram_wait(ram);
+    if (block >= ram->numberOfBlocks) {
+        return false;
+    }
+    memcpy(destiny, fkfs_device_ram_block(ram, block) + offset, size);
+    return true;
+}
+
+static uint8_t fkfs_device_ram_write_start(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    auto ram = (fkfs_device_ram_t *)ctx;
+    fkfs_device_ram_wait(ram);
+    if (block + number > ram->numberOfBlocks) {
+        return false;
+    }
+    ram->block = block;
+    ram->number = number;
+    ram->source = source;
+    ram->busy = ram->busyPolls;
+    if (ram->busy == 0) {
+        fkfs_device_ram_complete(ram);
+    }
+    return true;
+}
+
+static uint8_t fkfs_device_ram_poll(void *ctx) {
+    auto ram = (fkfs_device_ram_t *)ctx;
+    if (ram->busy > 0) {
+        ram->busy--;
+        return FKFS_DEVICE_BUSY;
+    }
+    return fkfs_device_ram_complete(ram);
+}
+
+static uint8_t fkfs_device_ram_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    auto ram = (fkfs_device_ram_t *)ctx;
+    fkfs_device_ram_wait(ram);
+    if (firstBlock > lastBlock || lastBlock >= ram->numberOfBlocks) {
+        return false;
+    }
+    memset(fkfs_device_ram_block(ram, firstBlock), 0, (size_t)(lastBlock - firstBlock + 1) * SD_RAW_BLOCK_SIZE);
+    return true;
+}
+
+static uint32_t fkfs_device_ram_size(void *ctx) {
+    auto ram = (fkfs_device_ram_t *)ctx;
+    return ram->numberOfBlocks;
+}
+
+static const fkfs_device_ops_t fkfs_device_ram_ops = {
+    .read_block = fkfs_device_ram_read_block,
+    .write_block = fkfs_device_ram_write_block,
+    .erase = fkfs_device_ram_erase,
+    .size = fkfs_device_ram_size,
+    .flush = nullptr,
+    .read_blocks = fkfs_device_ram_read_blocks,
+    .write_blocks = fkfs_device_ram_write_blocks,
+    .read_partial = fkfs_device_ram_read_partial,
+    .read_end = nullptr,
+    .write_start = fkfs_device_ram_write_start,
+    .poll = fkfs_device_ram_poll,
+    .allocation_unit = nullptr,
+};
+
+uint8_t fkfs_device_ram_open(fkfs_device_t *dev, fkfs_device_ram_t *ram, uint8_t *memory, uint32_t numberOfBlocks) {
+    if (memory == nullptr) {
+        return false;
+    }
+
+    ram->memory = memory;
+    ram->numberOfBlocks = numberOfBlocks;
+    ram->busyPolls = 0;
+    ram->busy = 0;
+    ram->stalls = 0;
+    ram->stallPolls = 0;
+    ram->number = 0;
+
+    dev->ops = &fkfs_device_ram_ops;
+    dev->ctx = ram;
+
+    return true;
+}
@@ -0,0 +1,107 @@
+#ifndef FKFS_DEVICE_H_INCLUDED
+#define FKFS_DEVICE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sd_raw.h"
+
+/**
+ * Block device operations used by fkfs. Every device deals in whole blocks of
+ * SD_RAW_BLOCK_SIZE bytes. The multiple block operations are optional, when
+ * they're nullptr the fkfs_device_* helpers fall back to looping over the
+ * single block operations.
+ *
+ * read_partial reads size bytes from offset within a block and is optional as
+ * well, devices that can't do better read the whole block. Devices may keep a
+ * block open between partial reads of increasing offsets, read_end closes it
+ * and has to be called before anything else uses the bus.
+ *
+ * write_start returns once the write has been started, leaving it to complete
+ * in the background, and poll reports on it. The device may read from source
+ * (by DMA, say) until poll stops returning FKFS_DEVICE_BUSY. Other operations
+ * wait for an outstanding write. Without them writes are synchronous.
+ *
+ * flush returns once everything written so far is on the device and will
+ * stay there, waiting for any writes the device has queued. Devices may
+ * complete queued writes in any order, so fkfs flushes between a commit's
+ * data and its header and again before the commit counts as durable.
+ *
+ * allocation_unit returns the size of the card's allocation units in blocks,
+ * zero if it's unknown (or nullptr), so writes can be lined up with them.
+ */
+typedef struct fkfs_device_ops_t {
+    uint8_t (*read_block)(void *ctx, uint32_t block, uint8_t *destiny);
+    uint8_t (*write_block)(void *ctx, uint32_t block, const uint8_t *source);
+    uint8_t (*erase)(void *ctx, uint32_t firstBlock, uint32_t lastBlock);
+    uint32_t (*size)(void *ctx);
+    uint8_t (*flush)(void *ctx);
+    uint8_t (*read_blocks)(void *ctx, uint32_t block, uint32_t number, uint8_t *destiny);
+    uint8_t (*write_blocks)(void *ctx, uint32_t block, uint32_t number, const uint8_t *source);
+    uint8_t (*read_partial)(void *ctx, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny);
+    uint8_t (*read_end)(void *ctx);
+    uint8_t (*write_start)(void *ctx, uint32_t block, uint32_t number, const uint8_t *source);
+    uint8_t (*poll)(void *ctx);
+    uint32_t (*allocation_unit)(void *ctx);
+} fkfs_device_ops_t;
+
+constexpr uint8_t FKFS_DEVICE_READY = 0;
+constexpr uint8_t FKFS_DEVICE_BUSY = 1;
+constexpr uint8_t FKFS_DEVICE_FAILED = 2;
+
+typedef struct fkfs_device_t {
+    const fkfs_device_ops_t *ops;
+    void *ctx;
+} fkfs_device_t;
+
+uint8_t fkfs_device_read_block(fkfs_device_t *dev, uint32_t block, uint8_t *destiny);
+
+uint8_t fkfs_device_write_block(fkfs_device_t *dev, uint32_t block, const uint8_t *source);
+
+uint8_t fkfs_device_read_blocks(fkfs_device_t *dev, uint32_t block, uint32_t number, uint8_t *destiny);
+
+uint8_t fkfs_device_write_blocks(fkfs_device_t *dev, uint32_t block, uint32_t number, const uint8_t *source);
+
+uint8_t fkfs_device_read_partial(fkfs_device_t *dev, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny);
+
+uint8_t fkfs_device_read_end(fkfs_device_t *dev);
+
+uint8_t fkfs_device_write_start(fkfs_device_t *dev, uint32_t block, uint32_t number, const uint8_t *source);
+
+uint8_t fkfs_device_poll(fkfs_device_t *dev);
+
+uint8_t fkfs_device_erase(fkfs_device_t *dev, uint32_t firstBlock, uint32_t lastBlock);
+
+uint32_t fkfs_device_size(fkfs_device_t *dev);
+
+uint8_t fkfs_device_flush(fkfs_device_t *dev);
+
+uint32_t fkfs_device_allocation_unit(fkfs_device_t *dev);
+
+/**
+ * The SD card, by way of sd_raw. The card should already be initialized.
+ */
+uint8_t fkfs_device_sd_open(fkfs_device_t *dev, sd_raw_t *sd);
+
+/**
+ * A RAM disk over caller provided memory, handy for benchmarking the core
+ * without any I/O cost. Setting busyPolls simulates a write that takes that
+ * many polls to complete, only copying from the source once it's done the way
+ * a DMA transfer would. stalls counts the operations that had to wait and
+ * stallPolls the polls they waited for.
+ */
+typedef struct fkfs_device_ram_t {
+    uint8_t *memory;
+    uint32_t numberOfBlocks;
+    uint32_t busyPolls;
+    uint32_t busy;
+    uint32_t stalls;
+    uint32_t stallPolls;
+    uint32_t block;
+    uint32_t number;
+    const uint8_t *source;
+} fkfs_device_ram_t;
+
+uint8_t fkfs_device_ram_open(fkfs_device_t *dev, fkfs_device_ram_t *ram, uint8_t *memory, uint32_t numberOfBlocks);
+
+#endif
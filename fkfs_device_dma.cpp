@@ -0,0 +1,78 @@
+#ifdef ARDUINO
+
+#include "fkfs_device_dma.h"
+
+// Everything that isn't a DMA transfer goes through sd_raw once any write
+// that's underway is done with the bus.
+static sd_raw_t *fkfs_device_dma_sd(void *ctx) {
+    auto sd_dma = (sd_raw_dma_t *)ctx;
+    sd_raw_dma_wait(sd_dma);
+    return sd_dma->sd;
+}
+
+static uint8_t fkfs_device_dma_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    return sd_raw_dma_read_block((sd_raw_dma_t *)ctx, block, destiny);
+}
+
+static uint8_t fkfs_device_dma_write_start(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    return sd_raw_dma_write_blocks_start((sd_raw_dma_t *)ctx, block, number, source);
+}
+
+static uint8_t fkfs_device_dma_poll(void *ctx) {
+    return sd_raw_dma_poll((sd_raw_dma_t *)ctx);
+}
+
+static uint8_t fkfs_device_dma_write_blocks(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    if (!fkfs_device_dma_write_start(ctx, block, number, source)) {
+        return false;
+    }
+    return sd_raw_dma_wait((sd_raw_dma_t *)ctx) == SD_RAW_WRITE_READY;
+}
+
+static uint8_t fkfs_device_dma_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    return fkfs_device_dma_write_blocks(ctx, block, 1, source);
+}
+
+static uint8_t fkfs_device_dma_read_partial(void *ctx, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    return sd_raw_read_partial(fkfs_device_dma_sd(ctx), block, offset, size, destiny);
+}
+
+static uint8_t fkfs_device_dma_read_end(void *ctx) {
+    return sd_raw_read_end(fkfs_device_dma_sd(ctx));
+}
+
+static uint8_t fkfs_device_dma_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    return sd_raw_erase(fkfs_device_dma_sd(ctx), firstBlock, lastBlock);
+}
+
+static uint32_t fkfs_device_dma_size(void *ctx) {
+    return sd_raw_card_size(fkfs_device_dma_sd(ctx));
+}
+
+static uint32_t fkfs_device_dma_allocation_unit(void *ctx) {
+    return ((sd_raw_dma_t *)ctx)->sd->auBlocks;
+}
+
+static const fkfs_device_ops_t fkfs_device_dma_ops = {
+    .read_block = fkfs_device_dma_read_block,
+    .write_block = fkfs_device_dma_write_block,
+    .erase = fkfs_device_dma_erase,
+    .size = fkfs_device_dma_size,
+    .flush = nullptr,
+    .read_blocks = nullptr,
+    .write_blocks = fkfs_device_dma_write_blocks,
+    .read_partial = fkfs_device_dma_read_partial,
+    .read_end = fkfs_device_dma_read_end,
+    .write_start = fkfs_device_dma_write_start,
+    .poll = fkfs_device_dma_poll,
+    .allocation_unit = fkfs_device_dma_allocation_unit,
+};
+
+uint8_t fkfs_device_dma_open(fkfs_device_t *dev, sd_raw_dma_t *sd_dma) {
+    dev->ops = &fkfs_device_dma_ops;
+    dev->ctx = sd_dma;
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef FKFS_DEVICE_DMA_H_INCLUDED
+#define FKFS_DEVICE_DMA_H_INCLUDED
+
+#ifdef ARDUINO
+
+#include "fkfs_device.h"
+#include "sd_raw_dma.h"
+
+/**
+ * The SD card with block transfers done by DMA. Started writes complete from
+ * the DMA callbacks and the card's busy signal, so fkfs can go on filling the
+ * next block while one is on its way. sd_raw_dma_initialize should already
+ * have been called.
+ */
+uint8_t fkfs_device_dma_open(fkfs_device_t *dev, sd_raw_dma_t *sd_dma);
+
+#endif
+
+#endif
@@ -0,0 +1,720 @@
+#ifndef ARDUINO
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "fkfs_device_host.h"
+
+static uint8_t fkfs_device_file_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    auto file = (fkfs_device_file_t *)ctx;
+
+    if (fseek(file->fp, 0, SEEK_END) != 0) {
+        fprintf(stderr, "error: Unable to seek to block %d\n", block);
+        return false;
+    }
+
+    auto lengthOfFile = ftell(file->fp);
+    auto position = (long)SD_RAW_BLOCK_SIZE * block;
+
+    // Blocks past the end of the image have never been written, so they read
+    // back as zeros rather than whatever was in the buffer.
+    if (position + SD_RAW_BLOCK_SIZE > lengthOfFile) {
+        memset(destiny, 0, SD_RAW_BLOCK_SIZE);
+        return true;
+    }
+
+    if (fseek(file->fp, position, SEEK_SET) != 0) {
+        fprintf(stderr, "error: Unable to seek to block %d\n", block);
+        return false;
+    }
+
+    if (fread(destiny, 1, SD_RAW_BLOCK_SIZE, file->fp) != SD_RAW_BLOCK_SIZE) {
+        fprintf(stderr, "error: Unable to read block %d\n", block);
+        return false;
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_device_file_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    auto file = (fkfs_device_file_t *)ctx;
+    auto position = (long)SD_RAW_BLOCK_SIZE * block;
+
+    if (fseek(file->fp, position, SEEK_SET) != 0) {
+        fprintf(stderr, "error: Unable to seek to block %d\n", block);
+        return false;
+    }
+
+    if (fwrite(source, 1, SD_RAW_BLOCK_SIZE, file->fp) != SD_RAW_BLOCK_SIZE) {
+        fprintf(stderr, "error: Unable to write block %d\n", block);
+        return false;
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_device_file_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    uint8_t zeros[SD_RAW_BLOCK_SIZE] = { 0 };
+
+    for (uint32_t block = firstBlock; block <= lastBlock; ++block) {
+        if (!fkfs_device_file_write_block(ctx, block, zeros)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t fkfs_device_file_size(void *ctx) {
+    auto file = (fkfs_device_file_t *)ctx;
+
+    if (fseek(file->fp, 0, SEEK_END) != 0) {
+        return 0;
+    }
+
+    return ftell(file->fp) / SD_RAW_BLOCK_SIZE;
+}
+
+static uint8_t fkfs_device_file_flush(void *ctx) {
+    auto file = (fkfs_device_file_t *)ctx;
+    return fflush(file->fp) == 0;
+}
+
+static const fkfs_device_ops_t fkfs_device_file_ops = {
+    .read_block = fkfs_device_file_read_block,
+    .write_block = fkfs_device_file_write_block,
+    .erase = fkfs_device_file_erase,
+    .size = fkfs_device_file_size,
+    .flush = fkfs_device_file_flush,
+    .read_blocks = nullptr,
+    .write_blocks = nullptr,
+    .read_partial = nullptr,
+    .read_end = nullptr,
+    .write_start = nullptr,
+    .poll = nullptr,
+    .allocation_unit = nullptr,
+};
+
+uint8_t fkfs_device_file_open(fkfs_device_t *dev, fkfs_device_file_t *file, const char *path) {
+    file->fp = fopen(path, "r+b");
+    if (file->fp == nullptr) {
+        file->fp = fopen(path, "w+b");
+        if (file->fp == nullptr) {
+            return false;
+        }
+    }
+
+    dev->ops = &fkfs_device_file_ops;
+    dev->ctx = file;
+
+    return true;
+}
+
+uint8_t fkfs_device_file_close(fkfs_device_t *dev) {
+    auto file = (fkfs_device_file_t *)dev->ctx;
+    if (file->fp != nullptr) {
+        fclose(file->fp);
+        file->fp = nullptr;
+    }
+    return true;
+}
+
+static uint8_t fkfs_device_mmap_read_blocks(void *ctx, uint32_t block, uint32_t number, uint8_t *destiny) {
+    auto mm = (fkfs_device_mmap_t *)ctx;
+    if (block + number > mm->numberOfBlocks) {
+        return false;
+    }
+    memcpy(destiny, mm->memory + (size_t)block * SD_RAW_BLOCK_SIZE, (size_t)number * SD_RAW_BLOCK_SIZE);
+    return true;
+}
+
+static uint8_t fkfs_device_mmap_write_blocks(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    auto mm = (fkfs_device_mmap_t *)ctx;
+    if (block + number > mm->numberOfBlocks) {
+        return false;
+    }
+    memcpy(mm->memory + (size_t)block * SD_RAW_BLOCK_SIZE, source, (size_t)number * SD_RAW_BLOCK_SIZE);
+    return true;
+}
+
+static uint8_t fkfs_device_mmap_read_partial(void *ctx, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    auto mm = (fkfs_device_mmap_t *)ctx;
+    if (block >= mm->numberOfBlocks) {
+        return false;
+    }
+    memcpy(destiny, mm->memory + (size_t)block * SD_RAW_BLOCK_SIZE + offset, size);
+    return true;
+}
+
+static uint8_t fkfs_device_mmap_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    return fkfs_device_mmap_read_blocks(ctx, block, 1, destiny);
+}
+
+static uint8_t fkfs_device_mmap_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    return fkfs_device_mmap_write_blocks(ctx, block, 1, source);
+}
+
+static uint8_t fkfs_device_mmap_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    auto mm = (fkfs_device_mmap_t *)ctx;
+    if (firstBlock > lastBlock || lastBlock >= mm->numberOfBlocks) {
+        return false;
+    }
+    memset(mm->memory + (size_t)firstBlock * SD_RAW_BLOCK_SIZE, 0, (size_t)(lastBlock - firstBlock + 1) * SD_RAW_BLOCK_SIZE);
+    return true;
+}
+
+static uint32_t fkfs_device_mmap_size(void *ctx) {
+    auto mm = (fkfs_device_mmap_t *)ctx;
+    return mm->numberOfBlocks;
+}
+
+static uint8_t fkfs_device_mmap_flush(void *ctx) {
+    auto mm = (fkfs_device_mmap_t *)ctx;
+    return msync(mm->memory, (size_t)mm->numberOfBlocks * SD_RAW_BLOCK_SIZE, MS_SYNC) == 0;
+}
+
+static const fkfs_device_ops_t fkfs_device_mmap_ops = {
+    .read_block = fkfs_device_mmap_read_block,
+    .write_block = fkfs_device_mmap_write_block,
+    .erase = fkfs_device_mmap_erase,
+    .size = fkfs_device_mmap_size,
+    .flush = fkfs_device_mmap_flush,
+    .read_blocks = fkfs_device_mmap_read_blocks,
+    .write_blocks = fkfs_device_mmap_write_blocks,
+    .read_partial = fkfs_device_mmap_read_partial,
+    .read_end = nullptr,
+    .write_start = nullptr,
+    .poll = nullptr,
+    .allocation_unit = nullptr,
+};
+
+uint8_t fkfs_device_mmap_open(fkfs_device_t *dev, fkfs_device_mmap_t *mm, const char *path, uint32_t numberOfBlocks) {
+    mm->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (mm->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(mm->fd, &st) != 0) {
+        close(mm->fd);
+        return false;
+    }
+
+    uint32_t existing = st.st_size / SD_RAW_BLOCK_SIZE;
+    if (numberOfBlocks > existing) {
+        if (ftruncate(mm->fd, (off_t)numberOfBlocks * SD_RAW_BLOCK_SIZE) != 0) {
+            close(mm->fd);
+            return false;
+        }
+    }
+    else {
+        numberOfBlocks = existing;
+    }
+
+    if (numberOfBlocks == 0) {
+        close(mm->fd);
+        return false;
+    }
+
+    auto length = (size_t)numberOfBlocks * SD_RAW_BLOCK_SIZE;
+    auto memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, mm->fd, 0);
+    if (memory == MAP_FAILED) {
+        close(mm->fd);
+        return false;
+    }
+
+    mm->memory = (uint8_t *)memory;
+    mm->numberOfBlocks = numberOfBlocks;
+
+    dev->ops = &fkfs_device_mmap_ops;
+    dev->ctx = mm;
+
+    return true;
+}
+
+uint8_t fkfs_device_mmap_close(fkfs_device_t *dev) {
+    auto mm = (fkfs_device_mmap_t *)dev->ctx;
+    if (mm->memory != nullptr) {
+        munmap(mm->memory, (size_t)mm->numberOfBlocks * SD_RAW_BLOCK_SIZE);
+        mm->memory = nullptr;
+    }
+    if (mm->fd >= 0) {
+        close(mm->fd);
+        mm->fd = -1;
+    }
+    return true;
+}
+
+static uint64_t fkfs_device_fd_position(uint32_t block) {
+    return (uint64_t)block * SD_RAW_BLOCK_SIZE;
+}
+
+static uint8_t fkfs_device_fd_read(fkfs_device_fd_t *fd, uint32_t block, uint64_t position, size_t length, uint8_t *destiny) {
+    // Anything past the end of the image has never been written and so reads
+    // back as zeros, no reason to bother the kernel for that.
+    size_t available = 0;
+    if (position < fd->length) {
+        available = fd->length - position < length ? fd->length - position : length;
+    }
+
+    size_t done = 0;
+    while (done < available) {
+        fd->statistics.syscalls++;
+        auto r = pread(fd->fd, destiny + done, available - done, position + done);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            fprintf(stderr, "error: Unable to read block %d\n", block);
+            return false;
+        }
+        done += r;
+    }
+
+    fd->statistics.bytesRead += done;
+
+    if (done < length) {
+        memset(destiny + done, 0, length - done);
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_device_fd_read_blocks(void *ctx, uint32_t block, uint32_t number, uint8_t *destiny) {
+    auto fd = (fkfs_device_fd_t *)ctx;
+
+    fd->statistics.reads += number;
+
+    return fkfs_device_fd_read(fd, block, fkfs_device_fd_position(block), (size_t)number * SD_RAW_BLOCK_SIZE, destiny);
+}
+
+static uint8_t fkfs_device_fd_read_partial(void *ctx, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    auto fd = (fkfs_device_fd_t *)ctx;
+
+    fd->statistics.reads++;
+
+    return fkfs_device_fd_read(fd, block, fkfs_device_fd_position(block) + offset, size, destiny);
+}
+
+static uint8_t fkfs_device_fd_write_blocks(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    auto fd = (fkfs_device_fd_t *)ctx;
+    auto position = fkfs_device_fd_position(block);
+    auto length = (size_t)number * SD_RAW_BLOCK_SIZE;
+
+    if (fd->numberOfBlocks > 0 && block + number > fd->numberOfBlocks) {
+        return false;
+    }
+
+    fd->statistics.writes += number;
+
+    size_t done = 0;
+    while (done < length) {
+        fd->statistics.syscalls++;
+        auto w = pwrite(fd->fd, source + done, length - done, position + done);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            fprintf(stderr, "error: Unable to write block %d\n", block);
+            return false;
+        }
+        done += w;
+    }
+
+    fd->statistics.bytesWritten += done;
+
+    if (position + length > fd->length) {
+        fd->length = position + length;
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_device_fd_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    return fkfs_device_fd_read_blocks(ctx, block, 1, destiny);
+}
+
+static uint8_t fkfs_device_fd_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    return fkfs_device_fd_write_blocks(ctx, block, 1, source);
+}
+
+static uint8_t fkfs_device_fd_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    auto fd = (fkfs_device_fd_t *)ctx;
+
+    if (firstBlock > lastBlock) {
+        return false;
+    }
+
+    auto position = fkfs_device_fd_position(firstBlock);
+    if (position >= fd->length) {
+        return true;
+    }
+
+    auto end = fkfs_device_fd_position(lastBlock + 1);
+    if (end > fd->length) {
+        end = fd->length;
+    }
+
+    fd->statistics.erases += lastBlock - firstBlock + 1;
+    fd->statistics.syscalls++;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, end - position) == 0) {
+        return true;
+    }
+#endif
+
+    // No hole punching here, so write the zeros ourselves.
+    uint8_t zeros[SD_RAW_BLOCK_SIZE * 16] = { 0 };
+    while (position < end) {
+        auto length = end - position < sizeof(zeros) ? end - position : sizeof(zeros);
+        fd->statistics.syscalls++;
+        if (pwrite(fd->fd, zeros, length, position) != (ssize_t)length) {
+            return false;
+        }
+        position += length;
+    }
+
+    return true;
+}
+
+static uint32_t fkfs_device_fd_size(void *ctx) {
+    auto fd = (fkfs_device_fd_t *)ctx;
+    if (fd->numberOfBlocks > 0) {
+        return fd->numberOfBlocks;
+    }
+    return fd->length / SD_RAW_BLOCK_SIZE;
+}
+
+static uint8_t fkfs_device_fd_flush(void *ctx) {
+    auto fd = (fkfs_device_fd_t *)ctx;
+    fd->statistics.syscalls++;
+    return fdatasync(fd->fd) == 0;
+}
+
+static const fkfs_device_ops_t fkfs_device_fd_ops = {
+    .read_block = fkfs_device_fd_read_block,
+    .write_block = fkfs_device_fd_write_block,
+    .erase = fkfs_device_fd_erase,
+    .size = fkfs_device_fd_size,
+    .flush = fkfs_device_fd_flush,
+    .read_blocks = fkfs_device_fd_read_blocks,
+    .write_blocks = fkfs_device_fd_write_blocks,
+    .read_partial = fkfs_device_fd_read_partial,
+    .read_end = nullptr,
+    .write_start = nullptr,
+    .poll = nullptr,
+    .allocation_unit = nullptr,
+};
+
+uint8_t fkfs_device_fd_open(fkfs_device_t *dev, fkfs_device_fd_t *fd, const char *path, uint32_t numberOfBlocks) {
+    memset(fd, 0, sizeof(fkfs_device_fd_t));
+
+    fd->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd->fd, &st) != 0) {
+        close(fd->fd);
+        return false;
+    }
+
+    fd->length = st.st_size;
+
+    // Setting the length leaves a hole, so large images cost nothing until
+    // they're written to.
+    if (numberOfBlocks > 0 && fkfs_device_fd_position(numberOfBlocks) != fd->length) {
+        if (ftruncate(fd->fd, fkfs_device_fd_position(numberOfBlocks)) != 0) {
+            close(fd->fd);
+            return false;
+        }
+        fd->length = fkfs_device_fd_position(numberOfBlocks);
+    }
+
+    fd->numberOfBlocks = numberOfBlocks;
+
+    dev->ops = &fkfs_device_fd_ops;
+    dev->ctx = fd;
+
+    return true;
+}
+
+uint8_t fkfs_device_fd_close(fkfs_device_t *dev) {
+    auto fd = (fkfs_device_fd_t *)dev->ctx;
+    if (fd->fd >= 0) {
+        close(fd->fd);
+        fd->fd = -1;
+    }
+    return true;
+}
+
+void fkfs_device_fd_log_statistics(fkfs_device_t *dev) {
+    auto fd = (fkfs_device_fd_t *)dev->ctx;
+    fprintf(stderr, "fd: reads=%d writes=%d erases=%d syscalls=%d read=%llu written=%llu\n",
+            fd->statistics.reads, fd->statistics.writes, fd->statistics.erases, fd->statistics.syscalls,
+            (unsigned long long)fd->statistics.bytesRead, (unsigned long long)fd->statistics.bytesWritten);
+}
+
+static uint8_t fkfs_device_direct_fill(fkfs_device_direct_t *direct, uint32_t block) {
+    // Windows start on an alignment boundary so that the offset, length and
+    // buffer all satisfy O_DIRECT.
+    constexpr uint32_t BlocksPerAlignment = FKFS_DEVICE_DIRECT_ALIGNMENT / SD_RAW_BLOCK_SIZE;
+    auto start = block - (block % BlocksPerAlignment);
+    auto number = direct->windowBlocks;
+    if (start + number > direct->numberOfBlocks) {
+        number = direct->numberOfBlocks - start;
+    }
+
+    auto length = (size_t)number * SD_RAW_BLOCK_SIZE;
+    auto aligned = (length + FKFS_DEVICE_DIRECT_ALIGNMENT - 1) & ~(size_t)(FKFS_DEVICE_DIRECT_ALIGNMENT - 1);
+    auto position = (uint64_t)start * SD_RAW_BLOCK_SIZE;
+
+    size_t done = 0;
+    while (done < aligned) {
+        auto r = pread(direct->fd, direct->window + done, aligned - done, position + done);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            fprintf(stderr, "error: Unable to read extent at block %d (%s)\n", start, strerror(errno));
+            return false;
+        }
+        if (r == 0) {
+            break;
+        }
+        done += r;
+    }
+
+    if (done < length) {
+        memset(direct->window + done, 0, length - done);
+    }
+
+    direct->statistics.extents++;
+    direct->statistics.bytesRead += done;
+    direct->windowStart = start;
+    direct->windowValid = number;
+
+    return true;
+}
+
+static uint8_t fkfs_device_direct_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    auto direct = (fkfs_device_direct_t *)ctx;
+
+    if (block >= direct->numberOfBlocks) {
+        memset(destiny, 0, SD_RAW_BLOCK_SIZE);
+        return true;
+    }
+
+    if (block < direct->windowStart || block >= direct->windowStart + direct->windowValid) {
+        direct->statistics.misses++;
+        if (!fkfs_device_direct_fill(direct, block)) {
+            return false;
+        }
+    }
+    else {
+        direct->statistics.hits++;
+    }
+
+    memcpy(destiny, direct->window + (size_t)(block - direct->windowStart) * SD_RAW_BLOCK_SIZE, SD_RAW_BLOCK_SIZE);
+
+    return true;
+}
+
+// O_DIRECT transfers whole logical sectors, so a block sharing its sector
+// with others is written by reading the sector back and changing it there.
+static uint8_t fkfs_device_direct_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    auto direct = (fkfs_device_direct_t *)ctx;
+
+    if (direct->readOnly || block >= direct->numberOfBlocks) {
+        return false;
+    }
+
+    auto blocksPerSector = direct->sectorSize / SD_RAW_BLOCK_SIZE;
+    auto position = (uint64_t)(block - block % blocksPerSector) * SD_RAW_BLOCK_SIZE;
+
+    if (blocksPerSector > 1) {
+        ssize_t r;
+        while ((r = pread(direct->fd, direct->bounce, direct->sectorSize, position)) < 0 && errno == EINTR) {
+        }
+        if (r < 0) {
+            fprintf(stderr, "error: Unable to read sector of block %d (%s)\n", block, strerror(errno));
+            return false;
+        }
+        // The end of an image is only zeros to be written over.
+        memset(direct->bounce + r, 0, direct->sectorSize - r);
+    }
+
+    memcpy(direct->bounce + (block % blocksPerSector) * SD_RAW_BLOCK_SIZE, source, SD_RAW_BLOCK_SIZE);
+
+    if (pwrite(direct->fd, direct->bounce, direct->sectorSize, position) != (ssize_t)direct->sectorSize) {
+        fprintf(stderr, "error: Unable to write block %d (%s)\n", block, strerror(errno));
+        return false;
+    }
+
+    direct->statistics.writes++;
+
+    // Keep the window coherent with what we just wrote.
+    if (block >= direct->windowStart && block < direct->windowStart + direct->windowValid) {
+        memcpy(direct->window + (size_t)(block - direct->windowStart) * SD_RAW_BLOCK_SIZE, source, SD_RAW_BLOCK_SIZE);
+    }
+
+    return true;
+}
+
+static uint32_t fkfs_device_direct_size(void *ctx) {
+    auto direct = (fkfs_device_direct_t *)ctx;
+    return direct->numberOfBlocks;
+}
+
+static uint8_t fkfs_device_direct_flush(void *ctx) {
+    auto direct = (fkfs_device_direct_t *)ctx;
+    return fdatasync(direct->fd) == 0;
+}
+
+static const fkfs_device_ops_t fkfs_device_direct_ops = {
+    .read_block = fkfs_device_direct_read_block,
+    .write_block = fkfs_device_direct_write_block,
+    .erase = nullptr,
+    .size = fkfs_device_direct_size,
+    .flush = fkfs_device_direct_flush,
+    .read_blocks = nullptr,
+    .write_blocks = nullptr,
+    .read_partial = nullptr,
+    .read_end = nullptr,
+    .write_start = nullptr,
+    .poll = nullptr,
+    .allocation_unit = nullptr,
+};
+
+static int fkfs_device_direct_open_fd(const char *path, uint8_t readOnly, uint8_t *direct) {
+    auto flags = readOnly ? O_RDONLY : O_RDWR;
+    int fd;
+
+#ifdef O_DIRECT
+    fd = open(path, flags | O_DIRECT);
+    if (fd >= 0) {
+        *direct = true;
+        return fd;
+    }
+    if (errno != EINVAL) {
+        return -1;
+    }
+#endif
+
+    *direct = false;
+
+    fd = open(path, flags);
+#ifdef __APPLE__
+    if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) == 0) {
+        *direct = true;
+    }
+#endif
+    return fd;
+}
+
+uint8_t fkfs_device_direct_open(fkfs_device_t *dev, fkfs_device_direct_t *direct, const char *path, uint32_t windowBlocks, uint8_t readOnly) {
+    memset(direct, 0, sizeof(fkfs_device_direct_t));
+
+    constexpr uint32_t BlocksPerAlignment = FKFS_DEVICE_DIRECT_ALIGNMENT / SD_RAW_BLOCK_SIZE;
+    if (windowBlocks == 0) {
+        windowBlocks = FKFS_DEVICE_DIRECT_WINDOW_DEFAULT;
+    }
+    windowBlocks = (windowBlocks + BlocksPerAlignment - 1) / BlocksPerAlignment * BlocksPerAlignment;
+
+    direct->fd = fkfs_device_direct_open_fd(path, readOnly, &direct->direct);
+    if (direct->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(direct->fd, &st) != 0) {
+        close(direct->fd);
+        return false;
+    }
+
+    uint64_t length = st.st_size;
+    int sectorSize = SD_RAW_BLOCK_SIZE;
+#if defined(__linux__) && defined(BLKGETSIZE64)
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(direct->fd, BLKGETSIZE64, &length) != 0) {
+            close(direct->fd);
+            return false;
+        }
+    }
+#endif
+#if defined(__linux__) && defined(BLKSSZGET)
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(direct->fd, BLKSSZGET, &sectorSize) != 0) {
+            close(direct->fd);
+            return false;
+        }
+    }
+#endif
+
+    // Windows are aligned for the largest sectors we expect.
+    if (sectorSize < SD_RAW_BLOCK_SIZE || sectorSize > (int)FKFS_DEVICE_DIRECT_ALIGNMENT || sectorSize % SD_RAW_BLOCK_SIZE != 0) {
+        fprintf(stderr, "error: Unsupported sector size %d\n", sectorSize);
+        close(direct->fd);
+        return false;
+    }
+
+    direct->readOnly = readOnly;
+    direct->sectorSize = sectorSize;
+    direct->numberOfBlocks = length / SD_RAW_BLOCK_SIZE;
+    direct->windowBlocks = windowBlocks;
+
+    void *window = nullptr;
+    if (posix_memalign(&window, FKFS_DEVICE_DIRECT_ALIGNMENT, (size_t)windowBlocks * SD_RAW_BLOCK_SIZE) != 0) {
+        close(direct->fd);
+        return false;
+    }
+
+    void *bounce = nullptr;
+    if (posix_memalign(&bounce, sectorSize, sectorSize) != 0) {
+        free(window);
+        close(direct->fd);
+        return false;
+    }
+
+    direct->window = (uint8_t *)window;
+    direct->bounce = (uint8_t *)bounce;
+
+    dev->ops = &fkfs_device_direct_ops;
+    dev->ctx = direct;
+
+    return true;
+}
+
+uint8_t fkfs_device_direct_close(fkfs_device_t *dev) {
+    auto direct = (fkfs_device_direct_t *)dev->ctx;
+    free(direct->window);
+    free(direct->bounce);
+    direct->window = nullptr;
+    direct->bounce = nullptr;
+    if (direct->fd >= 0) {
+        close(direct->fd);
+        direct->fd = -1;
+    }
+    return true;
+}
+
+void fkfs_device_direct_log_statistics(fkfs_device_t *dev) {
+    auto direct = (fkfs_device_direct_t *)dev->ctx;
+    fprintf(stderr, "direct: direct=%d sector=%d window=%d extents=%d hits=%d misses=%d writes=%d read=%llu\n",
+            direct->direct, direct->sectorSize, direct->windowBlocks, direct->statistics.extents,
+            direct->statistics.hits, direct->statistics.misses, direct->statistics.writes,
+            (unsigned long long)direct->statistics.bytesRead);
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef FKFS_DEVICE_HOST_H_INCLUDED
+#define FKFS_DEVICE_HOST_H_INCLUDED
+
+#ifndef ARDUINO
+
+#include <stdio.h>
+
+#include "fkfs_device.h"
+
+/**
+ * An image file accessed through stdio.
+ */
+typedef struct fkfs_device_file_t {
+    FILE *fp;
+} fkfs_device_file_t;
+
+uint8_t fkfs_device_file_open(fkfs_device_t *dev, fkfs_device_file_t *file, const char *path);
+
+uint8_t fkfs_device_file_close(fkfs_device_t *dev);
+
+/**
+ * An image file mapped into memory. If numberOfBlocks is larger than the
+ * image the image is grown, if it's zero the existing size is used.
+ */
+typedef struct fkfs_device_mmap_t {
+    int fd;
+    uint8_t *memory;
+    uint32_t numberOfBlocks;
+} fkfs_device_mmap_t;
+
+uint8_t fkfs_device_mmap_open(fkfs_device_t *dev, fkfs_device_mmap_t *mm, const char *path, uint32_t numberOfBlocks);
+
+uint8_t fkfs_device_mmap_close(fkfs_device_t *dev);
+
+/**
+ * An image file accessed with positioned I/O, one syscall per operation. The
+ * length of the image is cached so reads past the end are answered without
+ * touching the kernel and erases punch holes, keeping images sparse.
+ */
+typedef struct fkfs_device_fd_statistics_t {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t syscalls;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+} fkfs_device_fd_statistics_t;
+
+typedef struct fkfs_device_fd_t {
+    int fd;
+    uint64_t length;
+    uint32_t numberOfBlocks;
+    fkfs_device_fd_statistics_t statistics;
+} fkfs_device_fd_t;
+
+/**
+ * If numberOfBlocks is non-zero the image is given that size (sparsely),
+ * otherwise the size of the device follows the length of the image.
+ */
+uint8_t fkfs_device_fd_open(fkfs_device_t *dev, fkfs_device_fd_t *fd, const char *path, uint32_t numberOfBlocks);
+
+uint8_t fkfs_device_fd_close(fkfs_device_t *dev);
+
+void fkfs_device_fd_log_statistics(fkfs_device_t *dev);
+
+/**
+ * A raw device (or image) opened with O_DIRECT, bypassing the page cache. Reads
+ * are served from a window of windowBlocks blocks that's refilled with a
+ * single large aligned read whenever a block outside of it is requested, so
+ * sequential scans run at the reader's bandwidth. Writes go through a bounce
+ * buffer of one logical sector, read back first when sectors hold more than
+ * one block.
+ */
+constexpr uint32_t FKFS_DEVICE_DIRECT_ALIGNMENT = 4096;
+constexpr uint32_t FKFS_DEVICE_DIRECT_WINDOW_DEFAULT = 2048;
+
+typedef struct fkfs_device_direct_statistics_t {
+    uint32_t extents;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t writes;
+    uint64_t bytesRead;
+} fkfs_device_direct_statistics_t;
+
+typedef struct fkfs_device_direct_t {
+    int fd;
+    uint8_t direct;
+    uint8_t *window;
+    uint8_t *bounce;
+    uint8_t readOnly;
+    uint32_t sectorSize;
+    uint32_t windowBlocks;
+    uint32_t windowStart;
+    uint32_t windowValid;
+    uint32_t numberOfBlocks;
+    fkfs_device_direct_statistics_t statistics;
+} fkfs_device_direct_t;
+
+/**
+ * Zero windowBlocks uses the default. If the file system holding path doesn't
+ * support O_DIRECT the device is opened normally, direct tells which was used.
+ * A readOnly device is opened that way and refuses writes.
+ */
+uint8_t fkfs_device_direct_open(fkfs_device_t *dev, fkfs_device_direct_t *direct, const char *path, uint32_t windowBlocks, uint8_t readOnly);
+
+uint8_t fkfs_device_direct_close(fkfs_device_t *dev);
+
+void fkfs_device_direct_log_statistics(fkfs_device_t *dev);
+
+#endif
+
+#endif
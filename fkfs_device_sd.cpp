@@ -0,0 +1,70 @@
+#include "fkfs_device.h"
+
+static uint8_t fkfs_device_sd_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    return sd_raw_read_block((sd_raw_t *)ctx, block, destiny);
+}
+
+static uint8_t fkfs_device_sd_read_blocks(void *ctx, uint32_t block, uint32_t number, uint8_t *destiny) {
+    return sd_raw_read_blocks((sd_raw_t *)ctx, block, number, destiny);
+}
+
+static uint8_t fkfs_device_sd_read_partial(void *ctx, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    return sd_raw_read_partial((sd_raw_t *)ctx, block, offset, size, destiny);
+}
+
+static uint8_t fkfs_device_sd_read_end(void *ctx) {
+    return sd_raw_read_end((sd_raw_t *)ctx);
+}
+
+static uint8_t fkfs_device_sd_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    return sd_raw_write_block((sd_raw_t *)ctx, block, source);
+}
+
+static uint8_t fkfs_device_sd_write_blocks(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    return sd_raw_write_blocks((sd_raw_t *)ctx, block, number, source);
+}
+
+static uint8_t fkfs_device_sd_write_start(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    if (number == 1) {
+        return sd_raw_write_block_start((sd_raw_t *)ctx, block, source);
+    }
+    return sd_raw_write_blocks_start((sd_raw_t *)ctx, block, number, source);
+}
+
+static uint8_t fkfs_device_sd_poll(void *ctx) {
+    return sd_raw_write_poll((sd_raw_t *)ctx);
+}
+
+static uint8_t fkfs_device_sd_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    return sd_raw_erase((sd_raw_t *)ctx, firstBlock, lastBlock);
+}
+
+static uint32_t fkfs_device_sd_size(void *ctx) {
+    return sd_raw_card_size((sd_raw_t *)ctx);
+}
+
+static uint32_t fkfs_device_sd_allocation_unit(void *ctx) {
+    return ((sd_raw_t *)ctx)->auBlocks;
+}
+
+static const fkfs_device_ops_t fkfs_device_sd_ops = {
+    .read_block = fkfs_device_sd_read_block,
+    .write_block = fkfs_device_sd_write_block,
+    .erase = fkfs_device_sd_erase,
+    .size = fkfs_device_sd_size,
+    .flush = nullptr,
+    .read_blocks = fkfs_device_sd_read_blocks,
+    .write_blocks = fkfs_device_sd_write_blocks,
+    .read_partial = fkfs_device_sd_read_partial,
+    .read_end = fkfs_device_sd_read_end,
+    .write_start = fkfs_device_sd_write_start,
+    .poll = fkfs_device_sd_poll,
+    .allocation_unit = fkfs_device_sd_allocation_unit,
+};
+
+uint8_t fkfs_device_sd_open(fkfs_device_t *dev, sd_raw_t *sd) {
+    dev->ops = &fkfs_device_sd_ops;
+    dev->ctx = sd;
+
+    return true;
+}
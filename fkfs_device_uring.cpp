@@ -0,0 +1,613 @@
+#if !defined(ARDUINO) && defined(__linux__)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "fkfs_device_uring.h"
+
+constexpr uint32_t FKFS_DEVICE_URING_DEPTH_DEFAULT = 8;
+constexpr uint32_t FKFS_DEVICE_URING_ALIGNMENT = 4096;
+constexpr uint32_t FKFS_DEVICE_URING_SLOT_SIZE = FKFS_DEVICE_URING_SLOT_BLOCKS * SD_RAW_BLOCK_SIZE;
+
+// Write slots are tagged in the user data so completions can find their way
+// back to the right slot.
+constexpr uint64_t FKFS_DEVICE_URING_WRITE_TAG = 1ULL << 32;
+
+enum {
+    FKFS_DEVICE_URING_SLOT_FREE,
+    FKFS_DEVICE_URING_SLOT_QUEUED,
+    FKFS_DEVICE_URING_SLOT_INFLIGHT,
+    FKFS_DEVICE_URING_SLOT_READY,
+};
+
+static int fkfs_io_uring_setup(uint32_t entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int fkfs_io_uring_enter(int ring, uint32_t submit, uint32_t complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, ring, submit, complete, flags, nullptr, 0);
+}
+
+static struct io_uring_sqe *fkfs_device_uring_sqe(fkfs_device_uring_t *uring) {
+    auto tail = *uring->sqTail + uring->queued;
+    auto index = tail & *uring->sqMask;
+    auto sqe = &((struct io_uring_sqe *)uring->sqes)[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sqArray[index] = index;
+    uring->queued++;
+
+    return sqe;
+}
+
+static void fkfs_device_uring_prepare(fkfs_device_uring_t *uring, uint8_t opcode, uint64_t data, uint32_t block, uint32_t length, uint8_t *buffer) {
+    auto sqe = fkfs_device_uring_sqe(uring);
+    sqe->opcode = opcode;
+    sqe->fd = uring->file;
+    sqe->off = (uint64_t)block * SD_RAW_BLOCK_SIZE;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = length;
+    sqe->user_data = data;
+}
+
+static void fkfs_device_uring_complete(fkfs_device_uring_t *uring, uint64_t data, int32_t res) {
+    uring->inflight--;
+
+    if (data & FKFS_DEVICE_URING_WRITE_TAG) {
+        auto slot = &uring->writes[data & ~FKFS_DEVICE_URING_WRITE_TAG];
+        if (res != (int32_t)(slot->number * SD_RAW_BLOCK_SIZE)) {
+            fprintf(stderr, "error: Unable to write block %d (%d)\n", slot->block, res);
+            uring->error = true;
+        }
+        slot->state = FKFS_DEVICE_URING_SLOT_FREE;
+        return;
+    }
+
+    auto slot = &uring->reads[data];
+    if (res < 0) {
+        fprintf(stderr, "error: Unable to read block %d (%d)\n", slot->block, res);
+        slot->state = FKFS_DEVICE_URING_SLOT_FREE;
+        uring->error = true;
+        return;
+    }
+
+    // Short reads happen at the end of the image, the rest was never written.
+    auto length = slot->number * SD_RAW_BLOCK_SIZE;
+    if ((uint32_t)res < length) {
+        memset(slot->buffer + res, 0, length - res);
+    }
+
+    slot->state = FKFS_DEVICE_URING_SLOT_READY;
+}
+
+static void fkfs_device_uring_reap(fkfs_device_uring_t *uring) {
+    auto head = *uring->cqHead;
+    auto tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        auto cqe = &((struct io_uring_cqe *)uring->cqes)[head & *uring->cqMask];
+        fkfs_device_uring_complete(uring, cqe->user_data, cqe->res);
+        head++;
+    }
+
+    __atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static uint8_t fkfs_device_uring_submit(fkfs_device_uring_t *uring, uint32_t wait) {
+    auto submit = uring->queued;
+    if (submit > 0) {
+        __atomic_store_n(uring->sqTail, *uring->sqTail + submit, __ATOMIC_RELEASE);
+        uring->queued = 0;
+        uring->inflight += submit;
+    }
+
+    for (auto slot = uring->writes; slot < uring->writes + uring->depth; ++slot) {
+        if (slot->state == FKFS_DEVICE_URING_SLOT_QUEUED) {
+            slot->state = FKFS_DEVICE_URING_SLOT_INFLIGHT;
+        }
+    }
+    for (auto slot = uring->reads; slot < uring->reads + uring->depth; ++slot) {
+        if (slot->state == FKFS_DEVICE_URING_SLOT_QUEUED) {
+            slot->state = FKFS_DEVICE_URING_SLOT_INFLIGHT;
+        }
+    }
+
+    if (submit == 0 && wait == 0) {
+        return true;
+    }
+
+    auto flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        uring->statistics.submits++;
+        auto r = fkfs_io_uring_enter(uring->ring, submit, wait, flags);
+        if (r >= 0) {
+            break;
+        }
+        if (errno != EINTR) {
+            fprintf(stderr, "error: io_uring_enter failed (%s)\n", strerror(errno));
+            uring->error = true;
+            return false;
+        }
+        submit = 0;
+    }
+
+    fkfs_device_uring_reap(uring);
+
+    return true;
+}
+
+static uint8_t fkfs_device_uring_wait_slot(fkfs_device_uring_t *uring, fkfs_device_uring_slot_t *slot) {
+    if (slot->state == FKFS_DEVICE_URING_SLOT_QUEUED) {
+        if (!fkfs_device_uring_submit(uring, 0)) {
+            return false;
+        }
+    }
+
+    while (slot->state == FKFS_DEVICE_URING_SLOT_INFLIGHT) {
+        uring->statistics.waits++;
+        if (!fkfs_device_uring_submit(uring, 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_device_uring_drain_writes(fkfs_device_uring_t *uring) {
+    for (auto slot = uring->writes; slot < uring->writes + uring->depth; ++slot) {
+        if (!fkfs_device_uring_wait_slot(uring, slot)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static fkfs_device_uring_slot_t *fkfs_device_uring_find(fkfs_device_uring_slot_t *slots, uint32_t depth, uint32_t block) {
+    for (auto slot = slots; slot < slots + depth; ++slot) {
+        if (slot->state != FKFS_DEVICE_URING_SLOT_FREE && block >= slot->block && block < slot->block + slot->number) {
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+static fkfs_device_uring_slot_t *fkfs_device_uring_free_read(fkfs_device_uring_t *uring, uint32_t keep) {
+    // Completed reads behind the block being read can be reused.
+    for (auto slot = uring->reads; slot < uring->reads + uring->depth; ++slot) {
+        if (slot->state == FKFS_DEVICE_URING_SLOT_FREE) {
+            return slot;
+        }
+    }
+    for (auto slot = uring->reads; slot < uring->reads + uring->depth; ++slot) {
+        if (slot->state == FKFS_DEVICE_URING_SLOT_READY && !(keep >= slot->block && keep < slot->block + slot->number)) {
+            if (slot->block + slot->number <= keep || slot->block > keep + uring->depth * FKFS_DEVICE_URING_SLOT_BLOCKS) {
+                return slot;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static uint8_t fkfs_device_uring_queue_read(fkfs_device_uring_t *uring, fkfs_device_uring_slot_t *slot, uint32_t block) {
+    auto numberOfBlocks = fkfs_device_size(&uring->sync);
+    auto number = FKFS_DEVICE_URING_SLOT_BLOCKS;
+    if (numberOfBlocks > 0 && block + number > numberOfBlocks) {
+        number = numberOfBlocks > block ? numberOfBlocks - block : 0;
+    }
+    if (number == 0) {
+        return false;
+    }
+
+    // The kernel is free to reorder requests, so any write to the range has
+    // to land before we read it back.
+    for (auto write = uring->writes; write < uring->writes + uring->depth; ++write) {
+        if (write->state != FKFS_DEVICE_URING_SLOT_FREE && write->block >= block && write->block < block + number) {
+            if (!fkfs_device_uring_wait_slot(uring, write)) {
+                return false;
+            }
+        }
+    }
+
+    slot->block = block;
+    slot->number = number;
+    slot->state = FKFS_DEVICE_URING_SLOT_QUEUED;
+
+    uring->statistics.reads++;
+
+    // O_DIRECT needs aligned lengths, reads past the end just come up short.
+    auto length = number * SD_RAW_BLOCK_SIZE;
+    if (uring->direct) {
+        length = (length + FKFS_DEVICE_URING_ALIGNMENT - 1) & ~(FKFS_DEVICE_URING_ALIGNMENT - 1);
+    }
+
+    fkfs_device_uring_prepare(uring, IORING_OP_READ, slot - uring->reads, block, length, slot->buffer);
+
+    return true;
+}
+
+static uint32_t fkfs_device_uring_slot_start(uint32_t block) {
+    return block - (block % FKFS_DEVICE_URING_SLOT_BLOCKS);
+}
+
+static void fkfs_device_uring_read_ahead(fkfs_device_uring_t *uring, uint32_t block) {
+    auto next = fkfs_device_uring_slot_start(block) + FKFS_DEVICE_URING_SLOT_BLOCKS;
+    auto numberOfBlocks = fkfs_device_size(&uring->sync);
+
+    for (uint32_t i = 1; i < uring->depth; ++i, next += FKFS_DEVICE_URING_SLOT_BLOCKS) {
+        if (numberOfBlocks > 0 && next >= numberOfBlocks) {
+            break;
+        }
+        if (fkfs_device_uring_find(uring->reads, uring->depth, next) != nullptr) {
+            continue;
+        }
+        auto slot = fkfs_device_uring_free_read(uring, block);
+        if (slot == nullptr) {
+            break;
+        }
+        fkfs_device_uring_queue_read(uring, slot, next);
+    }
+}
+
+static uint8_t fkfs_device_uring_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    auto uring = (fkfs_device_uring_t *)ctx;
+
+    if (uring->fallback) {
+        return fkfs_device_read_block(&uring->sync, block, destiny);
+    }
+
+    if (uring->error) {
+        return false;
+    }
+
+    // Queued writes may cover this block, so they go first.
+    auto pending = fkfs_device_uring_find(uring->writes, uring->depth, block);
+    if (pending != nullptr) {
+        if (!fkfs_device_uring_wait_slot(uring, pending)) {
+            return false;
+        }
+    }
+
+    auto slot = fkfs_device_uring_find(uring->reads, uring->depth, block);
+    if (slot == nullptr) {
+        slot = fkfs_device_uring_free_read(uring, block);
+        if (slot == nullptr) {
+            // Everything is busy with read ahead we're not going to use,
+            // so just take the first slot back.
+            slot = &uring->reads[0];
+            if (!fkfs_device_uring_wait_slot(uring, slot)) {
+                return false;
+            }
+        }
+        if (!fkfs_device_uring_queue_read(uring, slot, fkfs_device_uring_slot_start(block))) {
+            if (uring->error) {
+                return false;
+            }
+            memset(destiny, 0, SD_RAW_BLOCK_SIZE);
+            return true;
+        }
+    }
+    else if (slot->state == FKFS_DEVICE_URING_SLOT_READY) {
+        uring->statistics.hits++;
+    }
+
+    // Only sequential readers get read ahead.
+    auto sequential = block == uring->lastRead + 1 || block == uring->lastRead;
+    if (sequential) {
+        fkfs_device_uring_read_ahead(uring, block);
+    }
+    uring->lastRead = block;
+
+    if (!fkfs_device_uring_wait_slot(uring, slot)) {
+        return false;
+    }
+
+    if (slot->state != FKFS_DEVICE_URING_SLOT_READY) {
+        return false;
+    }
+
+    memcpy(destiny, slot->buffer + (size_t)(block - slot->block) * SD_RAW_BLOCK_SIZE, SD_RAW_BLOCK_SIZE);
+
+    return !uring->error;
+}
+
+static uint8_t fkfs_device_uring_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    auto uring = (fkfs_device_uring_t *)ctx;
+
+    if (uring->fallback) {
+        return fkfs_device_write_block(&uring->sync, block, source);
+    }
+
+    if (uring->error) {
+        return false;
+    }
+
+    // Keep any read ahead coherent with what's being written.
+    auto reading = fkfs_device_uring_find(uring->reads, uring->depth, block);
+    if (reading != nullptr) {
+        if (!fkfs_device_uring_wait_slot(uring, reading)) {
+            return false;
+        }
+        if (reading->state == FKFS_DEVICE_URING_SLOT_READY) {
+            memcpy(reading->buffer + (size_t)(block - reading->block) * SD_RAW_BLOCK_SIZE, source, SD_RAW_BLOCK_SIZE);
+        }
+    }
+
+    // A write to the same block that hasn't been submitted yet is just
+    // replaced, one that's in flight has to finish first so the two can't
+    // land out of order.
+    auto slot = fkfs_device_uring_find(uring->writes, uring->depth, block);
+    if (slot != nullptr && slot->state == FKFS_DEVICE_URING_SLOT_QUEUED) {
+        memcpy(slot->buffer, source, SD_RAW_BLOCK_SIZE);
+        uring->statistics.coalesced++;
+        return true;
+    }
+    if (slot != nullptr) {
+        if (!fkfs_device_uring_wait_slot(uring, slot)) {
+            return false;
+        }
+    }
+
+    slot = nullptr;
+    for (auto iter = uring->writes; iter < uring->writes + uring->depth; ++iter) {
+        if (iter->state == FKFS_DEVICE_URING_SLOT_FREE) {
+            slot = iter;
+            break;
+        }
+    }
+
+    if (slot == nullptr) {
+        if (!fkfs_device_uring_drain_writes(uring)) {
+            return false;
+        }
+        slot = &uring->writes[0];
+    }
+
+    memcpy(slot->buffer, source, SD_RAW_BLOCK_SIZE);
+    slot->block = block;
+    slot->number = 1;
+    slot->state = FKFS_DEVICE_URING_SLOT_QUEUED;
+
+    uring->statistics.writes++;
+
+    fkfs_device_uring_prepare(uring, IORING_OP_WRITE, FKFS_DEVICE_URING_WRITE_TAG | (slot - uring->writes), block, SD_RAW_BLOCK_SIZE, slot->buffer);
+
+    auto end = (uint64_t)(block + 1) * SD_RAW_BLOCK_SIZE;
+    if (end > uring->fd.length) {
+        uring->fd.length = end;
+    }
+
+    return true;
+}
+
+static uint8_t fkfs_device_uring_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    auto uring = (fkfs_device_uring_t *)ctx;
+
+    if (!uring->fallback) {
+        if (!fkfs_device_uring_drain_writes(uring)) {
+            return false;
+        }
+
+        // Drop any read ahead of the erased range.
+        for (auto slot = uring->reads; slot < uring->reads + uring->depth; ++slot) {
+            if (!fkfs_device_uring_wait_slot(uring, slot)) {
+                return false;
+            }
+            if (slot->block <= lastBlock && slot->block + slot->number > firstBlock) {
+                slot->state = FKFS_DEVICE_URING_SLOT_FREE;
+            }
+        }
+    }
+
+    return fkfs_device_erase(&uring->sync, firstBlock, lastBlock);
+}
+
+static uint32_t fkfs_device_uring_size(void *ctx) {
+    auto uring = (fkfs_device_uring_t *)ctx;
+    return fkfs_device_size(&uring->sync);
+}
+
+static uint8_t fkfs_device_uring_flush(void *ctx) {
+    auto uring = (fkfs_device_uring_t *)ctx;
+
+    if (!uring->fallback) {
+        if (!fkfs_device_uring_drain_writes(uring)) {
+            return false;
+        }
+        if (uring->error) {
+            return false;
+        }
+        return fdatasync(uring->file) == 0;
+    }
+
+    return fkfs_device_flush(&uring->sync);
+}
+
+static const fkfs_device_ops_t fkfs_device_uring_ops = {
+    .read_block = fkfs_device_uring_read_block,
+    .write_block = fkfs_device_uring_write_block,
+    .erase = fkfs_device_uring_erase,
+    .size = fkfs_device_uring_size,
+    .flush = fkfs_device_uring_flush,
+    .read_blocks = nullptr,
+    .write_blocks = nullptr,
+    .read_partial = nullptr,
+    .read_end = nullptr,
+    .write_start = nullptr,
+    .poll = nullptr,
+    .allocation_unit = nullptr,
+};
+
+static uint8_t fkfs_device_uring_setup(fkfs_device_uring_t *uring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // Room for every read and write slot to be queued at once.
+    uring->ring = fkfs_io_uring_setup(uring->depth * 2, &params);
+    if (uring->ring < 0) {
+        return false;
+    }
+
+    uring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    uring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cqRingSize > uring->sqRingSize) {
+            uring->sqRingSize = uring->cqRingSize;
+        }
+        uring->cqRingSize = uring->sqRingSize;
+    }
+
+    uring->sqRing = mmap(nullptr, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring, IORING_OFF_SQ_RING);
+    if (uring->sqRing == MAP_FAILED) {
+        uring->sqRing = nullptr;
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cqRing = uring->sqRing;
+    }
+    else {
+        uring->cqRing = mmap(nullptr, uring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring, IORING_OFF_CQ_RING);
+        if (uring->cqRing == MAP_FAILED) {
+            uring->cqRing = nullptr;
+            return false;
+        }
+    }
+
+    uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(nullptr, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = nullptr;
+        return false;
+    }
+
+    auto sq = (uint8_t *)uring->sqRing;
+    uring->sqHead = (uint32_t *)(sq + params.sq_off.head);
+    uring->sqTail = (uint32_t *)(sq + params.sq_off.tail);
+    uring->sqMask = (uint32_t *)(sq + params.sq_off.ring_mask);
+    uring->sqArray = (uint32_t *)(sq + params.sq_off.array);
+
+    auto cq = (uint8_t *)uring->cqRing;
+    uring->cqHead = (uint32_t *)(cq + params.cq_off.head);
+    uring->cqTail = (uint32_t *)(cq + params.cq_off.tail);
+    uring->cqMask = (uint32_t *)(cq + params.cq_off.ring_mask);
+    uring->cqes = cq + params.cq_off.cqes;
+
+    return true;
+}
+
+static void fkfs_device_uring_teardown(fkfs_device_uring_t *uring) {
+    if (uring->sqes != nullptr) {
+        munmap(uring->sqes, uring->sqesSize);
+        uring->sqes = nullptr;
+    }
+    if (uring->cqRing != nullptr && uring->cqRing != uring->sqRing) {
+        munmap(uring->cqRing, uring->cqRingSize);
+    }
+    uring->cqRing = nullptr;
+    if (uring->sqRing != nullptr) {
+        munmap(uring->sqRing, uring->sqRingSize);
+        uring->sqRing = nullptr;
+    }
+    if (uring->ring >= 0) {
+        close(uring->ring);
+        uring->ring = -1;
+    }
+    if (uring->file >= 0 && uring->file != uring->fd.fd) {
+        close(uring->file);
+    }
+    uring->file = -1;
+    free(uring->memory);
+    uring->memory = nullptr;
+}
+
+uint8_t fkfs_device_uring_open(fkfs_device_t *dev, fkfs_device_uring_t *uring, const char *path, uint32_t numberOfBlocks, uint32_t depth, uint8_t direct) {
+    memset(uring, 0, sizeof(fkfs_device_uring_t));
+
+    uring->ring = -1;
+    uring->file = -1;
+    uring->depth = depth == 0 ? FKFS_DEVICE_URING_DEPTH_DEFAULT : depth;
+    if (uring->depth > FKFS_DEVICE_URING_DEPTH_MAX) {
+        uring->depth = FKFS_DEVICE_URING_DEPTH_MAX;
+    }
+    uring->lastRead = UINT32_MAX - 1;
+
+    // The synchronous device sizes the image and is what we fall back on.
+    if (!fkfs_device_fd_open(&uring->sync, &uring->fd, path, numberOfBlocks)) {
+        return false;
+    }
+
+    dev->ops = &fkfs_device_uring_ops;
+    dev->ctx = uring;
+
+    uring->file = uring->fd.fd;
+#ifdef O_DIRECT
+    if (direct) {
+        auto file = open(path, O_RDWR | O_DIRECT);
+        if (file >= 0) {
+            uring->file = file;
+            uring->direct = true;
+        }
+    }
+#endif
+
+    auto slots = uring->depth * 2;
+    void *memory = nullptr;
+    if (posix_memalign(&memory, FKFS_DEVICE_URING_ALIGNMENT, (size_t)slots * FKFS_DEVICE_URING_SLOT_SIZE) != 0) {
+        fkfs_device_uring_teardown(uring);
+        uring->fallback = true;
+        return true;
+    }
+
+    uring->memory = (uint8_t *)memory;
+    for (uint32_t i = 0; i < uring->depth; ++i) {
+        uring->reads[i].buffer = uring->memory + (size_t)i * FKFS_DEVICE_URING_SLOT_SIZE;
+        uring->writes[i].buffer = uring->memory + (size_t)(uring->depth + i) * FKFS_DEVICE_URING_SLOT_SIZE;
+    }
+
+    if (!fkfs_device_uring_setup(uring)) {
+        fprintf(stderr, "warning: io_uring unavailable, falling back to synchronous I/O\n");
+        fkfs_device_uring_teardown(uring);
+        uring->fallback = true;
+        uring->direct = false;
+    }
+
+    return true;
+}
+
+uint8_t fkfs_device_uring_close(fkfs_device_t *dev) {
+    auto uring = (fkfs_device_uring_t *)dev->ctx;
+    auto success = true;
+
+    if (!uring->fallback) {
+        success = fkfs_device_uring_drain_writes(uring) && !uring->error;
+        for (auto slot = uring->reads; slot < uring->reads + uring->depth; ++slot) {
+            fkfs_device_uring_wait_slot(uring, slot);
+        }
+    }
+
+    fkfs_device_uring_teardown(uring);
+    fkfs_device_fd_close(&uring->sync);
+
+    return success;
+}
+
+void fkfs_device_uring_log_statistics(fkfs_device_t *dev) {
+    auto uring = (fkfs_device_uring_t *)dev->ctx;
+    if (uring->fallback) {
+        fprintf(stderr, "uring: fallback\n");
+        fkfs_device_fd_log_statistics(&uring->sync);
+        return;
+    }
+    fprintf(stderr, "uring: depth=%d direct=%d submits=%d reads=%d writes=%d coalesced=%d hits=%d waits=%d\n",
+            uring->depth, uring->direct, uring->statistics.submits, uring->statistics.reads,
+            uring->statistics.writes, uring->statistics.coalesced, uring->statistics.hits,
+            uring->statistics.waits);
+}
+
+#endif
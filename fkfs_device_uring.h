@@ -0,0 +1,86 @@
+#ifndef FKFS_DEVICE_URING_H_INCLUDED
+#define FKFS_DEVICE_URING_H_INCLUDED
+
+#if !defined(ARDUINO) && defined(__linux__)
+
+#include "fkfs_device.h"
+#include "fkfs_device_host.h"
+
+/**
+ * An image file driven through io_uring. Sequential reads keep up to depth
+ * reads of FKFS_DEVICE_URING_SLOT_BLOCKS blocks in flight ahead of the
+ * reader. Writes are queued and submitted together, either when the next read
+ * comes along, when we run out of write slots or on flush, so the data writes
+ * of an fkfs_fsync go to the kernel in a single call. The kernel may complete
+ * them in any order, flush waits for all of them (fkfs flushes before and
+ * after each header). Writes that fail are reported by the following
+ * operation.
+ *
+ * When io_uring is unavailable the synchronous fd device is used instead and
+ * fallback is set.
+ */
+constexpr uint32_t FKFS_DEVICE_URING_DEPTH_MAX = 64;
+constexpr uint32_t FKFS_DEVICE_URING_SLOT_BLOCKS = 16;
+
+typedef struct fkfs_device_uring_slot_t {
+    uint32_t block;
+    uint32_t number;
+    uint8_t state;
+    uint8_t *buffer;
+} fkfs_device_uring_slot_t;
+
+typedef struct fkfs_device_uring_statistics_t {
+    uint32_t submits;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t coalesced;
+    uint32_t hits;
+    uint32_t waits;
+} fkfs_device_uring_statistics_t;
+
+typedef struct fkfs_device_uring_t {
+    fkfs_device_t sync;
+    fkfs_device_fd_t fd;
+    uint8_t fallback;
+    uint8_t direct;
+    uint8_t error;
+    int file;
+    int ring;
+    uint32_t depth;
+    uint32_t queued;
+    uint32_t inflight;
+    uint32_t lastRead;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    void *sqes;
+    size_t sqesSize;
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t *sqMask;
+    uint32_t *sqArray;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t *cqMask;
+    void *cqes;
+    uint8_t *memory;
+    fkfs_device_uring_slot_t reads[FKFS_DEVICE_URING_DEPTH_MAX];
+    fkfs_device_uring_slot_t writes[FKFS_DEVICE_URING_DEPTH_MAX];
+    fkfs_device_uring_statistics_t statistics;
+} fkfs_device_uring_t;
+
+/**
+ * The numberOfBlocks argument behaves as in fkfs_device_fd_open. A depth of
+ * zero uses the default and direct opens the image with O_DIRECT, when the
+ * file system allows it.
+ */
+uint8_t fkfs_device_uring_open(fkfs_device_t *dev, fkfs_device_uring_t *uring, const char *path, uint32_t numberOfBlocks, uint32_t depth, uint8_t direct);
+
+uint8_t fkfs_device_uring_close(fkfs_device_t *dev);
+
+void fkfs_device_uring_log_statistics(fkfs_device_t *dev);
+
+#endif
+
+#endif
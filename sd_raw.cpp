@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "sd_raw.h"
 #include "sd_raw_internal.h"
 
@@ -14,6 +16,83 @@ uint8_t sd_raw_cs_low(sd_raw_t *sd) {
     return true;
 }
 
+// CRC7 (x^7 + x^3 + 1) used by commands, kept in the top seven bits so the
+// end bit can be or'd in.
+static const uint8_t sd_raw_crc7_table[256] = {
+    0x00, 0x12, 0x24, 0x36, 0x48, 0x5a, 0x6c, 0x7e, 0x90, 0x82, 0xb4, 0xa6, 0xd8, 0xca, 0xfc, 0xee,
+    0x32, 0x20, 0x16, 0x04, 0x7a, 0x68, 0x5e, 0x4c, 0xa2, 0xb0, 0x86, 0x94, 0xea, 0xf8, 0xce, 0xdc,
+    0x64, 0x76, 0x40, 0x52, 0x2c, 0x3e, 0x08, 0x1a, 0xf4, 0xe6, 0xd0, 0xc2, 0xbc, 0xae, 0x98, 0x8a,
+    0x56, 0x44, 0x72, 0x60, 0x1e, 0x0c, 0x3a, 0x28, 0xc6, 0xd4, 0xe2, 0xf0, 0x8e, 0x9c, 0xaa, 0xb8,
+    0xc8, 0xda, 0xec, 0xfe, 0x80, 0x92, 0xa4, 0xb6, 0x58, 0x4a, 0x7c, 0x6e, 0x10, 0x02, 0x34, 0x26,
+    0xfa, 0xe8, 0xde, 0xcc, 0xb2, 0xa0, 0x96, 0x84, 0x6a, 0x78, 0x4e, 0x5c, 0x22, 0x30, 0x06, 0x14,
+    0xac, 0xbe, 0x88, 0x9a, 0xe4, 0xf6, 0xc0, 0xd2, 0x3c, 0x2e, 0x18, 0x0a, 0x74, 0x66, 0x50, 0x42,
+    0x9e, 0x8c, 0xba, 0xa8, 0xd6, 0xc4, 0xf2, 0xe0, 0x0e, 0x1c, 0x2a, 0x38, 0x46, 0x54, 0x62, 0x70,
+    0x82, 0x90, 0xa6, 0xb4, 0xca, 0xd8, 0xee, 0xfc, 0x12, 0x00, 0x36, 0x24, 0x5a, 0x48, 0x7e, 0x6c,
+    0xb0, 0xa2, 0x94, 0x86, 0xf8, 0xea, 0xdc, 0xce, 0x20, 0x32, 0x04, 0x16, 0x68, 0x7a, 0x4c, 0x5e,
+    0xe6, 0xf4, 0xc2, 0xd0, 0xae, 0xbc, 0x8a, 0x98, 0x76, 0x64, 0x52, 0x40, 0x3e, 0x2c, 0x1a, 0x08,
+    0xd4, 0xc6, 0xf0, 0xe2, 0x9c, 0x8e, 0xb8, 0xaa, 0x44, 0x56, 0x60, 0x72, 0x0c, 0x1e, 0x28, 0x3a,
+    0x4a, 0x58, 0x6e, 0x7c, 0x02, 0x10, 0x26, 0x34, 0xda, 0xc8, 0xfe, 0xec, 0x92, 0x80, 0xb6, 0xa4,
+    0x78, 0x6a, 0x5c, 0x4e, 0x30, 0x22, 0x14, 0x06, 0xe8, 0xfa, 0xcc, 0xde, 0xa0, 0xb2, 0x84, 0x96,
+    0x2e, 0x3c, 0x0a, 0x18, 0x66, 0x74, 0x42, 0x50, 0xbe, 0xac, 0x9a, 0x88, 0xf6, 0xe4, 0xd2, 0xc0,
+    0x1c, 0x0e, 0x38, 0x2a, 0x54, 0x46, 0x70, 0x62, 0x8c, 0x9e, 0xa8, 0xba, 0xc4, 0xd6, 0xe0, 0xf2,
+};
+
+// CRC16-CCITT (x^16 + x^12 + x^5 + 1) used by data blocks and registers.
+static const uint16_t sd_raw_crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+uint32_t const SD_RAW_AU_BLOCKS[16] = {
+    0, 32, 64, 128, 256, 512, 1024, 2048,
+    4096, 8192, 16384, 24576, 32768, 49152, 65536, 131072,
+};
+
+uint8_t sd_raw_crc7(const uint8_t *data, uint16_t size) {
+    uint8_t crc = 0;
+    for (uint16_t i = 0; i < size; ++i) {
+        crc = sd_raw_crc7_table[crc ^ data[i]];
+    }
+    return crc | 0x01;
+}
+
+uint16_t sd_raw_crc16(uint16_t crc, const uint8_t *data, uint16_t size) {
+    for (uint16_t i = 0; i < size; ++i) {
+        crc = (crc << 8) ^ sd_raw_crc16_table[((crc >> 8) ^ data[i]) & 0xff];
+    }
+    return crc;
+}
+
 static uint8_t sd_raw_spi_read() {
     return SPI.transfer(0xff);
 }
@@ -22,11 +101,73 @@ static uint8_t sd_raw_spi_write(uint8_t value) {
     return SPI.transfer(value);
 }
 
+// Block payloads go through the buffer transfer, which the SPI drivers do
+// without a call and a status poll per byte. The buffer is sent and then
+// overwritten with what comes back, so reads clock out 0xff.
+static void sd_raw_spi_receive(uint8_t *destiny, uint16_t size) {
+    memset(destiny, 0xff, size);
+    SPI.transfer(destiny, size);
+}
+
+static void sd_raw_spi_send(const uint8_t *source, uint16_t size) {
+    uint8_t buffer[SD_RAW_SPI_CHUNK];
+
+    while (size > 0) {
+        uint16_t n = size > sizeof(buffer) ? sizeof(buffer) : size;
+        memcpy(buffer, source, n);
+        SPI.transfer(buffer, n);
+        source += n;
+        size -= n;
+    }
+}
+
+static void sd_raw_spi_skip(uint16_t size) {
+    uint8_t buffer[SD_RAW_SPI_CHUNK];
+
+    while (size > 0) {
+        uint16_t n = size > sizeof(buffer) ? sizeof(buffer) : size;
+        sd_raw_spi_receive(buffer, n);
+        size -= n;
+    }
+}
+
+// Data of the open block, the CRC is kept up to date as we go when CRCs are
+// on, so skipped bytes have to be looked at as well.
+static void sd_raw_block_receive(sd_raw_t *sd, uint8_t *destiny, uint16_t size) {
+    sd_raw_spi_receive(destiny, size);
+    if (sd->crc) {
+        sd->readCrc = sd_raw_crc16(sd->readCrc, destiny, size);
+    }
+}
+
+static void sd_raw_block_skip(sd_raw_t *sd, uint16_t size) {
+    uint8_t buffer[SD_RAW_SPI_CHUNK];
+
+    if (!sd->crc) {
+        sd_raw_spi_skip(size);
+        return;
+    }
+
+    while (size > 0) {
+        uint16_t n = size > sizeof(buffer) ? sizeof(buffer) : size;
+        sd_raw_block_receive(sd, buffer, n);
+        size -= n;
+    }
+}
+
+// Reads the CRC that follows a block and checks it against ours.
+static uint8_t sd_raw_block_crc(sd_raw_t *sd) {
+    uint16_t crc = sd_raw_spi_read() << 8;
+    crc |= sd_raw_spi_read();
+    return !sd->crc || crc == sd->readCrc;
+}
+
 uint8_t sd_raw_flush(sd_raw_t *sd, uint16_t timeoutMs) {
     uint32_t t0 = millis();
 
     do {
         if (sd_raw_spi_read() == 0xff) {
+            sd->ready = true;
             return true;
         }
     }
@@ -35,40 +176,85 @@ uint8_t sd_raw_flush(sd_raw_t *sd, uint16_t timeoutMs) {
     return false;
 }
 
-static uint8_t sd_raw_read_end(sd_raw_t *sd) {
+uint8_t sd_raw_read_end(sd_raw_t *sd) {
     if (sd->inBlock) {
-        while (sd->offset++ < SD_RAW_BLOCK_SIZE + 2) { // I think this is block size + crc bytes.
-            sd_raw_spi_read();
+        // Rest of the block and the two CRC bytes.
+        sd_raw_block_skip(sd, SD_RAW_BLOCK_SIZE - sd->offset);
+        sd->inBlock = false;
+
+        if (!sd_raw_block_crc(sd)) {
+            return sd_raw_error(sd, SD_CARD_ERROR_READ_CRC);
         }
 
+        sd->ready = true;
         sd_raw_cs_high(sd);
-        sd->inBlock = false;
     }
     return true;
 }
 
+// Commands answered with an R1 and nothing more, the card's idle afterwards.
+static uint8_t sd_raw_command_idles(uint8_t command) {
+    switch (command) {
+    case CMD32:
+    case CMD33:
+    case CMD55:
+    case CMD59:
+    case ACMD23:
+    case ACMD41:
+        return true;
+    default:
+        return false;
+    }
+}
+
 uint8_t sd_raw_command(sd_raw_t *sd, uint8_t command, uint32_t arg) {
+    // Let a write that's still programming finish, any failure is left for
+    // whoever's polling it.
+    if (sd->writeStatus == SD_RAW_WRITE_BUSY) {
+        sd_raw_write_wait(sd);
+    }
+
     sd_raw_read_end(sd);
     sd_raw_cs_low(sd);
-    sd_raw_flush(sd, 300);
 
-    sd_raw_spi_write(command | 0x40);
+    // CMD12 interrupts a transfer that's underway, so the card won't be idle.
+    // A card we know is idle only needs the byte between commands (NRC).
+    if (sd->ready) {
+        sd_raw_spi_read();
+    }
+    else if (command != CMD12) {
+        sd_raw_flush(sd, 300);
+    }
+    sd->ready = false;
+
+    // Cards always check the CRC of CMD0 and CMD8, the rest only once CRCs
+    // are turned on. It's cheap enough to always send.
+    uint8_t frame[6] = {
+        (uint8_t)(command | 0x40),
+        (uint8_t)(arg >> 24),
+        (uint8_t)(arg >> 16),
+        (uint8_t)(arg >> 8),
+        (uint8_t)arg,
+        0,
+    };
+    frame[5] = sd_raw_crc7(frame, 5);
 
-    for (int8_t s = 24; s >= 0; s -= 8) {
-        sd_raw_spi_write(arg >> s);
+    for (uint8_t i = 0; i < sizeof(frame); ++i) {
+        sd_raw_spi_write(frame[i]);
     }
 
-    uint8_t crc = 0xff;
-    if (command == CMD0) crc = 0x95;  // Correct crc for CMD0 with arg 0
-    if (command == CMD8) crc = 0x87;  // Correct crc for CMD8 with arg 0x1AA
-    sd_raw_spi_write(crc);
+    // Skip the stuff byte that follows CMD12.
+    if (command == CMD12) {
+        sd_raw_spi_read();
+    }
 
     for (uint8_t i = 0; ((sd->status = sd_raw_spi_read()) & 0x80) && i != 0xff; i++) {
     }
+    sd->ready = !(sd->status & 0x80) && sd_raw_command_idles(command);
     return sd->status;
 }
 
-static uint8_t sd_raw_acommand(sd_raw_t *sd, uint8_t command, uint32_t arg) {
+uint8_t sd_raw_acommand(sd_raw_t *sd, uint8_t command, uint32_t arg) {
     sd_raw_command(sd, CMD55, 0);
     return sd_raw_command(sd, command, arg);
 }
@@ -95,6 +281,14 @@ static uint8_t sd_raw_spi_configure() {
 
 uint8_t sd_raw_initialize(sd_raw_t *sd, uint8_t pinCs) {
     sd->cs = pinCs;
+    sd->inBlock = false;
+    sd->crc = false;
+    sd->writeStatus = SD_RAW_WRITE_READY;
+    sd->ready = false;
+    sd->statusWrites = 0;
+    sd->numberOfBlocks = 0;
+    sd->auBlocks = 0;
+    sd->speedClass = 0;
 
     pinMode(sd->cs, OUTPUT);
     sd_raw_cs_high(sd);
@@ -155,6 +349,21 @@ uint8_t sd_raw_initialize(sd_raw_t *sd, uint8_t pinCs) {
 
     sd_raw_cs_high(sd);
 
+    // Older cards may not have an SD status, that's fine.
+    sd_raw_read_geometry(sd);
+    sd->status = 0;
+
+    return true;
+}
+
+uint8_t sd_raw_set_crc(sd_raw_t *sd, uint8_t enabled) {
+    if (sd_raw_command(sd, CMD59, enabled ? 1 : 0)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_CMD59);
+    }
+
+    sd->crc = enabled;
+
+    sd_raw_cs_high(sd);
     return true;
 }
 
@@ -185,12 +394,12 @@ static uint8_t sd_raw_read_register(sd_raw_t *sd, uint8_t command, void *buffer)
         return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
     }
 
-    for (uint16_t i = 0; i < 16; i++) {
-        destiny[i] = sd_raw_spi_read();
-    }
+    sd_raw_spi_receive(destiny, 16);
 
-    sd_raw_spi_read(); // CRC byte
-    sd_raw_spi_read(); // CRC byte
+    sd->readCrc = sd_raw_crc16(0, destiny, 16);
+    if (!sd_raw_block_crc(sd)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_READ_CRC);
+    }
 
     sd_raw_cs_high(sd);
 
@@ -201,9 +410,49 @@ static uint8_t sd_raw_read_csd(sd_raw_t *sd, csd_t* csd) {
     return sd_raw_read_register(sd, CMD9, csd);
 }
 
-static uint8_t sd_raw_read_data(sd_raw_t *sd, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
-    const uint8_t partialBlockRead = false;
+uint8_t sd_raw_read_geometry(sd_raw_t *sd) {
+    uint8_t status[SD_RAW_STATUS_SIZE];
 
+    sd->numberOfBlocks = 0;
+    sd->numberOfBlocks = sd_raw_card_size(sd);
+    if (sd->numberOfBlocks == 0) {
+        return false;
+    }
+
+    // Response is r2, the second byte is the rest of the card status.
+    if (sd_raw_acommand(sd, ACMD13, 0) || sd_raw_spi_read()) {
+        return sd_raw_error(sd, SD_CARD_ERROR_ACMD13);
+    }
+
+    if (!sd_wait_start_block(sd)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_ACMD13);
+    }
+
+    sd_raw_spi_receive(status, sizeof(status));
+
+    sd->readCrc = sd_raw_crc16(0, status, sizeof(status));
+    if (!sd_raw_block_crc(sd)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_READ_CRC);
+    }
+
+    sd_raw_cs_high(sd);
+
+    sd->speedClass = status[8];
+    sd->auBlocks = SD_RAW_AU_BLOCKS[status[10] >> 4];
+
+    return true;
+}
+
+// Reads of blocks whose writes haven't been checked yet check them first, so
+// a failed write is reported as that rather than as bad data.
+uint8_t sd_raw_read_check(sd_raw_t *sd, uint32_t block, uint32_t number) {
+    if (sd->statusWrites == 0 || block > sd->statusLast || block + number <= sd->statusFirst) {
+        return true;
+    }
+    return sd_raw_write_check(sd);
+}
+
+static uint8_t sd_raw_read_data(sd_raw_t *sd, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny, uint8_t partialBlockRead) {
     if (size == 0) {
         return true;
     }
@@ -213,6 +462,15 @@ static uint8_t sd_raw_read_data(sd_raw_t *sd, uint32_t block, uint16_t offset, u
     }
 
     if (!sd->inBlock || block != sd->block || offset < sd->offset) {
+        // Finish any other block here, so its CRC is checked.
+        if (!sd_raw_read_end(sd)) {
+            return false;
+        }
+
+        if (!sd_raw_read_check(sd, block, 1)) {
+            return false;
+        }
+
         sd->block = block;
 
         if (sd->type != SD_CARD_TYPE_SDHC) {
@@ -228,55 +486,85 @@ static uint8_t sd_raw_read_data(sd_raw_t *sd, uint32_t block, uint16_t offset, u
         }
 
         sd->offset = 0;
+        sd->readCrc = 0;
         sd->inBlock = true;
     }
 
     // Skip data before offset
-    for (; sd->offset < offset; sd->offset++) {
-        sd_raw_spi_read();
-    }
-    for (uint16_t i = 0; i < size; i++) {
-        destiny[i] = sd_raw_spi_read();
-    }
+    sd_raw_block_skip(sd, offset - sd->offset);
+    sd_raw_block_receive(sd, destiny, size);
 
-    sd->offset += size;
+    sd->offset = offset + size;
     if (!partialBlockRead || sd->offset >= SD_RAW_BLOCK_SIZE) {
-        sd_raw_read_end(sd);
+        return sd_raw_read_end(sd);
     }
     return true;
 }
 
 uint8_t sd_raw_read_block(sd_raw_t *sd, uint32_t block, uint8_t *destiny) {
-    return sd_raw_read_data(sd, block, 0, SD_RAW_BLOCK_SIZE, destiny);
+    return sd_raw_read_data(sd, block, 0, SD_RAW_BLOCK_SIZE, destiny, false);
 }
 
-static uint8_t sd_raw_write_data(sd_raw_t *sd, uint8_t token, const uint8_t *source) {
-    // CRC16 checksum is supposed to be ignored in SPI mode (unless
-    // explicitly enabled) and a dummy value is normally written.
-    // A few funny cards (e.g. Eye-Fi X2) expect a valid CRC anyway.
-    // Call setCRC(true) to enable CRC16 checksum on block writes.
-    // This has a noticeable impact on write speed. :(
-    // NOTE: We just aren't going to support these cards. -jlewallen
-    int16_t crc = 0xffff; // Dummy value
-
-    #ifdef SD_RAW_CRC_SUPPORT
-    if (sd->writeCrc) {
-        int16_t i, x;
-        // CRC16 code via Scott Dattalo www.dattalo.com
-        for (crc = i = 0; i < SD_RAW_BLOCK_SIZE; i++) {
-            x   = ((crc >> 8) ^ source[i]) & 0xff;
-            x  ^= x >> 4;
-            crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
+uint8_t sd_raw_read_partial(sd_raw_t *sd, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    return sd_raw_read_data(sd, block, offset, size, destiny, true);
+}
+
+uint8_t sd_raw_read_blocks(sd_raw_t *sd, uint32_t block, uint32_t number, uint8_t *destiny) {
+    if (number == 0) {
+        return true;
+    }
+
+    if (!sd_raw_read_check(sd, block, number)) {
+        return false;
+    }
+
+    if (sd->type != SD_CARD_TYPE_SDHC) {
+        block <<= 9;
+    }
+
+    if (sd_raw_command(sd, CMD18, block)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_CMD18);
+    }
+
+    for (uint32_t i = 0; i < number; ++i) {
+        if (!sd_wait_start_block(sd)) {
+            return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
+        }
+
+        sd->readCrc = 0;
+        sd_raw_block_receive(sd, destiny + i * SD_RAW_BLOCK_SIZE, SD_RAW_BLOCK_SIZE);
+
+        if (!sd_raw_block_crc(sd)) {
+            // Stop the card sending the rest.
+            sd_raw_command(sd, CMD12, 0);
+            sd_raw_flush(sd, SD_RAW_READ_TIMEOUT);
+            return sd_raw_error(sd, SD_CARD_ERROR_READ_CRC);
         }
     }
-    #endif // SD_RAW_CRC_SUPPORT
 
-    sd_raw_spi_write(token);
+    if (sd_raw_command(sd, CMD12, 0)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_CMD12);
+    }
 
-    for (uint16_t i = 0; i < SD_RAW_BLOCK_SIZE; i++) {
-        sd_raw_spi_write(source[i]);
+    if (!sd_raw_flush(sd, SD_RAW_READ_TIMEOUT)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_READ_TIMEOUT);
     }
 
+    sd_raw_cs_high(sd);
+    return true;
+}
+
+static uint8_t sd_raw_write_data(sd_raw_t *sd, uint8_t token, const uint8_t *source) {
+    // CRC16 is ignored in SPI mode unless it's been turned on with
+    // sd_raw_set_crc, otherwise a dummy value is written.
+    uint16_t crc = sd->crc ? sd_raw_crc16(0, source, SD_RAW_BLOCK_SIZE) : 0xffff;
+
+    sd->ready = false;
+
+    sd_raw_spi_write(token);
+
+    sd_raw_spi_send(source, SD_RAW_BLOCK_SIZE);
+
     sd_raw_spi_write(crc >> 8);
     sd_raw_spi_write(crc);
 
@@ -289,42 +577,185 @@ static uint8_t sd_raw_write_data(sd_raw_t *sd, uint8_t token, const uint8_t *sou
     return true;
 }
 
-uint8_t sd_raw_write_block(sd_raw_t *sd, uint32_t block, const uint8_t *source) {
+uint8_t sd_raw_write_poll(sd_raw_t *sd) {
+    if (sd->writeStatus != SD_RAW_WRITE_BUSY) {
+        return sd->writeStatus;
+    }
+
+    // The card holds the line low while it's programming.
+    sd_raw_cs_low(sd);
+    if (sd_raw_spi_read() != 0xff) {
+        sd_raw_cs_high(sd);
+        if (((uint32_t)millis() - sd->writeStarted) >= SD_RAW_WRITE_TIMEOUT) {
+            sd->writeStatus = SD_RAW_WRITE_FAILED;
+            sd_raw_error(sd, SD_CARD_ERROR_WRITE_TIMEOUT);
+            return SD_RAW_WRITE_FAILED;
+        }
+        return SD_RAW_WRITE_BUSY;
+    }
+
+    sd->writeStatus = SD_RAW_WRITE_READY;
+    sd->ready = true;
+
+    if (++sd->statusWrites < sd->statusInterval) {
+        sd_raw_cs_high(sd);
+        return SD_RAW_WRITE_READY;
+    }
+
+    if (!sd_raw_write_check(sd)) {
+        sd->writeStatus = SD_RAW_WRITE_FAILED;
+        return SD_RAW_WRITE_FAILED;
+    }
+
+    return SD_RAW_WRITE_READY;
+}
+
+uint8_t sd_raw_write_check(sd_raw_t *sd) {
+    if (sd->statusWrites == 0) {
+        return true;
+    }
+
+    sd->statusWrites = 0;
+
+    // Response is r2 so get and check two bytes for nonzero
+    if (sd_raw_command(sd, CMD13, 0) || sd_raw_spi_read()) {
+        return sd_raw_error(sd, SD_CARD_ERROR_WRITE_PROGRAMMING);
+    }
+
+    sd->ready = true;
+    sd_raw_cs_high(sd);
+    return true;
+}
+
+uint8_t sd_raw_write_wait(sd_raw_t *sd) {
+    uint8_t status;
+    while ((status = sd_raw_write_poll(sd)) == SD_RAW_WRITE_BUSY) {
+    }
+    return status;
+}
+
+uint8_t sd_raw_write_started(sd_raw_t *sd, uint32_t block, uint32_t number) {
+    // Blocks the next status check is about.
+    if (sd->statusWrites == 0) {
+        sd->statusFirst = block;
+        sd->statusLast = block + number - 1;
+    }
+    else {
+        sd->statusFirst = block < sd->statusFirst ? block : sd->statusFirst;
+        sd->statusLast = block + number - 1 > sd->statusLast ? block + number - 1 : sd->statusLast;
+    }
+
+    sd->writeStatus = SD_RAW_WRITE_BUSY;
+    sd->writeStarted = millis();
+    sd->ready = false;
+    sd_raw_cs_high(sd);
+    return true;
+}
+
+uint8_t sd_raw_write_abort(sd_raw_t *sd, uint8_t multiple, uint32_t error) {
+    sd_raw_cs_low(sd);
+
+    // The card takes the stop token once it's done with the last block.
+    if (multiple) {
+        sd_raw_flush(sd, SD_RAW_WRITE_TIMEOUT);
+        sd_raw_spi_write(STOP_TRAN_TOKEN);
+    }
+
+    sd_raw_flush(sd, SD_RAW_WRITE_TIMEOUT);
+
+    return sd_raw_error(sd, error);
+}
+
+uint8_t sd_raw_write_block_start(sd_raw_t *sd, uint32_t block, const uint8_t *source) {
     #if SD_PROTECT_BLOCK_ZERO
     if (block == 0) {
         return sd_raw_error(sd, SD_CARD_ERROR_WRITE_BLOCK_ZERO);
     }
     #endif // SD_PROTECT_BLOCK_ZERO
 
-    if (sd->type != SD_CARD_TYPE_SDHC) {
-        block <<= 9;
-    }
+    uint32_t address = sd->type == SD_CARD_TYPE_SDHC ? block : block << 9;
 
-    if (sd_raw_command(sd, CMD24, block)) {
+    if (sd_raw_command(sd, CMD24, address)) {
         return sd_raw_error(sd, SD_CARD_ERROR_CMD24);
     }
 
+    // Keeps the status of the data response, a CRC error for one.
     if (!sd_raw_write_data(sd, DATA_START_BLOCK, source)) {
-        return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
+        return sd_raw_write_abort(sd, false, sd->status);
+    }
+
+    // Flash programming completes in the background.
+    return sd_raw_write_started(sd, block, 1);
+}
+
+uint8_t sd_raw_write_block(sd_raw_t *sd, uint32_t block, const uint8_t *source) {
+    if (!sd_raw_write_block_start(sd, block, source)) {
+        return false;
+    }
+
+    return sd_raw_write_wait(sd) == SD_RAW_WRITE_READY;
+}
+
+uint8_t sd_raw_write_blocks_start(sd_raw_t *sd, uint32_t block, uint32_t number, const uint8_t *source) {
+    #if SD_PROTECT_BLOCK_ZERO
+    if (block == 0) {
+        return sd_raw_error(sd, SD_CARD_ERROR_WRITE_BLOCK_ZERO);
+    }
+    #endif // SD_PROTECT_BLOCK_ZERO
+
+    if (number == 0) {
+        return true;
+    }
+
+    uint32_t address = sd->type == SD_CARD_TYPE_SDHC ? block : block << 9;
+
+    // Lets the card erase the whole run up front rather than as it goes.
+    if (number > 1 && sd_raw_acommand(sd, ACMD23, number)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_ACMD23);
+    }
+
+    if (sd_raw_command(sd, CMD25, address)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_CMD25);
+    }
+
+    // Once the burst's begun a failure has to stop it, or the card's left
+    // waiting for more data.
+    for (uint32_t i = 0; i < number; ++i) {
+        // Card may still be busy programming the previous block.
+        if (!sd_raw_flush(sd, SD_RAW_WRITE_TIMEOUT)) {
+            return sd_raw_write_abort(sd, true, SD_CARD_ERROR_WRITE_TIMEOUT);
+        }
+
+        if (!sd_raw_write_data(sd, WRITE_MULTIPLE_TOKEN, source + i * SD_RAW_BLOCK_SIZE)) {
+            return sd_raw_write_abort(sd, true, SD_CARD_ERROR_WRITE_MULTIPLE);
+        }
     }
 
-    // Wait for flash programming to complete
     if (!sd_raw_flush(sd, SD_RAW_WRITE_TIMEOUT)) {
-        return sd_raw_error(sd, SD_CARD_ERROR_WRITE_TIMEOUT);
+        return sd_raw_write_abort(sd, true, SD_CARD_ERROR_WRITE_TIMEOUT);
     }
 
-    // Response is r2 so get and check two bytes for nonzero
-    if (sd_raw_command(sd, CMD13, 0) || sd_raw_spi_read()) {
-        return sd_raw_error(sd, SD_CARD_ERROR_WRITE_PROGRAMMING);
+    sd_raw_spi_write(STOP_TRAN_TOKEN);
+
+    // Programming of the last block completes in the background.
+    return sd_raw_write_started(sd, block, number);
+}
+
+uint8_t sd_raw_write_blocks(sd_raw_t *sd, uint32_t block, uint32_t number, const uint8_t *source) {
+    if (!sd_raw_write_blocks_start(sd, block, number, source)) {
+        return false;
     }
 
-    sd_raw_cs_high(sd);
-    return true;
+    return sd_raw_write_wait(sd) == SD_RAW_WRITE_READY;
 }
 
 uint32_t sd_raw_card_size(sd_raw_t *sd) {
     csd_t csd;
 
+    if (sd->numberOfBlocks > 0) {
+        return sd->numberOfBlocks;
+    }
+
     if (!sd_raw_read_csd(sd, &csd)) {
         return 0;
     }
@@ -9,17 +9,64 @@ typedef struct sd_raw_t {
     uint8_t type;
     uint16_t offset;
     uint8_t inBlock;
+    uint8_t crc;
+    uint16_t readCrc;
     uint32_t block;
+    uint8_t writeStatus;
+    uint32_t writeStarted;
+    // Set when the card is known to be idle, so the next command needn't wait.
+    uint8_t ready;
+    // The card's status (CMD13) is checked after every statusInterval writes,
+    // zero or one checks each one. Blocks written since the last check are
+    // statusFirst to statusLast, a SD_CARD_ERROR_WRITE_PROGRAMMING is about
+    // one of them.
+    uint16_t statusInterval;
+    uint16_t statusWrites;
+    uint32_t statusFirst;
+    uint32_t statusLast;
+    // Geometry, read once the card's initialized. auBlocks is zero if the card
+    // wouldn't tell us.
+    uint32_t numberOfBlocks;
+    uint32_t auBlocks;
+    uint8_t speedClass;
 } sd_raw_t;
 
 uint8_t sd_raw_initialize(sd_raw_t *sd, uint8_t pinCs);
 uint8_t sd_raw_read_block(sd_raw_t *sd, uint32_t block, uint8_t *destiny);
+uint8_t sd_raw_read_blocks(sd_raw_t *sd, uint32_t block, uint32_t number, uint8_t *destiny);
+// Leaves the block open so later reads further along it continue the same
+// transfer, sd_raw_read_end (or any other command) finishes it.
+uint8_t sd_raw_read_partial(sd_raw_t *sd, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny);
+uint8_t sd_raw_read_end(sd_raw_t *sd);
 uint8_t sd_raw_write_block(sd_raw_t *sd, uint32_t block, const uint8_t *source);
+uint8_t sd_raw_write_blocks(sd_raw_t *sd, uint32_t block, uint32_t number, const uint8_t *source);
+// Send the data and return while the card is still programming, the write
+// is finished once sd_raw_write_poll stops returning SD_RAW_WRITE_BUSY. Any
+// other command waits for the card to finish first.
+uint8_t sd_raw_write_block_start(sd_raw_t *sd, uint32_t block, const uint8_t *source);
+uint8_t sd_raw_write_blocks_start(sd_raw_t *sd, uint32_t block, uint32_t number, const uint8_t *source);
+uint8_t sd_raw_write_poll(sd_raw_t *sd);
+uint8_t sd_raw_write_wait(sd_raw_t *sd);
+// Checks the card's status now for any writes that haven't been, reads of
+// those blocks do this first.
+uint8_t sd_raw_write_check(sd_raw_t *sd);
+// Turns CRC checking of commands and data on (CMD59), reads that fail the
+// check return SD_CARD_ERROR_READ_CRC and the card rejects bad writes.
+uint8_t sd_raw_set_crc(sd_raw_t *sd, uint8_t enabled);
 uint32_t sd_raw_card_size(sd_raw_t *sd);
+// Reads the card size (CSD) and the allocation unit size and speed class (SD
+// status) into the sd_raw_t, sd_raw_initialize does this for us.
+uint8_t sd_raw_read_geometry(sd_raw_t *sd);
 uint8_t sd_raw_erase(sd_raw_t *sd, uint32_t firstBlock, uint32_t lastBlock);
 
 const uint16_t SD_RAW_BLOCK_SIZE = 512;
 
+// Status of the last write, from sd_raw_write_poll. A failure sticks until the
+// next write is started.
+uint8_t const SD_RAW_WRITE_READY = 0;
+uint8_t const SD_RAW_WRITE_BUSY = 1;
+uint8_t const SD_RAW_WRITE_FAILED = 2;
+
 // CMD0 took too long.
 uint8_t const SD_CARD_ERROR_CMD0 = 0X1;
 // CMD8 was not accepted - not a valid SD card
@@ -66,6 +113,16 @@ uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X15;
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X16;
 // A general error.
 uint8_t const SD_CARD_ERROR_GENERAL = 0X17;
+// Card returned an error response for CMD18 (read multiple blocks)
+uint8_t const SD_CARD_ERROR_CMD18 = 0X18;
+// Card returned an error response for CMD12 (stop transmission)
+uint8_t const SD_CARD_ERROR_CMD12 = 0X19;
+// Card returned an error response for CMD59 (CRC on/off)
+uint8_t const SD_CARD_ERROR_CMD59 = 0X1A;
+// Data read from the card failed its CRC check
+uint8_t const SD_CARD_ERROR_READ_CRC = 0X1B;
+// Card returned an error response for ACMD13 (SD status)
+uint8_t const SD_CARD_ERROR_ACMD13 = 0X1C;
 
 // Standard capacity V1 SD card
 uint8_t const SD_CARD_TYPE_SD1 = 1;
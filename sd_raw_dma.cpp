@@ -1,5 +1,7 @@
 #ifdef ARDUINO
 
+#include <stddef.h>
+
 #include "sd_raw_dma.h"
 #include "sd_raw_internal.h"
 #undef min
@@ -12,12 +14,30 @@
 extern uint8_t sd_raw_cs_high(sd_raw_t *sd);
 extern uint8_t sd_raw_cs_low(sd_raw_t *sd);
 
-static void dma_rx_callback(struct dma_resource *const resource) {
+// Completion is signalled from the DMA interrupt, the callbacks only get the
+// resource so we find our way back from there.
+static sd_raw_dma_t *sd_raw_dma_from(struct dma_resource *const resource, size_t offset) {
+    return (sd_raw_dma_t *)((uint8_t *)resource - offset);
+}
 
+static void dma_rx_callback(struct dma_resource *const resource) {
+    sd_raw_dma_from(resource, offsetof(sd_raw_dma_t, rx_resource))->rxDone = true;
 }
 
 static void dma_tx_callback(struct dma_resource *const resource) {
+    sd_raw_dma_from(resource, offsetof(sd_raw_dma_t, tx_resource))->txDone = true;
+}
 
+static void dma_rx_error_callback(struct dma_resource *const resource) {
+    auto sd_dma = sd_raw_dma_from(resource, offsetof(sd_raw_dma_t, rx_resource));
+    sd_dma->failed = true;
+    sd_dma->rxDone = true;
+}
+
+static void dma_tx_error_callback(struct dma_resource *const resource) {
+    auto sd_dma = sd_raw_dma_from(resource, offsetof(sd_raw_dma_t, tx_resource));
+    sd_dma->failed = true;
+    sd_dma->txDone = true;
 }
 
 static status_code setup_transfer_descriptor(DmacDescriptor *descriptor, void *source_memory, void *destination_memory,
@@ -52,107 +72,280 @@ static status_code setup_transfer_descriptor(DmacDescriptor *descriptor, void *s
     return STATUS_OK;
 }
 
-uint8_t sd_raw_dma_initialize(sd_raw_dma_t *sd_dma, sd_raw_t *sd, uint8_t *source_memory, uint8_t *destination_memory, size_t length) {
+static uint8_t sd_raw_dma_allocate(dma_resource *resource, DmacDescriptor *descriptor, uint8_t trigger, dma_callback_t done, dma_callback_t error) {
     dma_resource_config _config;
 
-    sd_dma->sd = sd;
-
     dma_get_config_defaults(&_config);
 
-    _config.peripheral_trigger = SERCOM4_DMAC_ID_TX;
+    _config.peripheral_trigger = trigger;
     _config.trigger_action = DMA_TRIGGER_ACTION_BEAT;
 
-    if (dma_allocate(&sd_dma->tx_resource, &_config) != STATUS_OK) {
-        return false;
-    }
-    if (setup_transfer_descriptor(&sd_dma->tx_descriptor, source_memory, (void *)(&SERCOM4->SPI.DATA.reg), length, DMA_BEAT_SIZE_BYTE, true, false) != STATUS_OK) {
+    if (dma_allocate(resource, &_config) != STATUS_OK) {
         return false;
     }
-    if (dma_add_descriptor(&sd_dma->tx_resource, &sd_dma->tx_descriptor) != STATUS_OK) {
+
+    // Descriptors are filled in for each transfer, see sd_raw_dma_send.
+    dma_descriptor_config descriptor_config;
+    dma_descriptor_get_config_defaults(&descriptor_config);
+    dma_descriptor_create(descriptor, &descriptor_config);
+
+    if (dma_add_descriptor(resource, descriptor) != STATUS_OK) {
         return false;
     }
 
-    dma_register_callback(&sd_dma->tx_resource, dma_tx_callback, DMA_CALLBACK_TRANSFER_DONE);
-    dma_enable_callback(&sd_dma->tx_resource, DMA_CALLBACK_TRANSFER_DONE);
+    dma_register_callback(resource, done, DMA_CALLBACK_TRANSFER_DONE);
+    dma_enable_callback(resource, DMA_CALLBACK_TRANSFER_DONE);
+    dma_register_callback(resource, error, DMA_CALLBACK_TRANSFER_ERROR);
+    dma_enable_callback(resource, DMA_CALLBACK_TRANSFER_ERROR);
 
-    dma_get_config_defaults(&_config);
+    return true;
+}
 
-    _config.peripheral_trigger = SERCOM4_DMAC_ID_RX;
-    _config.trigger_action = DMA_TRIGGER_ACTION_BEAT;
+uint8_t sd_raw_dma_initialize(sd_raw_dma_t *sd_dma, sd_raw_t *sd) {
+    sd_dma->sd = sd;
+    sd_dma->fill = 0xff;
+    sd_dma->state = SD_RAW_DMA_IDLE;
 
-    if (dma_allocate(&sd_dma->rx_resource, &_config) != STATUS_OK) {
+    if (!sd_raw_dma_allocate(&sd_dma->tx_resource, &sd_dma->tx_descriptor, SERCOM4_DMAC_ID_TX, dma_tx_callback, dma_tx_error_callback)) {
         return false;
     }
-    if (setup_transfer_descriptor(&sd_dma->rx_descriptor, (void *)(&SERCOM4->SPI.DATA.reg), destination_memory, length, DMA_BEAT_SIZE_BYTE, false, true) != STATUS_OK) {
-        return false;
-    }
-    if (dma_add_descriptor(&sd_dma->rx_resource, &sd_dma->rx_descriptor) != STATUS_OK) {
+
+    if (!sd_raw_dma_allocate(&sd_dma->rx_resource, &sd_dma->rx_descriptor, SERCOM4_DMAC_ID_RX, dma_rx_callback, dma_rx_error_callback)) {
         return false;
     }
 
-    dma_register_callback(&sd_dma->rx_resource, dma_rx_callback, DMA_CALLBACK_TRANSFER_DONE);
-    dma_enable_callback(&sd_dma->rx_resource, DMA_CALLBACK_TRANSFER_DONE);
-
     return true;
 }
 
-uint8_t sd_raw_dma_write_block(sd_raw_dma_t *sd_dma, uint32_t block) {
-    if (sd_raw_command(sd_dma->sd, CMD24, block)) {
-        return sd_raw_error(sd_dma->sd, SD_CARD_ERROR_CMD24);
+static uint8_t sd_raw_dma_failed(sd_raw_dma_t *sd_dma, uint32_t error) {
+    sd_dma->state = SD_RAW_DMA_FAILED;
+    sd_raw_write_abort(sd_dma->sd, sd_dma->number > 1, error);
+    return SD_RAW_WRITE_FAILED;
+}
+
+// Sends the data token and starts the DMA transfer of the current block.
+static uint8_t sd_raw_dma_send(sd_raw_dma_t *sd_dma) {
+    const uint8_t *source = sd_dma->source + sd_dma->index * SD_RAW_BLOCK_SIZE;
+
+    SPI.transfer(sd_dma->number > 1 ? WRITE_MULTIPLE_TOKEN : DATA_START_BLOCK);
+
+    if (setup_transfer_descriptor(&sd_dma->tx_descriptor, (void *)source, (void *)(&SERCOM4->SPI.DATA.reg), SD_RAW_BLOCK_SIZE, DMA_BEAT_SIZE_BYTE, true, false) != STATUS_OK) {
+        return false;
     }
 
-    SPI.transfer(DATA_START_BLOCK);
+    sd_dma->txDone = false;
+    sd_dma->failed = false;
+    sd_dma->state = SD_RAW_DMA_SENDING;
 
     SPI.beginTransaction(SPISettings(12000000, MSBFIRST, SPI_MODE0));
 
-    dma_start_transfer_job(&sd_dma->tx_resource);
+    if (dma_start_transfer_job(&sd_dma->tx_resource) != STATUS_OK) {
+        SPI.endTransaction();
+        return false;
+    }
 
-    while (dma_get_job_status(&sd_dma->tx_resource) == STATUS_BUSY);
+    // The CPU is free while the block goes out, a good time for the CRC.
+    sd_dma->crc = sd_dma->sd->crc ? sd_raw_crc16(0, source, SD_RAW_BLOCK_SIZE) : 0xffff;
 
-    SPI.endTransaction();
+    return true;
+}
 
-    SPI.transfer(0xff);
-    SPI.transfer(0xff);
+uint8_t sd_raw_dma_write_blocks_start(sd_raw_dma_t *sd_dma, uint32_t block, uint32_t number, const uint8_t *source) {
+    sd_raw_t *sd = sd_dma->sd;
 
-    sd_dma->sd->status = SPI.transfer(0xff);
+    // One write at a time, a failure was already reported to whoever polled.
+    sd_raw_dma_wait(sd_dma);
 
-    if ((sd_dma->sd->status & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
-        return sd_raw_error(sd_dma->sd, SD_CARD_ERROR_WRITE);
+    if (number == 0) {
+        return true;
     }
 
-    if (!sd_raw_flush(sd_dma->sd, SD_RAW_WRITE_TIMEOUT)) {
-        return sd_raw_error(sd_dma->sd, SD_CARD_ERROR_WRITE_TIMEOUT);
+    uint32_t address = sd->type == SD_CARD_TYPE_SDHC ? block : block << 9;
+
+    // Lets the card erase the whole run up front rather than as it goes.
+    if (number > 1 && sd_raw_acommand(sd, ACMD23, number)) {
+        sd_dma->state = SD_RAW_DMA_FAILED;
+        return sd_raw_error(sd, SD_CARD_ERROR_ACMD23);
     }
 
-    if (sd_raw_command(sd_dma->sd, CMD13, 0) || SPI.transfer(0xff)) {
-        return sd_raw_error(sd_dma->sd, SD_CARD_ERROR_WRITE_PROGRAMMING);
+    uint8_t command = number > 1 ? CMD25 : CMD24;
+    if (sd_raw_command(sd, command, address)) {
+        sd_dma->state = SD_RAW_DMA_FAILED;
+        return sd_raw_error(sd, number > 1 ? SD_CARD_ERROR_CMD25 : SD_CARD_ERROR_CMD24);
     }
 
-    sd_raw_cs_high(sd_dma->sd);
+    sd_dma->source = source;
+    sd_dma->block = block;
+    sd_dma->number = number;
+    sd_dma->index = 0;
+
+    if (!sd_raw_dma_send(sd_dma)) {
+        sd_dma->state = SD_RAW_DMA_FAILED;
+        return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
+    }
 
     return true;
 }
 
-uint8_t sd_raw_dma_read_block(sd_raw_dma_t *sd_dma, uint32_t block) {
-    if (sd_raw_command(sd_dma->sd, CMD17, block)) {
-        return sd_raw_error(sd_dma->sd, SD_CARD_ERROR_CMD17);
+uint8_t sd_raw_dma_poll(sd_raw_dma_t *sd_dma) {
+    sd_raw_t *sd = sd_dma->sd;
+
+    switch (sd_dma->state) {
+    case SD_RAW_DMA_SENDING: {
+        if (!sd_dma->txDone) {
+            return SD_RAW_WRITE_BUSY;
+        }
+
+        SPI.endTransaction();
+
+        if (sd_dma->failed) {
+            return sd_raw_dma_failed(sd_dma, SD_CARD_ERROR_WRITE);
+        }
+
+        // A dummy CRC unless CRCs are on.
+        SPI.transfer(sd_dma->crc >> 8);
+        SPI.transfer(sd_dma->crc);
+
+        sd->status = SPI.transfer(0xff);
+
+        if ((sd->status & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
+            return sd_raw_dma_failed(sd_dma, sd_dma->number > 1 ? SD_CARD_ERROR_WRITE_MULTIPLE : SD_CARD_ERROR_WRITE);
+        }
+
+        sd_dma->index++;
+
+        if (sd_dma->number == 1) {
+            sd_raw_write_started(sd, sd_dma->block, 1);
+            sd_dma->state = SD_RAW_DMA_PROGRAMMING;
+        }
+        else {
+            sd_dma->started = millis();
+            sd_dma->state = SD_RAW_DMA_BETWEEN;
+        }
+
+        return SD_RAW_WRITE_BUSY;
+    }
+    case SD_RAW_DMA_BETWEEN: {
+        // The card holds the line low while it programs the last block.
+        if (SPI.transfer(0xff) != 0xff) {
+            if (((uint32_t)millis() - sd_dma->started) >= SD_RAW_WRITE_TIMEOUT) {
+                return sd_raw_dma_failed(sd_dma, SD_CARD_ERROR_WRITE_TIMEOUT);
+            }
+            return SD_RAW_WRITE_BUSY;
+        }
+
+        if (sd_dma->index < sd_dma->number) {
+            if (!sd_raw_dma_send(sd_dma)) {
+                return sd_raw_dma_failed(sd_dma, SD_CARD_ERROR_WRITE_MULTIPLE);
+            }
+            return SD_RAW_WRITE_BUSY;
+        }
+
+        SPI.transfer(STOP_TRAN_TOKEN);
+
+        sd_raw_write_started(sd, sd_dma->block, sd_dma->number);
+        sd_dma->state = SD_RAW_DMA_PROGRAMMING;
+
+        return SD_RAW_WRITE_BUSY;
+    }
+    case SD_RAW_DMA_PROGRAMMING: {
+        auto status = sd_raw_write_poll(sd);
+        if (status == SD_RAW_WRITE_READY) {
+            sd_dma->state = SD_RAW_DMA_IDLE;
+        }
+        else if (status == SD_RAW_WRITE_FAILED) {
+            sd_dma->state = SD_RAW_DMA_FAILED;
+        }
+        return status;
+    }
+    case SD_RAW_DMA_FAILED: {
+        return SD_RAW_WRITE_FAILED;
+    }
+    default: {
+        return SD_RAW_WRITE_READY;
+    }
+    }
+}
+
+uint8_t sd_raw_dma_wait(sd_raw_dma_t *sd_dma) {
+    uint8_t status;
+    while ((status = sd_raw_dma_poll(sd_dma)) == SD_RAW_WRITE_BUSY) {
+    }
+    return status;
+}
+
+uint8_t sd_raw_dma_write_block(sd_raw_dma_t *sd_dma, uint32_t block, const uint8_t *source) {
+    if (!sd_raw_dma_write_blocks_start(sd_dma, block, 1, source)) {
+        return false;
+    }
+
+    return sd_raw_dma_wait(sd_dma) == SD_RAW_WRITE_READY;
+}
+
+uint8_t sd_raw_dma_read_block(sd_raw_dma_t *sd_dma, uint32_t block, uint8_t *destiny) {
+    sd_raw_t *sd = sd_dma->sd;
+
+    sd_raw_dma_wait(sd_dma);
+
+    if (!sd_raw_read_check(sd, block, 1)) {
+        return false;
+    }
+
+    if (sd->type != SD_CARD_TYPE_SDHC) {
+        block <<= 9;
+    }
+
+    if (sd_raw_command(sd, CMD17, block)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_CMD17);
     }
 
-    if (!sd_wait_start_block(sd_dma->sd)) {
-        return sd_raw_error(sd_dma->sd, SD_CARD_ERROR_GENERAL);
+    if (!sd_wait_start_block(sd)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
     }
 
+    // Clock the block in by sending fill bytes.
+    if (setup_transfer_descriptor(&sd_dma->rx_descriptor, (void *)(&SERCOM4->SPI.DATA.reg), destiny, SD_RAW_BLOCK_SIZE, DMA_BEAT_SIZE_BYTE, false, true) != STATUS_OK) {
+        return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
+    }
+    if (setup_transfer_descriptor(&sd_dma->tx_descriptor, &sd_dma->fill, (void *)(&SERCOM4->SPI.DATA.reg), SD_RAW_BLOCK_SIZE, DMA_BEAT_SIZE_BYTE, false, false) != STATUS_OK) {
+        return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
+    }
+
+    sd_dma->rxDone = false;
+    sd_dma->txDone = false;
+    sd_dma->failed = false;
+
     SPI.beginTransaction(SPISettings(12000000, MSBFIRST, SPI_MODE0));
 
     dma_start_transfer_job(&sd_dma->rx_resource);
 
     dma_start_transfer_job(&sd_dma->tx_resource);
 
-    while (dma_get_job_status(&sd_dma->tx_resource) == STATUS_BUSY);
+    // A transfer that never finishes is given up on rather than hanging.
+    uint32_t started = millis();
+    while (!sd_dma->rxDone) {
+        if (((uint32_t)millis() - started) >= SD_RAW_READ_TIMEOUT) {
+            dma_abort_job(&sd_dma->tx_resource);
+            dma_abort_job(&sd_dma->rx_resource);
+            SPI.endTransaction();
+            return sd_raw_error(sd, SD_CARD_ERROR_READ_TIMEOUT);
+        }
+    }
 
     SPI.endTransaction();
 
-    sd_raw_cs_high(sd_dma->sd);
+    uint16_t crc = SPI.transfer(0xff) << 8;
+    crc |= SPI.transfer(0xff);
+
+    if (sd_dma->failed) {
+        return sd_raw_error(sd, SD_CARD_ERROR_GENERAL);
+    }
+
+    if (sd->crc && crc != sd_raw_crc16(0, destiny, SD_RAW_BLOCK_SIZE)) {
+        return sd_raw_error(sd, SD_CARD_ERROR_READ_CRC);
+    }
+
+    sd_raw_cs_high(sd);
 
     return true;
 }
@@ -8,19 +8,48 @@
 #include "sd_raw.h"
 #include "utility/dma.h"
 
+constexpr uint8_t SD_RAW_DMA_IDLE = 0;
+constexpr uint8_t SD_RAW_DMA_SENDING = 1;
+constexpr uint8_t SD_RAW_DMA_BETWEEN = 2;
+constexpr uint8_t SD_RAW_DMA_PROGRAMMING = 3;
+constexpr uint8_t SD_RAW_DMA_FAILED = 4;
+
 typedef struct sd_raw_dma_t {
     sd_raw_t *sd;
     dma_resource rx_resource;
     dma_resource tx_resource;
     COMPILER_ALIGNED(16) DmacDescriptor tx_descriptor;
     COMPILER_ALIGNED(16) DmacDescriptor rx_descriptor;
+    volatile uint8_t txDone;
+    volatile uint8_t rxDone;
+    volatile uint8_t failed;
+    uint8_t fill;
+    uint8_t state;
+    uint16_t crc;
+    uint32_t block;
+    uint32_t number;
+    uint32_t index;
+    uint32_t started;
+    const uint8_t *source;
 } sd_raw_dma_t;
 
-uint8_t sd_raw_dma_initialize(sd_raw_dma_t *sd_dma, sd_raw_t *sd, uint8_t *source_memory, uint8_t *destination_memory, size_t length);
+uint8_t sd_raw_dma_initialize(sd_raw_dma_t *sd_dma, sd_raw_t *sd);
+
+/**
+ * Starts writing number blocks from source and returns while the DMA transfer
+ * of the first one is underway. sd_raw_dma_poll moves the write along from
+ * block to block as the transfers complete, returning SD_RAW_WRITE_BUSY until
+ * the card is done programming, so source has to be left alone until then.
+ */
+uint8_t sd_raw_dma_write_blocks_start(sd_raw_dma_t *sd_dma, uint32_t block, uint32_t number, const uint8_t *source);
+
+uint8_t sd_raw_dma_poll(sd_raw_dma_t *sd_dma);
+
+uint8_t sd_raw_dma_wait(sd_raw_dma_t *sd_dma);
 
-uint8_t sd_raw_dma_write_block(sd_raw_dma_t *sd_dma, uint32_t block);
+uint8_t sd_raw_dma_write_block(sd_raw_dma_t *sd_dma, uint32_t block, const uint8_t *source);
 
-uint8_t sd_raw_dma_read_block(sd_raw_dma_t *sd_dma, uint32_t block);
+uint8_t sd_raw_dma_read_block(sd_raw_dma_t *sd_dma, uint32_t block, uint8_t *destiny);
 
 #endif
 
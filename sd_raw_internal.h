@@ -5,12 +5,24 @@ uint8_t sd_raw_flush(sd_raw_t *sd, uint16_t timeoutMs);
 uint8_t sd_wait_start_block(sd_raw_t *sd);
 uint8_t sd_raw_command(sd_raw_t *sd, uint8_t command, uint32_t arg);
 uint8_t sd_raw_error(sd_raw_t *sd, uint32_t error);
+uint8_t sd_raw_acommand(sd_raw_t *sd, uint8_t command, uint32_t arg);
+uint8_t sd_raw_write_started(sd_raw_t *sd, uint32_t block, uint32_t number);
+// Ends a write that's failed, stopping a burst and waiting out any programming
+// before deselecting the card, and returns the error.
+uint8_t sd_raw_write_abort(sd_raw_t *sd, uint8_t multiple, uint32_t error);
+uint8_t sd_raw_read_check(sd_raw_t *sd, uint32_t block, uint32_t number);
+// The CRC7 of a command, shifted up and with the end bit set.
+uint8_t sd_raw_crc7(const uint8_t *data, uint16_t size);
+uint16_t sd_raw_crc16(uint16_t crc, const uint8_t *data, uint16_t size);
 
 uint32_t const SD_RAW_INIT_TIMEOUT = 2 * 1000;
 uint32_t const SD_RAW_READ_TIMEOUT = 300;
 uint32_t const SD_RAW_WRITE_TIMEOUT = 600;
 uint32_t const SD_RAW_ERASE_TIMEOUT = 10 * 1000;
 
+// Size of the stack buffer used to send from const memory and to skip data.
+uint16_t const SD_RAW_SPI_CHUNK = 64;
+
 // GO_IDLE_STATE - init card in spi mode if CS low
 uint8_t const CMD0 = 0X00;
 // SEND_IF_COND - verify SD Memory Card interface operating condition.
@@ -19,10 +31,14 @@ uint8_t const CMD8 = 0X08;
 uint8_t const CMD9 = 0X09;
 // SEND_CID - read the card identification information (CID register)
 uint8_t const CMD10 = 0X0A;
+// STOP_TRANSMISSION - end multiple block read sequence
+uint8_t const CMD12 = 0X0C;
 // SEND_STATUS - read the card status register
 uint8_t const CMD13 = 0X0D;
 // READ_BLOCK - read a single data block from the card
 uint8_t const CMD17 = 0X11;
+// READ_MULTIPLE_BLOCK - read blocks of data until a STOP_TRANSMISSION
+uint8_t const CMD18 = 0X12;
 // WRITE_BLOCK - write a single data block to the card
 uint8_t const CMD24 = 0X18;
 // WRITE_MULTIPLE_BLOCK - write blocks of data until a STOP_TRANSMISSION
@@ -38,6 +54,10 @@ uint8_t const CMD38 = 0X26;
 uint8_t const CMD55 = 0X37;
 // READ_OCR - read the OCR register of a card
 uint8_t const CMD58 = 0X3A;
+// CRC_ON_OFF - turn CRC checking on (bit 0 set) or off
+uint8_t const CMD59 = 0X3B;
+// SD_STATUS - read the 64 byte SD status register
+uint8_t const ACMD13 = 0X0D;
 // SET_WR_BLK_ERASE_COUNT - Set the number of write blocks to be
 // pre-erased before writing
 uint8_t const ACMD23 = 0X17;
@@ -50,6 +70,8 @@ uint8_t const R1_READY_STATE = 0X00;
 uint8_t const R1_IDLE_STATE = 0X01;
 // status bit for illegal command
 uint8_t const R1_ILLEGAL_COMMAND = 0X04;
+// status bit for a command that failed its CRC check
+uint8_t const R1_COM_CRC_ERROR = 0X08;
 // start data token for read or write single block
 uint8_t const DATA_START_BLOCK = 0XFE;
 // stop token for write multiple blocks
@@ -60,6 +82,14 @@ uint8_t const WRITE_MULTIPLE_TOKEN = 0XFC;
 uint8_t const DATA_RES_MASK = 0X1F;
 // write data accepted token
 uint8_t const DATA_RES_ACCEPTED = 0X05;
+// write data rejected due to a CRC error token
+uint8_t const DATA_RES_CRC_ERROR = 0X0B;
+
+// Size of the SD status register.
+uint8_t const SD_RAW_STATUS_SIZE = 64;
+
+// AU_SIZE of the SD status, in blocks. Zero is undefined.
+extern uint32_t const SD_RAW_AU_BLOCKS[16];
 
 typedef struct cid_t {
     // byte 0
@@ -5,6 +5,7 @@ import (
 	"encoding/binary"
 	"flag"
 	"fmt"
+	"io"
 	"log"
 	"os"
 	"strings"
@@ -14,6 +15,19 @@ import (
 const (
 	MaximumEntrySize = 505
 	MaximumBlockSize = 512
+	// Must match FKFS_HEADER_BLOCKS, the ring follows block 0.
+	HeaderBlocks  = 64
+	HeaderCrcSeed = 31337
+	// Data blocks end with a stamp, see fkfs_block_trailer_t.
+	BlockDataSize  = 506
+	TrailerCrcSeed = 7331
+	// The region follows the header, see fkfs_region_t. Cards without one
+	// were written with the defaults.
+	RegionCrcSeed     = 2718
+	DefaultFirstBlock = 8000
+	// Appends a sync commit carried in the header's block instead of the
+	// head follow the region, see fkfs_inline_t.
+	InlineCrcSeed = 4217
 )
 
 var (
@@ -69,18 +83,237 @@ type HeaderBlock struct {
 	Crc        uint16
 }
 
-func ReadHeader(f *os.File) *HeaderBlock {
+func HeaderValid(header *HeaderBlock) bool {
+	b := new(bytes.Buffer)
+	binary.Write(b, binary.LittleEndian, header)
+
+	return header.Crc == Crc16Update(HeaderCrcSeed, b.Bytes(), len(b.Bytes())-2)
+}
+
+type Region struct {
+	FirstBlock uint32
+	EndBlock   uint32
+	Stamp      uint32
+	Crc        uint16
+}
+
+func RegionValid(region *Region) bool {
+	b := new(bytes.Buffer)
+	binary.Write(b, binary.LittleEndian, region)
+
+	return region.FirstBlock < region.EndBlock && region.Crc == Crc16Update(RegionCrcSeed, b.Bytes(), len(b.Bytes())-2)
+}
+
+type Inline struct {
+	Block  uint32
+	Stamp  uint32
+	Offset uint16
+	Size   uint16
+	Crc    uint16
+}
+
+// What follows the header and region in a header block, FKFS_INLINE_SIZE
+// bytes of appends at most.
+type InlineTail struct {
+	Inline Inline
+	Data   []byte
+}
+
+func InlineValid(tail *InlineTail) bool {
+	if tail.Inline.Size == 0 || int(tail.Inline.Size) > len(tail.Data) {
+		return false
+	}
+
+	b := new(bytes.Buffer)
+	binary.Write(b, binary.LittleEndian, &tail.Inline)
+
+	crc := Crc16Update(InlineCrcSeed, b.Bytes(), len(b.Bytes())-2)
+	crc = Crc16Update(crc, tail.Data, int(tail.Inline.Size))
+
+	return tail.Inline.Crc == crc
+}
+
+// The card as fkfs mounts it, blocks are read from the image except for a
+// head with appends put back from the header's block.
+type Card struct {
+	File      *os.File
+	Head      uint32
+	HeadBlock []byte
+}
+
+// Blocks past the end of the image read as zeros.
+func (c *Card) ReadBlock(block uint32) []byte {
+	if c.HeadBlock != nil && block == c.Head {
+		return c.HeadBlock
+	}
+
+	data := make([]byte, MaximumBlockSize)
+	_, err := c.File.ReadAt(data, int64(block)*MaximumBlockSize)
+	if err != nil && err != io.EOF {
+		panic(err)
+	}
+
+	return data
+}
+
+// The data region the card was wiped with, or the defaults for cards from
+// before it was kept.
+func DefaultRegion(f *os.File) *Region {
+	info, err := f.Stat()
+	if err != nil {
+		panic(err)
+	}
+
+	return &Region{
+		FirstBlock: DefaultFirstBlock,
+		EndBlock:   uint32(info.Size()/MaximumBlockSize) - 2,
+	}
+}
+
+// Headers are committed round a ring of blocks after block 0, older cards
+// only have the pair in block 0. The newest valid one wins, along with the
+// region and inline appends in its block.
+func ReadHeader(card *Card) (*HeaderBlock, *Region, *InlineTail) {
+	f := card.File
+
+	var newest *HeaderBlock
+	var tail *InlineTail
+	region := DefaultRegion(f)
+
+	consider := func(header HeaderBlock) bool {
+		if HeaderValid(&header) && (newest == nil || header.Generation > newest.Generation) {
+			newest = &header
+			return true
+		}
+		return false
+	}
+
 	headerBlock := [2]HeaderBlock{}
 	err := binary.Read(f, binary.LittleEndian, &headerBlock)
 	if err != nil {
 		panic(err)
 	}
 
-	if headerBlock[0].Generation > headerBlock[1].Generation {
-		return &headerBlock[0]
+	consider(headerBlock[0])
+	consider(headerBlock[1])
+
+	for i := 0; i < HeaderBlocks; i += 1 {
+		r := bytes.NewReader(card.ReadBlock(uint32(1 + i)))
+
+		header := HeaderBlock{}
+		stored := Region{}
+		inline := InlineTail{}
+		binary.Read(r, binary.LittleEndian, &header)
+		binary.Read(r, binary.LittleEndian, &stored)
+		binary.Read(r, binary.LittleEndian, &inline.Inline)
+		inline.Data, _ = io.ReadAll(r)
+
+		if consider(header) {
+			region = DefaultRegion(f)
+			if RegionValid(&stored) {
+				region = &stored
+			}
+			tail = &inline
+		}
+	}
+
+	if newest == nil {
+		log.Fatalf("No valid header")
 	}
 
-	return &headerBlock[1]
+	return newest, region, tail
+}
+
+// Appends the last commit only had in the header's block go back in the
+// head, stamped as the commit left it, unless the card already has them. See
+// fkfs_inline_replay.
+func ReplayInline(card *Card, header *HeaderBlock, tail *InlineTail) bool {
+	if tail == nil || !InlineValid(tail) {
+		return false
+	}
+
+	inline := &tail.Inline
+	if inline.Block != header.Block || inline.Offset+inline.Size != header.Offset {
+		return false
+	}
+
+	block := card.ReadBlock(header.Block)
+	data := tail.Data[:inline.Size]
+	stamp, ok := BlockStamp(block)
+	if ok && stamp == inline.Stamp && bytes.Equal(block[inline.Offset:header.Offset], data) {
+		return false
+	}
+
+	copy(block[inline.Offset:], data)
+
+	b := new(bytes.Buffer)
+	binary.Write(b, binary.LittleEndian, inline.Stamp)
+	binary.Write(b, binary.LittleEndian, Crc16Update(TrailerCrcSeed, b.Bytes(), len(b.Bytes())))
+	copy(block[BlockDataSize:], b.Bytes())
+
+	card.Head = header.Block
+	card.HeadBlock = block
+
+	return true
+}
+
+type Trailer struct {
+	Stamp uint32
+	Crc   uint16
+}
+
+func BlockStamp(data []byte) (uint32, bool) {
+	trailer := Trailer{}
+	binary.Read(bytes.NewReader(data[BlockDataSize:]), binary.LittleEndian, &trailer)
+
+	b := new(bytes.Buffer)
+	binary.Write(b, binary.LittleEndian, trailer.Stamp)
+
+	return trailer.Stamp, trailer.Crc == Crc16Update(TrailerCrcSeed, b.Bytes(), len(b.Bytes()))
+}
+
+func ReadStamp(card *Card, block uint32) (uint32, bool) {
+	return BlockStamp(card.ReadBlock(block))
+}
+
+// Moves distance blocks on from block, wrapping around the region.
+func (r *Region) Forward(block uint32, distance uint32) uint32 {
+	return r.FirstBlock + (block-r.FirstBlock+distance)%(r.EndBlock-r.FirstBlock)
+}
+
+// Blocks written after the header was committed carry the stamps following
+// the head's, the last of them is found by galloping and a binary search.
+func FindLogEnd(card *Card, header *HeaderBlock, region *Region) uint32 {
+	stamp, ok := ReadStamp(card, header.Block)
+	if !ok {
+		return header.Block
+	}
+
+	written := func(distance uint32) bool {
+		found, ok := ReadStamp(card, region.Forward(header.Block, distance))
+		return ok && found == stamp+distance
+	}
+
+	size := region.EndBlock - region.FirstBlock
+	low, high := uint32(0), uint32(1)
+	for high < size && written(high) {
+		low = high
+		high *= 2
+	}
+	if high > size {
+		high = size
+	}
+
+	for high-low > 1 {
+		middle := low + (high-low)/2
+		if written(middle) {
+			low = middle
+		} else {
+			high = middle
+		}
+	}
+
+	return region.Forward(header.Block, low)
 }
 
 type Block struct {
@@ -107,18 +340,13 @@ func BlockChecksum(file *File, entry *Entry, data []byte) uint16 {
 	return crc
 }
 
-func ReadBlock(header *HeaderBlock, c Cursor, f *os.File) *Block {
-	position := int64(c.Block*512 + uint32(c.Offset))
-
-	f.Seek(position, 0)
+func ReadBlock(header *HeaderBlock, c Cursor, card *Card) *Block {
+	r := bytes.NewReader(card.ReadBlock(c.Block)[c.Offset:])
 
 	entry := Entry{}
-	err := binary.Read(f, binary.LittleEndian, &entry)
-	if err != nil {
-		panic(err)
-	}
+	err := binary.Read(r, binary.LittleEndian, &entry)
 
-	if entry.File >= 6 || entry.Size == 0 || entry.Size > MaximumEntrySize || entry.Available == 0 || entry.Available > MaximumEntrySize {
+	if err != nil || entry.File >= 6 || entry.Size == 0 || entry.Size > MaximumEntrySize || entry.Available == 0 || entry.Available > MaximumEntrySize || int(entry.Size) > r.Len() {
 		return &Block{
 			Next: Cursor{
 				Block:  c.Block + 1,
@@ -129,10 +357,7 @@ func ReadBlock(header *HeaderBlock, c Cursor, f *os.File) *Block {
 
 	data := make([]byte, entry.Size)
 
-	_, err = f.Read(data)
-	if err != nil {
-		panic(err)
-	}
+	r.Read(data)
 
 	actual := BlockChecksum(&header.Files[entry.File], &entry, data)
 
@@ -191,7 +416,15 @@ func main() {
 
 	defer f.Close()
 
-	header := ReadHeader(f)
+	card := &Card{
+		File: f,
+	}
+
+	header, region, tail := ReadHeader(card)
+
+	if header.Block < region.FirstBlock || header.Block >= region.EndBlock {
+		log.Fatalf("Head %d outside region %d - %d", header.Block, region.FirstBlock, region.EndBlock)
+	}
 
 	c := Cursor{
 		Block:  0,
@@ -202,13 +435,27 @@ func main() {
 
 	prefix := time.Now().Format("20060102_150405")
 
-	for c.Block = 1; c.Block < header.Block; {
+	if ReplayInline(card, header, tail) {
+		log.Printf("Replaying %d bytes the header carries for block %d", tail.Inline.Size, header.Block)
+	}
+
+	end := FindLogEnd(card, header, region)
+	if end != header.Block {
+		log.Printf("Reading past the header to block %d", end)
+	}
+
+	// Once the log has wrapped all of the region is read.
+	if end < header.Block {
+		end = region.EndBlock - 1
+	}
+
+	for c.Block = region.FirstBlock; c.Block <= end; {
 		if c.Block == 0 {
 			c.Block += 1
 			continue
 		}
 
-		b := ReadBlock(header, c, f)
+		b := ReadBlock(header, c, card)
 
 		if b.Entry != nil {
 			if files[b.Entry.File] == nil {
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "hal.h"
+
+/**
+ * Stands in for the Arduino SPI library on the host. Bytes are exchanged with
+ * the attached device while its chip select is low and every call is counted,
+ * so the cost of driver changes can be measured off the board.
+ */
+typedef struct spi_device_t {
+    uint8_t cs;
+    void *ctx;
+    uint8_t (*exchange)(void *ctx, uint8_t value);
+} spi_device_t;
+
+typedef struct spi_statistics_t {
+    uint32_t byteCalls;
+    uint32_t bufferCalls;
+    uint64_t bytes;
+} spi_statistics_t;
+
+class SPIClass {
+public:
+    spi_device_t *device{ nullptr };
+    uint8_t selected{ false };
+    spi_statistics_t statistics{ };
+
+    void begin();
+    void end();
+    void setClockDivider(uint8_t divider);
+    uint8_t transfer(uint8_t value);
+    void transfer(void *buffer, size_t size);
+
+    void attach(spi_device_t *device);
+    void chipSelect(uint8_t pin, uint8_t level);
+};
+
+extern SPIClass SPI;
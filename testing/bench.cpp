@@ -0,0 +1,918 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <cinttypes>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Arduino.h"
+#include "fkfs.h"
+#include "fkfs_device_host.h"
+#include "fkfs_device_uring.h"
+#include "sd_card.h"
+#include "fkfs_device_sim.h"
+#include "sd_raw_internal.h"
+
+static constexpr uint8_t FKFS_FILE_LOG = 0;
+static constexpr uint8_t FKFS_FILE_DATA = 1;
+static constexpr uint8_t FKFS_FILE_PRIORITY_LOWEST = 255;
+static constexpr uint8_t FKFS_FILE_PRIORITY_HIGHEST = 0;
+
+static constexpr uint32_t BENCH_NUMBER_OF_BLOCKS = 32768;
+static constexpr uint32_t BENCH_APPENDS = 20000;
+
+// Two allocation units in the sim profiles, so the log wraps after 4MB.
+static constexpr uint32_t BENCH_ERASE_NUMBER_OF_BLOCKS = 16386;
+static constexpr uint32_t BENCH_ERASE_ROUNDS = 8;
+static constexpr uint32_t BENCH_ERASE_APPENDS = 10000;
+static constexpr uint32_t BENCH_ERASE_AHEAD = 2048;
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_ms(bench_clock::time_point started) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - started).count();
+}
+
+static bool bench_files(fkfs_t *fs, bool wipe) {
+    if (!fkfs_initialize_file(fs, FKFS_FILE_LOG, FKFS_FILE_PRIORITY_LOWEST, false, "FK.LOG")) {
+        return false;
+    }
+
+    if (!fkfs_initialize_file(fs, FKFS_FILE_DATA, FKFS_FILE_PRIORITY_HIGHEST, false, "DATA.BIN")) {
+        return false;
+    }
+
+    return fkfs_initialize(fs, wipe);
+}
+
+static bool bench_append(fkfs_t *fs) {
+    uint8_t record[128];
+    for (size_t i = 0; i < sizeof(record); ++i) {
+        record[i] = i;
+    }
+
+    for (uint32_t i = 0; i < BENCH_APPENDS; ++i) {
+        auto file = (i % 4 == 0) ? FKFS_FILE_DATA : FKFS_FILE_LOG;
+        auto size = 16 + (i * 7) % (sizeof(record) - 16);
+        if (!fkfs_file_append(fs, file, size, record)) {
+            fprintf(stderr, "error: Unable to append (%d)\n", i);
+            return false;
+        }
+    }
+
+    return fkfs_flush(fs);
+}
+
+static uint32_t bench_iterate(fkfs_t *fs, bool readAhead, bool partialReads = false) {
+    uint8_t buffer[FKFS_MAXIMUM_BLOCK_SIZE];
+    uint32_t bytes = 0;
+    for (auto file : { FKFS_FILE_LOG, FKFS_FILE_DATA }) {
+        fkfs_file_iter_t iter = { 0 };
+        fkfs_iterator_config_t config = {
+            .maxBlocks = 0,
+            .maxTime = 0,
+            .manualNext = false,
+            .readAhead = readAhead,
+            .partialReads = partialReads,
+            .buffer = buffer,
+            .bufferSize = sizeof(buffer),
+        };
+
+        fkfs_file_iterator_create(fs, file, &iter);
+
+        while (fkfs_file_iterate(fs, &config, &iter)) {
+            bytes += iter.size;
+        }
+    }
+    return bytes;
+}
+
+static bool run(const char *name, fkfs_t *fs) {
+    if (!bench_files(fs, true)) {
+        return false;
+    }
+
+    auto started = bench_clock::now();
+
+    if (!bench_append(fs)) {
+        return false;
+    }
+
+    auto appendTime = elapsed_ms(started);
+    auto appendWrites = fs->statistics.blockWrites;
+    auto appendBursts = fs->statistics.burstWrites;
+    auto appendReads = fs->statistics.blockReads;
+
+    started = bench_clock::now();
+
+    auto bytes = bench_iterate(fs, false);
+
+    auto iterateTime = elapsed_ms(started);
+    auto iterateReads = fs->statistics.blockReads;
+    auto iterateBursts = fs->statistics.burstReads;
+
+    started = bench_clock::now();
+
+    auto aheadBytes = bench_iterate(fs, true);
+
+    auto aheadTime = elapsed_ms(started);
+    auto aheadReads = fs->statistics.blockReads;
+
+    started = bench_clock::now();
+
+    auto partialBytes = bench_iterate(fs, false, true);
+
+    auto partialTime = elapsed_ms(started);
+
+    printf("%-8s append %8.2fms (%6d writes, %6d bursts, %6d reads) iterate %8.2fms (%6d reads, %d bytes)\n",
+           name, appendTime, appendWrites, appendBursts, appendReads, iterateTime,
+           iterateReads - appendReads, bytes);
+    printf("%-8s read ahead %8.2fms (%6d reads, %6d bursts, %d bytes)\n",
+           name, aheadTime, aheadReads - iterateReads, fs->statistics.burstReads - iterateBursts, aheadBytes);
+    printf("%-8s partial %8.2fms (%6d reads, %6d device bytes, %d bytes)\n",
+           name, partialTime, fs->statistics.partialReads, fs->statistics.partialBytes, partialBytes);
+
+    return true;
+}
+
+/**
+ * Reads the data file back an entry at a time while appending to the log, the
+ * way firmware uploads while it's still logging. The iterator's block and the
+ * head take turns in the cache unless there's room for both.
+ */
+static bool run_cache(fkfs_t *fs) {
+    uint8_t record[64] = { 0 };
+
+    if (!bench_files(fs, true) || !bench_append(fs)) {
+        return false;
+    }
+
+    fkfs_statistics_zero(&fs->statistics);
+
+    fkfs_file_iter_t iter = { 0 };
+    fkfs_iterator_config_t config = {
+        .maxBlocks = 0,
+        .maxTime = 0,
+        .manualNext = false,
+        .readAhead = false,
+        .partialReads = false,
+        .buffer = nullptr,
+        .bufferSize = 0,
+    };
+    uint32_t expected = fs->header.files[FKFS_FILE_DATA].size;
+    uint32_t bytes = 0;
+
+    auto started = bench_clock::now();
+
+    fkfs_file_iterator_create(fs, FKFS_FILE_DATA, &iter);
+    while (fkfs_file_iterate(fs, &config, &iter)) {
+        bytes += iter.size;
+        if (!fkfs_file_append(fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+    }
+
+    auto elapsed = elapsed_ms(started);
+
+    if (bytes != expected) {
+        fprintf(stderr, "error: Iterated %d of %d bytes\n", bytes, expected);
+        return false;
+    }
+
+    printf("cache %2d blocks %8.2fms (%6d reads, %6d writes, %6d hits, %6d misses, %6d writebacks, %d bytes)\n",
+           FKFS_CACHE_BLOCKS, elapsed, fs->statistics.blockReads, fs->statistics.blockWrites,
+           fs->statistics.cacheHits, fs->statistics.cacheMisses, fs->statistics.cacheWritebacks, bytes);
+
+    return true;
+}
+
+/**
+ * Appends with DATA as a sync file under a few policies, a commit per append,
+ * group commits every few hundred bytes and only flushing at the end.
+ */
+static bool run_sync(fkfs_t *fs) {
+    struct policy_t {
+        const char *name;
+        uint8_t sync;
+        uint32_t syncBytes;
+        uint8_t inlineSync;
+    } policies[] = {
+        { "every", true, 0, false },
+        { "inline", true, 0, true },
+        { "128B", true, 128, false },
+        { "384B", true, 384, false },
+        { "flush", false, 0, false },
+    };
+
+    for (auto &policy : policies) {
+        fs->inlineSync = policy.inlineSync;
+
+        if (!bench_files(fs, true)) {
+            return false;
+        }
+
+        if (policy.sync && !fkfs_file_sync_policy(fs, FKFS_FILE_DATA, policy.syncBytes, 0)) {
+            return false;
+        }
+
+        auto generation = fs->header.generation;
+        auto started = bench_clock::now();
+
+        if (!bench_append(fs)) {
+            return false;
+        }
+
+        auto elapsed = elapsed_ms(started);
+
+        if (fkfs_durable(fs) != fkfs_sequence(fs)) {
+            fprintf(stderr, "error: Durable %d of %d\n", fkfs_durable(fs), fkfs_sequence(fs));
+            return false;
+        }
+
+        printf("sync %-6s %8.2fms (%6d writes, %6d commits, %6d inline, %d appends)\n",
+               policy.name, elapsed, fs->statistics.blockWrites, fs->header.generation - generation,
+               fs->statistics.inlineCommits, fkfs_sequence(fs));
+    }
+
+    // Small status records on their own, where inlineSync fits many commits
+    // in the header's block before the head has to be written.
+    uint8_t record[20] = { 0 };
+
+    for (auto inlineSync : { false, true }) {
+        fs->inlineSync = inlineSync;
+
+        if (!bench_files(fs, true)) {
+            return false;
+        }
+
+        if (!fkfs_file_sync_policy(fs, FKFS_FILE_DATA, 0, 0)) {
+            return false;
+        }
+
+        auto started = bench_clock::now();
+
+        for (uint32_t i = 0; i < BENCH_APPENDS / 4; ++i) {
+            if (!fkfs_file_append(fs, FKFS_FILE_DATA, sizeof(record), record)) {
+                fprintf(stderr, "error: Unable to append (%d)\n", i);
+                return false;
+            }
+        }
+
+        if (!fkfs_flush(fs)) {
+            return false;
+        }
+
+        auto elapsed = elapsed_ms(started);
+
+        printf("sync small %-6s %8.2fms (%6d writes, %6d inline, %d appends)\n",
+               inlineSync ? "inline" : "every", elapsed, fs->statistics.blockWrites,
+               fs->statistics.inlineCommits, fkfs_sequence(fs));
+    }
+
+    return true;
+}
+
+/**
+ * Appends to a RAM disk that stays busy for a while after every write, like a
+ * card programming flash, first waiting out each write and then polling
+ * between appends the way firmware would between samples.
+ */
+static bool run_busy(fkfs_t *fs, fkfs_device_ram_t *ram) {
+    uint8_t record[128] = { 0 };
+
+    for (auto asynchronous : { false, true }) {
+        // Start from a blank disk each time, like the other backends.
+        if (!fkfs_device_erase(&fs->device, 0, ram->numberOfBlocks - 1)) {
+            return false;
+        }
+
+        fs->asynchronous = asynchronous;
+        ram->busyPolls = 64;
+        ram->stalls = 0;
+        ram->stallPolls = 0;
+
+        if (!bench_files(fs, true)) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < BENCH_APPENDS; ++i) {
+            auto file = (i % 4 == 0) ? FKFS_FILE_DATA : FKFS_FILE_LOG;
+            if (!fkfs_file_append(fs, file, 16 + i % 64, record)) {
+                fprintf(stderr, "error: Unable to append (%d)\n", i);
+                return false;
+            }
+            if (i % 32 == 0 && !fkfs_flush(fs)) {
+                return false;
+            }
+            if (!fkfs_poll(fs)) {
+                return false;
+            }
+        }
+
+        if (!fkfs_flush(fs)) {
+            return false;
+        }
+
+        uint8_t status;
+        while ((status = fkfs_poll(fs)) == FKFS_PENDING) {
+        }
+        if (!status) {
+            return false;
+        }
+
+        auto bytes = bench_iterate(fs, false);
+
+        printf("busy %-5s append (%6d writes, %6d stalls, %7d polls stalled, %7d busy polls, %d bytes)\n",
+               asynchronous ? "async" : "sync", fs->statistics.blockWrites, ram->stalls, ram->stallPolls, fs->statistics.busyPolls, bytes);
+    }
+
+    return true;
+}
+
+static void bench_spi_log(const char *name, uint32_t blocks, spi_statistics_t *before) {
+    auto calls = (SPI.statistics.byteCalls - before->byteCalls) + (SPI.statistics.bufferCalls - before->bufferCalls);
+    auto bytes = SPI.statistics.bytes - before->bytes;
+
+    printf("spi %-12s %6.1f calls/block %7.1f bytes/block\n", name, (double)calls / blocks, (double)bytes / blocks);
+
+    *before = SPI.statistics;
+}
+
+// The bit twiddling CRC16 sd_raw used to have, for comparison.
+static uint16_t bench_crc16_bitwise(const uint8_t *data, uint16_t size) {
+    uint16_t crc = 0;
+    for (uint16_t i = 0; i < size; i++) {
+        uint16_t x = ((crc >> 8) ^ data[i]) & 0xff;
+        x ^= x >> 4;
+        crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
+    }
+    return crc;
+}
+
+/**
+ * Times block transfers with CRCs off and on, and the CRC itself. On the host
+ * the emulator swamps the CRC, the MB/s are what to compare to the SPI clock.
+ */
+static bool bench_spi_crc(sd_raw_t *sd) {
+    static constexpr uint32_t BENCH_CRC_BLOCKS = 4096;
+
+    std::vector<uint8_t> block(SD_RAW_BLOCK_SIZE);
+    for (size_t i = 0; i < block.size(); ++i) {
+        block[i] = i * 13;
+    }
+
+    volatile uint16_t sink = 0;
+    auto started = bench_clock::now();
+    for (uint32_t i = 0; i < BENCH_CRC_BLOCKS * 16; ++i) {
+        sink = sink + sd_raw_crc16(0, block.data(), SD_RAW_BLOCK_SIZE);
+    }
+    auto tableTime = elapsed_ms(started);
+
+    started = bench_clock::now();
+    for (uint32_t i = 0; i < BENCH_CRC_BLOCKS * 16; ++i) {
+        sink = sink + bench_crc16_bitwise(block.data(), SD_RAW_BLOCK_SIZE);
+    }
+    auto bitwiseTime = elapsed_ms(started);
+
+    if (sd_raw_crc16(0, block.data(), SD_RAW_BLOCK_SIZE) != bench_crc16_bitwise(block.data(), SD_RAW_BLOCK_SIZE)) {
+        fprintf(stderr, "error: CRC16 mismatch\n");
+        return false;
+    }
+
+    auto megabytes = (double)BENCH_CRC_BLOCKS * 16 * SD_RAW_BLOCK_SIZE / (1024 * 1024);
+    printf("crc16 table %8.1fMB/s bitwise %8.1fMB/s\n", megabytes / (tableTime / 1000), megabytes / (bitwiseTime / 1000));
+
+    for (auto crc : { false, true }) {
+        if (!sd_raw_set_crc(sd, crc)) {
+            return false;
+        }
+
+        started = bench_clock::now();
+        for (uint32_t i = 0; i < BENCH_CRC_BLOCKS; ++i) {
+            if (!sd_raw_write_block(sd, 1 + i % 64, block.data())) {
+                return false;
+            }
+        }
+        auto writeTime = elapsed_ms(started);
+
+        started = bench_clock::now();
+        for (uint32_t i = 0; i < BENCH_CRC_BLOCKS; ++i) {
+            if (!sd_raw_read_block(sd, 1 + i % 64, block.data())) {
+                return false;
+            }
+        }
+        auto readTime = elapsed_ms(started);
+
+        printf("spi crc %-3s write %8.2fms read %8.2fms (%d blocks)\n", crc ? "on" : "off", writeTime, readTime, BENCH_CRC_BLOCKS);
+    }
+
+    return sd_raw_set_crc(sd, false);
+}
+
+/**
+ * Runs sd_raw against the card emulator, counting the SPI calls and bytes each
+ * kind of operation takes, and then runs the usual benchmark through it.
+ */
+static bool run_spi(fkfs_t *fs, fkfs_device_ram_t *ram) {
+    static constexpr uint8_t BENCH_SPI_CS = 4;
+    static constexpr uint32_t BENCH_SPI_BLOCKS = 64;
+
+    fkfs_device_t backing;
+    if (!fkfs_device_ram_open(&backing, ram, ram->memory, ram->numberOfBlocks)) {
+        return false;
+    }
+
+    sd_card_t card;
+    sd_card_open(&card, &backing, BENCH_SPI_CS);
+    SPI.attach(&card.spi);
+
+    if (!sd_raw_initialize(&fs->sd, BENCH_SPI_CS)) {
+        fprintf(stderr, "error: Unable to initialize card (%d)\n", fs->sd.status);
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(BENCH_SPI_BLOCKS * SD_RAW_BLOCK_SIZE, 0xa5);
+    auto before = SPI.statistics;
+
+    for (uint32_t i = 0; i < BENCH_SPI_BLOCKS; ++i) {
+        if (!sd_raw_write_block(&fs->sd, 1 + i, buffer.data())) {
+            return false;
+        }
+    }
+    bench_spi_log("write block", BENCH_SPI_BLOCKS, &before);
+
+    // Checking the card's status once for the lot.
+    fs->sd.statusInterval = BENCH_SPI_BLOCKS;
+    for (uint32_t i = 0; i < BENCH_SPI_BLOCKS; ++i) {
+        if (!sd_raw_write_block(&fs->sd, 1 + i, buffer.data())) {
+            return false;
+        }
+    }
+    if (!sd_raw_write_check(&fs->sd)) {
+        return false;
+    }
+    fs->sd.statusInterval = 0;
+    bench_spi_log("write lazy", BENCH_SPI_BLOCKS, &before);
+
+    if (!sd_raw_write_blocks(&fs->sd, 1, BENCH_SPI_BLOCKS, buffer.data())) {
+        return false;
+    }
+    bench_spi_log("write blocks", BENCH_SPI_BLOCKS, &before);
+
+    for (uint32_t i = 0; i < BENCH_SPI_BLOCKS; ++i) {
+        if (!sd_raw_read_block(&fs->sd, 1 + i, buffer.data())) {
+            return false;
+        }
+    }
+    bench_spi_log("read block", BENCH_SPI_BLOCKS, &before);
+
+    if (!sd_raw_read_blocks(&fs->sd, 1, BENCH_SPI_BLOCKS, buffer.data())) {
+        return false;
+    }
+    bench_spi_log("read blocks", BENCH_SPI_BLOCKS, &before);
+
+    for (uint32_t i = 0; i < BENCH_SPI_BLOCKS; ++i) {
+        if (!sd_raw_read_partial(&fs->sd, 1 + i, SD_RAW_BLOCK_SIZE - 16, 16, buffer.data()) ||
+            !sd_raw_read_end(&fs->sd)) {
+            return false;
+        }
+    }
+    bench_spi_log("read tail", BENCH_SPI_BLOCKS, &before);
+
+    if (!bench_spi_crc(&fs->sd)) {
+        return false;
+    }
+
+    if (!fkfs_device_sd_open(&fs->device, &fs->sd)) {
+        return false;
+    }
+
+    auto success = run("spi", fs);
+
+    printf("spi %d byte calls, %d buffer calls, %" PRIu64 " bytes\n",
+           SPI.statistics.byteCalls, SPI.statistics.bufferCalls, SPI.statistics.bytes);
+    sd_card_log_statistics(&card);
+
+    SPI.attach(nullptr);
+
+    return success;
+}
+
+/**
+ * Iterates both files with a time budget per call, the way firmware shares
+ * the CPU, returning the bytes and counting the calls it took.
+ */
+static uint32_t bench_iterate_budget(fkfs_t *fs, uint32_t maxTime, uint32_t *calls, uint32_t *longest) {
+    uint32_t bytes = 0;
+    for (auto file : { FKFS_FILE_LOG, FKFS_FILE_DATA }) {
+        fkfs_file_iter_t iter = { 0 };
+        fkfs_iterator_config_t config = {
+            .maxBlocks = 0,
+            .maxTime = maxTime,
+            .manualNext = false,
+            .readAhead = false,
+            .partialReads = false,
+            .buffer = nullptr,
+            .bufferSize = 0,
+        };
+
+        fkfs_file_iterator_create(fs, file, &iter);
+
+        while (true) {
+            auto started = millis();
+            auto success = fkfs_file_iterate(fs, &config, &iter);
+            *longest = std::max(*longest, millis() - started);
+            (*calls)++;
+            if (success) {
+                bytes += iter.size;
+            }
+            else if (fkfs_file_iterator_done(fs, &iter)) {
+                break;
+            }
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Runs the usual appends and iteration against the latency model of a card,
+ * on the virtual clock, so the times are what the card would take and are
+ * the same from run to run.
+ */
+static bool run_sim(fkfs_t *fs, fkfs_device_ram_t *ram, const fkfs_device_sim_profile_t *profile) {
+    uint8_t record[128] = { 0 };
+    fkfs_device_t backing;
+    if (!fkfs_device_ram_open(&backing, ram, ram->memory, ram->numberOfBlocks)) {
+        return false;
+    }
+
+    for (auto asynchronous : { false, true }) {
+        if (!fkfs_device_erase(&backing, 0, ram->numberOfBlocks - 1)) {
+            return false;
+        }
+
+        fkfs_device_sim_t sim;
+        if (!fkfs_device_sim_open(&fs->device, &sim, &backing, profile)) {
+            return false;
+        }
+
+        hal_clock_virtual(true);
+
+        fs->asynchronous = asynchronous;
+
+        if (!bench_files(fs, true)) {
+            return false;
+        }
+
+        std::vector<uint32_t> latencies;
+        auto started = hal_clock_micros();
+
+        for (uint32_t i = 0; i < BENCH_APPENDS; ++i) {
+            auto file = (i % 4 == 0) ? FKFS_FILE_DATA : FKFS_FILE_LOG;
+            auto appendStarted = hal_clock_micros();
+            if (!fkfs_file_append(fs, file, 16 + i % 64, record)) {
+                fprintf(stderr, "error: Unable to append (%d)\n", i);
+                return false;
+            }
+            if (i % 32 == 0 && !fkfs_flush(fs)) {
+                return false;
+            }
+            if (!fkfs_poll(fs)) {
+                return false;
+            }
+            latencies.push_back(hal_clock_micros() - appendStarted);
+        }
+
+        if (!fkfs_flush(fs)) {
+            return false;
+        }
+
+        uint8_t status;
+        while ((status = fkfs_poll(fs)) == FKFS_PENDING) {
+        }
+        if (!status) {
+            return false;
+        }
+
+        auto appendTime = hal_clock_micros() - started;
+
+        std::sort(latencies.begin(), latencies.end());
+        auto p99 = latencies[latencies.size() * 99 / 100];
+        auto longest = latencies.back();
+
+        started = hal_clock_micros();
+        auto bytes = bench_iterate(fs, false);
+        auto iterateTime = hal_clock_micros() - started;
+
+        started = hal_clock_micros();
+        auto aheadBytes = bench_iterate(fs, true);
+        auto aheadTime = hal_clock_micros() - started;
+
+        uint32_t calls = 0;
+        uint32_t longestCall = 0;
+        auto budgetBytes = bench_iterate_budget(fs, 20, &calls, &longestCall);
+
+        if (aheadBytes != bytes || budgetBytes != bytes) {
+            fprintf(stderr, "error: Iterated %d, %d and %d bytes\n", bytes, aheadBytes, budgetBytes);
+            return false;
+        }
+
+        auto mode = asynchronous ? "async" : "sync";
+        printf("sim %-4s %-5s append %8.2fms (mean %6.0fus, p99 %6dus, max %7dus)\n", profile->name, mode,
+               appendTime / 1000.0, (double)appendTime / BENCH_APPENDS, p99, longest);
+        printf("sim %-4s %-5s iterate %7.1fKB/s read ahead %7.1fKB/s (%d bytes, %d calls of 20ms, longest %dms)\n",
+               profile->name, mode, bytes / 1.024 / iterateTime * 1000, aheadBytes / 1.024 / aheadTime * 1000,
+               bytes, calls, longestCall);
+        fkfs_device_sim_log_statistics(&fs->device);
+        fkfs_device_sim_close(&fs->device);
+
+        hal_clock_virtual(false);
+    }
+
+    return true;
+}
+
+/**
+ * Fills a small card a few times over, truncating everything after each round
+ * as though it had been uploaded, and then idles. With erasing ahead the idle
+ * time is spent erasing so the appends after the wrap go to erased blocks.
+ */
+static bool run_erase(fkfs_t *fs, fkfs_device_ram_t *ram, const fkfs_device_sim_profile_t *profile) {
+    uint8_t record[120] = { 0 };
+    fkfs_device_t backing;
+    if (!fkfs_device_ram_open(&backing, ram, ram->memory, ram->numberOfBlocks)) {
+        return false;
+    }
+
+    for (auto eraseAhead : { 0u, BENCH_ERASE_AHEAD }) {
+        if (!fkfs_device_erase(&backing, 0, ram->numberOfBlocks - 1)) {
+            return false;
+        }
+
+        fkfs_device_sim_t sim;
+        if (!fkfs_device_sim_open(&fs->device, &sim, &backing, profile)) {
+            return false;
+        }
+
+        hal_clock_virtual(true);
+
+        fs->asynchronous = false;
+        fs->eraseAhead = eraseAhead;
+
+        if (!bench_files(fs, true)) {
+            return false;
+        }
+
+        std::vector<uint32_t> latencies;
+        uint64_t appendTime = 0;
+        uint64_t idleTime = 0;
+
+        for (uint32_t round = 0; round < BENCH_ERASE_ROUNDS; ++round) {
+            for (uint32_t i = 0; i < BENCH_ERASE_APPENDS; ++i) {
+                auto file = (i % 4 == 0) ? FKFS_FILE_DATA : FKFS_FILE_LOG;
+                auto appendStarted = hal_clock_micros();
+                if (!fkfs_file_append(fs, file, sizeof(record), record)) {
+                    fprintf(stderr, "error: Unable to append (%d, %d)\n", round, i);
+                    return false;
+                }
+                if (i % 32 == 0 && !fkfs_flush(fs)) {
+                    return false;
+                }
+                auto micros = hal_clock_micros() - appendStarted;
+                latencies.push_back(micros);
+                appendTime += micros;
+            }
+
+            if (!fkfs_file_truncate_all(fs) || !fkfs_flush(fs)) {
+                return false;
+            }
+
+            auto idleStarted = hal_clock_micros();
+            auto ahead = UINT32_MAX;
+            while (fkfs_erased_ahead(fs) != ahead) {
+                ahead = fkfs_erased_ahead(fs);
+                if (!fkfs_idle(fs)) {
+                    return false;
+                }
+            }
+            idleTime += hal_clock_micros() - idleStarted;
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        auto p99 = latencies[latencies.size() * 99 / 100];
+        auto longest = latencies.back();
+
+        printf("erase %-4s ahead %4d append %8.2fms (mean %6.0fus, p99 %6dus, max %7dus) idle %8.2fms\n",
+               profile->name, eraseAhead, appendTime / 1000.0, (double)appendTime / latencies.size(), p99, longest,
+               idleTime / 1000.0);
+        printf("erase %-4s ahead %4d erased=%d preserved=%d erased-writes=%d\n", profile->name, eraseAhead,
+               fs->statistics.erasedBlocks, fs->statistics.preservedBlocks, fs->statistics.erasedWrites);
+        fkfs_device_sim_log_statistics(&fs->device);
+        fkfs_device_sim_close(&fs->device);
+
+        hal_clock_virtual(false);
+    }
+
+    return true;
+}
+
+/**
+ * Writes an image with the fd device and then iterates it with io_uring at
+ * a range of queue depths. The image is read with O_DIRECT when possible so
+ * the page cache doesn't flatter the deeper queues.
+ */
+static bool run_depths(const char *path) {
+    {
+        fkfs_t fs;
+        fkfs_create(&fs);
+
+        fkfs_device_fd_t fd;
+        if (!fkfs_device_fd_open(&fs.device, &fd, path, BENCH_NUMBER_OF_BLOCKS)) {
+            return false;
+        }
+
+        auto success = bench_files(&fs, true) && bench_append(&fs);
+        fkfs_device_fd_close(&fs.device);
+        if (!success) {
+            return false;
+        }
+    }
+
+    for (auto depth : { 1, 2, 4, 8, 16, 32, 64 }) {
+        fkfs_t fs;
+        fkfs_create(&fs);
+
+        fkfs_device_uring_t uring;
+        if (!fkfs_device_uring_open(&fs.device, &uring, path, 0, depth, true)) {
+            return false;
+        }
+
+        if (!bench_files(&fs, false)) {
+            fkfs_device_uring_close(&fs.device);
+            return false;
+        }
+
+        auto started = bench_clock::now();
+        auto bytes = bench_iterate(&fs, false);
+        auto iterateTime = elapsed_ms(started);
+
+        printf("uring depth %2d iterate %8.2fms (%6d reads, %d bytes)\n", depth, iterateTime, fs.statistics.blockReads, bytes);
+        fkfs_device_uring_log_statistics(&fs.device);
+
+        fkfs_device_uring_close(&fs.device);
+    }
+
+    return true;
+}
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <ram|busy|cache|sync|spi|sim|erase|file|mmap|fd|uring|depths> [image|profile] [depth]\n", argv[0]);
+        return 2;
+    }
+
+    std::string backend = argv[1];
+    const char *path = argc > 2 ? argv[2] : "bench.img";
+
+    fkfs_t fs;
+    if (!fkfs_create(&fs)) {
+        return 2;
+    }
+
+    // Always start from an empty image, stale entries from a previous run
+    // would otherwise be picked up by the allocator.
+    if (backend != "ram" && backend != "busy" && backend != "cache" && backend != "sync" && backend != "spi" && backend != "sim" && backend != "erase") {
+        remove(path);
+    }
+
+    if (backend == "ram") {
+        std::vector<uint8_t> memory((size_t)BENCH_NUMBER_OF_BLOCKS * SD_RAW_BLOCK_SIZE);
+        fkfs_device_ram_t ram;
+        if (!fkfs_device_ram_open(&fs.device, &ram, memory.data(), BENCH_NUMBER_OF_BLOCKS)) {
+            return 2;
+        }
+        return run("ram", &fs) ? 0 : 2;
+    }
+    else if (backend == "busy") {
+        std::vector<uint8_t> memory((size_t)BENCH_NUMBER_OF_BLOCKS * SD_RAW_BLOCK_SIZE);
+        fkfs_device_ram_t ram;
+        if (!fkfs_device_ram_open(&fs.device, &ram, memory.data(), BENCH_NUMBER_OF_BLOCKS)) {
+            return 2;
+        }
+        return run_busy(&fs, &ram) ? 0 : 2;
+    }
+    else if (backend == "cache") {
+        std::vector<uint8_t> memory((size_t)BENCH_NUMBER_OF_BLOCKS * SD_RAW_BLOCK_SIZE);
+        fkfs_device_ram_t ram;
+        if (!fkfs_device_ram_open(&fs.device, &ram, memory.data(), BENCH_NUMBER_OF_BLOCKS)) {
+            return 2;
+        }
+        return run_cache(&fs) ? 0 : 2;
+    }
+    else if (backend == "sync") {
+        std::vector<uint8_t> memory((size_t)BENCH_NUMBER_OF_BLOCKS * SD_RAW_BLOCK_SIZE);
+        fkfs_device_ram_t ram;
+        if (!fkfs_device_ram_open(&fs.device, &ram, memory.data(), BENCH_NUMBER_OF_BLOCKS)) {
+            return 2;
+        }
+        return run_sync(&fs) ? 0 : 2;
+    }
+    else if (backend == "spi") {
+        std::vector<uint8_t> memory((size_t)BENCH_NUMBER_OF_BLOCKS * SD_RAW_BLOCK_SIZE);
+        fkfs_device_ram_t ram;
+        ram.memory = memory.data();
+        ram.numberOfBlocks = BENCH_NUMBER_OF_BLOCKS;
+        return run_spi(&fs, &ram) ? 0 : 2;
+    }
+    else if (backend == "sim") {
+        std::vector<uint8_t> memory((size_t)BENCH_NUMBER_OF_BLOCKS * SD_RAW_BLOCK_SIZE);
+        fkfs_device_ram_t ram;
+        ram.memory = memory.data();
+        ram.numberOfBlocks = BENCH_NUMBER_OF_BLOCKS;
+        for (auto profile = fkfs_device_sim_profiles; profile->name != nullptr; ++profile) {
+            if (argc > 2 && strcmp(argv[2], profile->name) != 0) {
+                continue;
+            }
+            if (!run_sim(&fs, &ram, profile)) {
+                return 2;
+            }
+        }
+        return 0;
+    }
+    else if (backend == "erase") {
+        std::vector<uint8_t> memory((size_t)BENCH_ERASE_NUMBER_OF_BLOCKS * SD_RAW_BLOCK_SIZE);
+        fkfs_device_ram_t ram;
+        ram.memory = memory.data();
+        ram.numberOfBlocks = BENCH_ERASE_NUMBER_OF_BLOCKS;
+        for (auto profile = fkfs_device_sim_profiles; profile->name != nullptr; ++profile) {
+            if (argc > 2 && strcmp(argv[2], profile->name) != 0) {
+                continue;
+            }
+            if (!run_erase(&fs, &ram, profile)) {
+                return 2;
+            }
+        }
+        return 0;
+    }
+    else if (backend == "file") {
+        // The file device is as large as the image, so it's sized first.
+        fkfs_device_fd_t fd;
+        if (!fkfs_device_fd_open(&fs.device, &fd, path, BENCH_NUMBER_OF_BLOCKS) || !fkfs_device_fd_close(&fs.device)) {
+            fprintf(stderr, "error: Unable to open file.\n");
+            return 2;
+        }
+
+        fkfs_device_file_t file;
+        if (!fkfs_device_file_open(&fs.device, &file, path)) {
+            fprintf(stderr, "error: Unable to open file.\n");
+            return 2;
+        }
+        auto success = run("file", &fs);
+        fkfs_device_file_close(&fs.device);
+        return success ? 0 : 2;
+    }
+    else if (backend == "mmap") {
+        fkfs_device_mmap_t mm;
+        if (!fkfs_device_mmap_open(&fs.device, &mm, path, BENCH_NUMBER_OF_BLOCKS)) {
+            fprintf(stderr, "error: Unable to open file.\n");
+            return 2;
+        }
+        auto success = run("mmap", &fs);
+        fkfs_device_mmap_close(&fs.device);
+        return success ? 0 : 2;
+    }
+    else if (backend == "fd") {
+        fkfs_device_fd_t fd;
+        if (!fkfs_device_fd_open(&fs.device, &fd, path, BENCH_NUMBER_OF_BLOCKS)) {
+            fprintf(stderr, "error: Unable to open file.\n");
+            return 2;
+        }
+        auto success = run("fd", &fs);
+        fkfs_device_fd_log_statistics(&fs.device);
+        fkfs_device_fd_close(&fs.device);
+        return success ? 0 : 2;
+    }
+
+    else if (backend == "uring") {
+        fkfs_device_uring_t uring;
+        auto depth = argc > 3 ? atoi(argv[3]) : 0;
+        if (!fkfs_device_uring_open(&fs.device, &uring, path, BENCH_NUMBER_OF_BLOCKS, depth, false)) {
+            fprintf(stderr, "error: Unable to open file.\n");
+            return 2;
+        }
+        auto success = run("uring", &fs);
+        fkfs_device_uring_log_statistics(&fs.device);
+        success = fkfs_device_uring_close(&fs.device) && success;
+        return success ? 0 : 2;
+    }
+    else if (backend == "depths") {
+        return run_depths(path) ? 0 : 2;
+    }
+
+    fprintf(stderr, "error: Unknown backend %s\n", backend.c_str());
+
+    return 2;
+}
@@ -0,0 +1,337 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "hal.h"
+#include "fkfs_device_sim.h"
+
+static constexpr uint32_t FKFS_DEVICE_SIM_NO_BLOCK = UINT32_MAX;
+static constexpr uint32_t FKFS_DEVICE_SIM_POLL_MICROS = 5;
+static constexpr uint32_t FKFS_DEVICE_SIM_SEED = 1;
+
+// Bytes on the bus for a block, besides the data: start token and CRC.
+static constexpr uint32_t FKFS_DEVICE_SIM_BLOCK_BYTES = SD_RAW_BLOCK_SIZE + 3;
+
+const fkfs_device_sim_profile_t fkfs_device_sim_profiles[] = {
+    // A decent card with the bus at 12MHz.
+    {
+        .name = "fast",
+        .commandMicros = 20,
+        .byteNanos = 670,
+        .accessMicros = 100,
+        .programMicros = 250,
+        .streamMicros = 60,
+        .eraseMicros = 2000,
+        .eraseBlockNanos = 10,
+        .gcInterval = 2000,
+        .gcMicros = 40000,
+        .auBlocks = 8192,
+        .auMergeMicros = 100000,
+        .overwriteMicros = 1500,
+    },
+    // A cheap card with the bus at 4MHz, slow to program and prone to stalls.
+    {
+        .name = "slow",
+        .commandMicros = 40,
+        .byteNanos = 2000,
+        .accessMicros = 400,
+        .programMicros = 1500,
+        .streamMicros = 500,
+        .eraseMicros = 20000,
+        .eraseBlockNanos = 50,
+        .gcInterval = 300,
+        .gcMicros = 250000,
+        .auBlocks = 8192,
+        .auMergeMicros = 400000,
+        .overwriteMicros = 6000,
+    },
+    {
+        .name = nullptr,
+    },
+};
+
+const fkfs_device_sim_profile_t *fkfs_device_sim_profile(const char *name) {
+    for (auto profile = fkfs_device_sim_profiles; profile->name != nullptr; ++profile) {
+        if (strcmp(profile->name, name) == 0) {
+            return profile;
+        }
+    }
+    return nullptr;
+}
+
+static void fkfs_device_sim_spend(fkfs_device_sim_t *sim, uint64_t micros) {
+    hal_clock_advance(micros);
+    sim->statistics.transferMicros += micros;
+}
+
+static void fkfs_device_sim_transfer(fkfs_device_sim_t *sim, uint32_t bytes) {
+    fkfs_device_sim_spend(sim, (uint64_t)bytes * sim->profile->byteNanos / 1000);
+}
+
+static void fkfs_device_sim_command(fkfs_device_sim_t *sim) {
+    sim->statistics.commands++;
+    fkfs_device_sim_spend(sim, sim->profile->commandMicros);
+}
+
+// Finishes the block a partial read left open, clocking out the rest of it.
+static uint8_t fkfs_device_sim_read_end(void *ctx) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+    if (sim->openBlock != FKFS_DEVICE_SIM_NO_BLOCK) {
+        fkfs_device_sim_transfer(sim, SD_RAW_BLOCK_SIZE - sim->openOffset + 2);
+        sim->openBlock = FKFS_DEVICE_SIM_NO_BLOCK;
+    }
+    return true;
+}
+
+// Waits out any programming and gets the bus ready for another command.
+static void fkfs_device_sim_wait(fkfs_device_sim_t *sim) {
+    auto now = hal_clock_micros();
+    if (now < sim->busyUntil) {
+        hal_clock_advance(sim->busyUntil - now);
+        sim->statistics.waitMicros += sim->busyUntil - now;
+    }
+    fkfs_device_sim_read_end(sim);
+}
+
+static void fkfs_device_sim_program(fkfs_device_sim_t *sim, uint32_t number) {
+    uint64_t micros = sim->profile->programMicros + (uint64_t)(number - 1) * sim->profile->streamMicros;
+
+    for (uint32_t i = 0; i < number; ++i) {
+        sim->seed = sim->seed * 1103515245 + 12345;
+        if (sim->profile->gcInterval > 0 && (sim->seed >> 16) % sim->profile->gcInterval == 0) {
+            micros += sim->profile->gcMicros;
+            sim->statistics.gcStalls++;
+        }
+    }
+
+    sim->busyUntil = hal_clock_micros() + micros;
+}
+
+// Tracks the allocation units being written, returning any merge stall for the
+// unit that has to be closed to open this one.
+static uint64_t fkfs_device_sim_allocation(fkfs_device_sim_t *sim, uint32_t block, uint32_t number) {
+    auto au = block / sim->profile->auBlocks;
+    auto start = au * sim->profile->auBlocks;
+    uint64_t micros = 0;
+
+    fkfs_device_sim_au_t *open = nullptr;
+    for (uint8_t i = 0; i < FKFS_DEVICE_SIM_OPEN_AUS; ++i) {
+        if (sim->aus[i].au == au) {
+            open = &sim->aus[i];
+            break;
+        }
+    }
+
+    if (open == nullptr) {
+        open = &sim->aus[0];
+        for (uint8_t i = 1; i < FKFS_DEVICE_SIM_OPEN_AUS; ++i) {
+            if (sim->aus[i].used < open->used) {
+                open = &sim->aus[i];
+            }
+        }
+        if (open->au != FKFS_DEVICE_SIM_NO_BLOCK && (!open->sequential || open->next != (open->au + 1) * sim->profile->auBlocks)) {
+            micros = sim->profile->auMergeMicros;
+            sim->statistics.auMerges++;
+        }
+        open->au = au;
+        open->next = start;
+        open->sequential = true;
+    }
+
+    if (block != open->next) {
+        open->sequential = false;
+    }
+    open->next = block + number;
+    open->used = ++sim->auClock;
+
+    return micros;
+}
+
+// Marks the blocks as programmed, returning the cost of those that weren't
+// erased beforehand.
+static uint64_t fkfs_device_sim_overwrite(fkfs_device_sim_t *sim, uint32_t block, uint32_t number) {
+    uint64_t micros = 0;
+
+    for (uint32_t i = block; i < block + number; ++i) {
+        auto mask = (uint8_t)(1 << (i % 8));
+        if ((sim->programmed[i / 8] & mask) && i >= sim->profile->auBlocks) {
+            micros += sim->profile->overwriteMicros;
+            sim->statistics.overwrites++;
+        }
+        sim->programmed[i / 8] |= mask;
+    }
+
+    return micros;
+}
+
+static uint8_t fkfs_device_sim_read_blocks(void *ctx, uint32_t block, uint32_t number, uint8_t *destiny) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+
+    fkfs_device_sim_wait(sim);
+    fkfs_device_sim_command(sim);
+    for (uint32_t i = 0; i < number; ++i) {
+        fkfs_device_sim_spend(sim, sim->profile->accessMicros);
+        fkfs_device_sim_transfer(sim, FKFS_DEVICE_SIM_BLOCK_BYTES);
+    }
+    if (number > 1) {
+        fkfs_device_sim_command(sim);
+    }
+
+    return fkfs_device_read_blocks(sim->backing, block, number, destiny);
+}
+
+static uint8_t fkfs_device_sim_read_block(void *ctx, uint32_t block, uint8_t *destiny) {
+    return fkfs_device_sim_read_blocks(ctx, block, 1, destiny);
+}
+
+static uint8_t fkfs_device_sim_read_partial(void *ctx, uint32_t block, uint16_t offset, uint16_t size, uint8_t *destiny) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+
+    if (block == sim->openBlock && offset >= sim->openOffset) {
+        fkfs_device_sim_transfer(sim, offset - sim->openOffset + size);
+    }
+    else {
+        fkfs_device_sim_wait(sim);
+        fkfs_device_sim_command(sim);
+        fkfs_device_sim_spend(sim, sim->profile->accessMicros);
+        fkfs_device_sim_transfer(sim, 1 + offset + size);
+    }
+
+    sim->openBlock = block;
+    sim->openOffset = offset + size;
+    if (sim->openOffset >= SD_RAW_BLOCK_SIZE) {
+        fkfs_device_sim_read_end(sim);
+    }
+
+    return fkfs_device_read_partial(sim->backing, block, offset, size, destiny);
+}
+
+static uint8_t fkfs_device_sim_write_start(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+
+    fkfs_device_sim_wait(sim);
+    fkfs_device_sim_command(sim);
+    fkfs_device_sim_transfer(sim, number * FKFS_DEVICE_SIM_BLOCK_BYTES);
+    fkfs_device_sim_program(sim, number);
+    sim->busyUntil += fkfs_device_sim_allocation(sim, block, number);
+    sim->busyUntil += fkfs_device_sim_overwrite(sim, block, number);
+
+    // The data's been sent, so the source is free once we return.
+    return fkfs_device_write_blocks(sim->backing, block, number, source);
+}
+
+static uint8_t fkfs_device_sim_poll(void *ctx) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+
+    if (hal_clock_micros() < sim->busyUntil) {
+        sim->statistics.busyPolls++;
+        hal_clock_advance(sim->pollMicros);
+        return FKFS_DEVICE_BUSY;
+    }
+
+    return FKFS_DEVICE_READY;
+}
+
+static uint8_t fkfs_device_sim_write_blocks(void *ctx, uint32_t block, uint32_t number, const uint8_t *source) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+
+    if (!fkfs_device_sim_write_start(ctx, block, number, source)) {
+        return false;
+    }
+
+    fkfs_device_sim_wait(sim);
+
+    return true;
+}
+
+static uint8_t fkfs_device_sim_write_block(void *ctx, uint32_t block, const uint8_t *source) {
+    return fkfs_device_sim_write_blocks(ctx, block, 1, source);
+}
+
+static uint8_t fkfs_device_sim_erase(void *ctx, uint32_t firstBlock, uint32_t lastBlock) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+
+    fkfs_device_sim_wait(sim);
+
+    // CMD32, CMD33 and CMD38.
+    for (uint8_t i = 0; i < 3; ++i) {
+        fkfs_device_sim_command(sim);
+    }
+
+    uint64_t blocks = lastBlock - firstBlock + 1;
+    sim->busyUntil = hal_clock_micros() + sim->profile->eraseMicros + blocks * sim->profile->eraseBlockNanos / 1000;
+
+    fkfs_device_sim_wait(sim);
+
+    for (uint32_t i = firstBlock; i <= lastBlock; ++i) {
+        sim->programmed[i / 8] &= ~(1 << (i % 8));
+    }
+
+    return fkfs_device_erase(sim->backing, firstBlock, lastBlock);
+}
+
+static uint32_t fkfs_device_sim_size(void *ctx) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+    return fkfs_device_size(sim->backing);
+}
+
+static uint8_t fkfs_device_sim_flush(void *ctx) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+    fkfs_device_sim_wait(sim);
+    return fkfs_device_flush(sim->backing);
+}
+
+static uint32_t fkfs_device_sim_allocation_unit(void *ctx) {
+    auto sim = (fkfs_device_sim_t *)ctx;
+    return sim->profile->auBlocks;
+}
+
+static const fkfs_device_ops_t fkfs_device_sim_ops = {
+    .read_block = fkfs_device_sim_read_block,
+    .write_block = fkfs_device_sim_write_block,
+    .erase = fkfs_device_sim_erase,
+    .size = fkfs_device_sim_size,
+    .flush = fkfs_device_sim_flush,
+    .read_blocks = fkfs_device_sim_read_blocks,
+    .write_blocks = fkfs_device_sim_write_blocks,
+    .read_partial = fkfs_device_sim_read_partial,
+    .read_end = fkfs_device_sim_read_end,
+    .write_start = fkfs_device_sim_write_start,
+    .poll = fkfs_device_sim_poll,
+    .allocation_unit = fkfs_device_sim_allocation_unit,
+};
+
+uint8_t fkfs_device_sim_open(fkfs_device_t *dev, fkfs_device_sim_t *sim, fkfs_device_t *backing, const fkfs_device_sim_profile_t *profile) {
+    memset(sim, 0, sizeof(fkfs_device_sim_t));
+    sim->backing = backing;
+    sim->profile = profile;
+    sim->pollMicros = FKFS_DEVICE_SIM_POLL_MICROS;
+    sim->seed = FKFS_DEVICE_SIM_SEED;
+    sim->openBlock = FKFS_DEVICE_SIM_NO_BLOCK;
+    for (uint8_t i = 0; i < FKFS_DEVICE_SIM_OPEN_AUS; ++i) {
+        sim->aus[i].au = FKFS_DEVICE_SIM_NO_BLOCK;
+    }
+    // Starts out erased, like a new card.
+    sim->programmed = (uint8_t *)calloc((fkfs_device_size(backing) + 7) / 8, 1);
+    if (sim->programmed == nullptr) {
+        return false;
+    }
+
+    dev->ops = &fkfs_device_sim_ops;
+    dev->ctx = sim;
+
+    return true;
+}
+
+void fkfs_device_sim_close(fkfs_device_t *dev) {
+    auto sim = (fkfs_device_sim_t *)dev->ctx;
+    free(sim->programmed);
+    sim->programmed = nullptr;
+}
+
+void fkfs_device_sim_log_statistics(fkfs_device_t *dev) {
+    auto sim = (fkfs_device_sim_t *)dev->ctx;
+    printf("sim: commands=%d gc=%d merges=%d overwrites=%d polls=%d transfer=%lluus wait=%lluus\n",
+           sim->statistics.commands, sim->statistics.gcStalls, sim->statistics.auMerges, sim->statistics.overwrites,
+           sim->statistics.busyPolls,
+           (unsigned long long)sim->statistics.transferMicros, (unsigned long long)sim->statistics.waitMicros);
+}
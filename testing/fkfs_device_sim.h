@@ -0,0 +1,89 @@
+#pragma once
+
+#include "fkfs_device.h"
+
+/**
+ * Latency model of a card on the end of an SPI bus. Times are in
+ * microseconds, except for the per byte and per erased block costs which are
+ * in nanoseconds.
+ *
+ * Every command costs commandMicros and reads wait accessMicros before the
+ * data starts. Each block written keeps the card busy programming for
+ * programMicros, or streamMicros for the blocks after the first of a multiple
+ * block write. Roughly one in every gcInterval writes is followed by a garbage
+ * collection stall of gcMicros.
+ *
+ * The card keeps FKFS_DEVICE_SIM_OPEN_AUS allocation units of auBlocks open
+ * for writing. Moving on from one that wasn't written start to finish in order
+ * makes the card merge it, a stall of auMergeMicros.
+ *
+ * Blocks written again without being erased first cost overwriteMicros more
+ * to program, the card has to erase them itself. The first allocation unit is
+ * spared, cards expect small writes there (that's where a FAT goes).
+ */
+typedef struct fkfs_device_sim_profile_t {
+    const char *name;
+    uint32_t commandMicros;
+    uint32_t byteNanos;
+    uint32_t accessMicros;
+    uint32_t programMicros;
+    uint32_t streamMicros;
+    uint32_t eraseMicros;
+    uint32_t eraseBlockNanos;
+    uint32_t gcInterval;
+    uint32_t gcMicros;
+    uint32_t auBlocks;
+    uint32_t auMergeMicros;
+    uint32_t overwriteMicros;
+} fkfs_device_sim_profile_t;
+
+extern const fkfs_device_sim_profile_t fkfs_device_sim_profiles[];
+
+const fkfs_device_sim_profile_t *fkfs_device_sim_profile(const char *name);
+
+typedef struct fkfs_device_sim_statistics_t {
+    uint32_t commands;
+    uint32_t gcStalls;
+    uint32_t busyPolls;
+    uint32_t auMerges;
+    uint32_t overwrites;
+    uint64_t transferMicros;
+    uint64_t waitMicros;
+} fkfs_device_sim_statistics_t;
+
+/**
+ * Wraps another device, usually a RAM disk, and advances the virtual clock (see
+ * hal_clock_virtual) by the time each operation would take on the card. Writes
+ * started with write_start return once the data is sent and the card then
+ * programs in the background, polling costs pollMicros each time. Anything
+ * else waits for the card first. The garbage collection stalls come from a
+ * fixed seed so runs repeat exactly.
+ */
+constexpr uint8_t FKFS_DEVICE_SIM_OPEN_AUS = 2;
+
+typedef struct fkfs_device_sim_au_t {
+    uint32_t au;
+    uint32_t next;
+    uint8_t sequential;
+    uint32_t used;
+} fkfs_device_sim_au_t;
+
+typedef struct fkfs_device_sim_t {
+    fkfs_device_t *backing;
+    const fkfs_device_sim_profile_t *profile;
+    uint32_t pollMicros;
+    uint64_t busyUntil;
+    uint32_t seed;
+    uint32_t openBlock;
+    uint16_t openOffset;
+    fkfs_device_sim_au_t aus[FKFS_DEVICE_SIM_OPEN_AUS];
+    uint32_t auClock;
+    uint8_t *programmed;
+    fkfs_device_sim_statistics_t statistics;
+} fkfs_device_sim_t;
+
+uint8_t fkfs_device_sim_open(fkfs_device_t *dev, fkfs_device_sim_t *sim, fkfs_device_t *backing, const fkfs_device_sim_profile_t *profile);
+
+void fkfs_device_sim_close(fkfs_device_t *dev);
+
+void fkfs_device_sim_log_statistics(fkfs_device_t *dev);
@@ -1,14 +1,7 @@
-#ifdef __linux__
-#include <linux/unistd.h>       /* for _syscallX macros/related stuff */
-#include <linux/kernel.h>       /* for struct sysinfo */
-#include <sys/sysinfo.h>
-#endif
-#ifdef __APPLE__
-#include <sys/sysctl.h>
-#endif
+#include <chrono>
 
 #include "hal.h"
-#include "sd_raw.h"
+#include "SPI.h"
 
 void FakeSerial::print(const char *str) {
     puts(str);
@@ -16,116 +9,45 @@ void FakeSerial::print(const char *str) {
 
 FakeSerial Serial;
 
-struct sd_raw_file_t {
-    FILE *fp;
-};
+static bool clockVirtual = false;
+static uint64_t clockMicros = 0;
 
-#ifdef __linux__
-uint32_t millis() {
-    struct sysinfo s_info;
-    auto error = sysinfo(&s_info);
-    return s_info.uptime;
+uint32_t micros() {
+    if (clockVirtual) {
+        return (uint32_t)clockMicros;
+    }
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now).count();
 }
-#endif
 
-#ifdef __APPLE__
 uint32_t millis() {
-    struct timeval ts;
-    size_t length = sizeof(ts);
-    int32_t mib[2] = { CTL_KERN, KERN_BOOTTIME };
-    if (sysctl(mib, 2, &ts, &length, NULL, 0) == 0) {
-        return static_cast<unsigned long long>(ts.tv_sec) * 1000ULL +
-               static_cast<unsigned long long>(ts.tv_usec) / 1000ULL;
+    if (clockVirtual) {
+        return (uint32_t)(clockMicros / 1000);
     }
-    return 0;
-}
-#endif
-
-uint32_t random(uint32_t max) {
-    return rand() % max;
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
 }
 
-sd_raw_file_t *sd_raw_file(sd_raw_t *sd) {
-    return (sd_raw_file_t *)sd;
+void hal_clock_virtual(bool enabled) {
+    clockVirtual = enabled;
+    clockMicros = 0;
 }
 
-uint8_t sd_raw_file_initialize(sd_raw_t *sd, const char *path) {
-    auto sdf = sd_raw_file(sd);
-    sdf->fp = fopen(path, "r+b");
-    if (sdf->fp == nullptr) {
-        sdf->fp = fopen(path, "w+b");
-        if (sdf->fp == nullptr) {
-            return false;
-        }
-    }
-
-    return true;
+void hal_clock_advance(uint64_t micros) {
+    clockMicros += micros;
 }
 
-uint8_t sd_raw_file_close(sd_raw_t *sd) {
-    auto sdf = sd_raw_file(sd);
-    fclose(sdf->fp);
-    return true;
+uint64_t hal_clock_micros() {
+    return clockMicros;
 }
 
-uint8_t sd_raw_read_block(sd_raw_t *sd, uint32_t block, uint8_t *destiny) {
-    auto sdf = sd_raw_file(sd);
-
-    if (fseek(sdf->fp, 0, SEEK_END) != 0) {
-        fprintf(stderr, "error: Unable to seek to block %d\n", block);
-        return false;
-    }
-
-    auto lengthOfFile = ftell(sdf->fp);
-    auto position = SD_RAW_BLOCK_SIZE * block;
-
-    if (position + SD_RAW_BLOCK_SIZE > lengthOfFile) {
-        return true;
-    }
-
-    if (fseek(sdf->fp, position, SEEK_SET) != 0) {
-        fprintf(stderr, "error: Unable to seek to block %d\n", block);
-        return false;
-    }
-
-    if (fread(destiny, 1, SD_RAW_BLOCK_SIZE, sdf->fp) != SD_RAW_BLOCK_SIZE) {
-        fprintf(stderr, "error: Unable to read block %d\n", block);
-        return false;
-    }
-    return true;
-}
-
-uint8_t sd_raw_write_block(sd_raw_t *sd, uint32_t block, const uint8_t *source) {
-    auto sdf = sd_raw_file(sd);
-
-    if (fseek(sdf->fp, 0, SEEK_END) != 0) {
-        fprintf(stderr, "error: Unable to seek to block %d\n", block);
-        return false;
-    }
-
-    auto lengthOfFile = ftell(sdf->fp);
-    auto position = SD_RAW_BLOCK_SIZE * block;
-
-    printf("writing %d\n", block);
-
-    if (fseek(sdf->fp, position, SEEK_SET) != 0) {
-        fprintf(stderr, "error: Unable to seek to block %d\n", block);
-        return false;
-    }
-
-    if (fwrite(source, 1, SD_RAW_BLOCK_SIZE, sdf->fp) != SD_RAW_BLOCK_SIZE) {
-        fprintf(stderr, "error: Unable to write block %d\n", block);
-        return false;
-    }
-    return true;
+uint32_t random(uint32_t max) {
+    return rand() % max;
 }
 
-uint32_t sd_raw_card_size(sd_raw_t *sd) {
-    auto sdf = sd_raw_file(sd);
-    return 0;
+void pinMode(uint8_t pin, uint8_t mode) {
 }
 
-uint8_t sd_raw_erase(sd_raw_t *sd, uint32_t firstBlock, uint32_t lastBlock) {
-    auto sdf = sd_raw_file(sd);
-    return 0;
+void digitalWrite(uint8_t pin, uint8_t level) {
+    SPI.chipSelect(pin, level);
 }
@@ -5,8 +5,6 @@
 #include <cstddef>
 #include <cstdint>
 
-#include "sd_raw.h"
-
 class FakeSerial {
 public:
     void print(const char *str);
@@ -16,8 +14,25 @@ extern FakeSerial Serial;
 
 uint32_t millis();
 
-uint32_t random(uint32_t max);
+uint32_t micros();
+
+// Switches millis() and micros() over to a virtual clock, starting at zero,
+// that only moves when it's advanced. Simulated devices advance it by the time
+// their operations would take, so runs are deterministic.
+void hal_clock_virtual(bool enabled);
+
+void hal_clock_advance(uint64_t micros);
 
-uint8_t sd_raw_file_initialize(sd_raw_t *sd, const char *path);
+uint64_t hal_clock_micros();
 
-uint8_t sd_raw_file_close(sd_raw_t *sd);
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+
+void pinMode(uint8_t pin, uint8_t mode);
+
+// Chip selects are passed along to the SPI mock.
+void digitalWrite(uint8_t pin, uint8_t level);
+
+uint32_t random(uint32_t max);
@@ -7,6 +7,7 @@
 #include "Arduino.h"
 #include "sd_raw.h"
 #include "fkfs.h"
+#include "fkfs_device_host.h"
 
 static constexpr uint8_t FKFS_FILE_LOG = 0;
 static constexpr uint8_t FKFS_FILE_DATA = 1;
@@ -18,6 +19,8 @@ int extract(fkfs_t *fs, uint8_t id, std::string filename, bool verbose) {
     fkfs_iterator_config_t config = {
         .maxBlocks = UINT32_MAX,
         .maxTime = 0,
+        .manualNext = false,
+        .readAhead = true,
     };
 
     auto fp = fopen(filename.c_str(), "w");
@@ -47,8 +50,21 @@ int extract(fkfs_t *fs, uint8_t id, std::string filename, bool verbose) {
 }
 
 int main(int argc, const char **argv) {
+    // Cards in USB readers are best read with --direct, which reads large
+    // extents and bypasses the page cache. Optionally give the extent in MiB.
+    uint32_t windowMiB = 0;
+    auto direct = false;
+    if (argc > 1 && strncmp(argv[1], "--direct", 8) == 0) {
+        direct = true;
+        if (argv[1][8] == '=') {
+            windowMiB = atoi(argv[1] + 9);
+        }
+        argc--;
+        argv++;
+    }
+
     if (argc != 3) {
-        fprintf(stderr, "Usage: %s <image> <directory>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--direct[=MiB]] <image> <directory>\n", argv[0]);
         return 2;
     }
 
@@ -57,9 +73,22 @@ int main(int argc, const char **argv) {
         return 2;
     }
 
-    if (!sd_raw_file_initialize(&fs.sd, argv[1])) {
-        fprintf(stderr, "error: Unable to open file.\n");
-        return 2;
+    fs.readOnly = true;
+
+    fkfs_device_fd_t image;
+    fkfs_device_direct_t card;
+    if (direct) {
+        auto windowBlocks = windowMiB * 1024 * 1024 / SD_RAW_BLOCK_SIZE;
+        if (!fkfs_device_direct_open(&fs.device, &card, argv[1], windowBlocks, fs.readOnly)) {
+            fprintf(stderr, "error: Unable to open device.\n");
+            return 2;
+        }
+    }
+    else {
+        if (!fkfs_device_fd_open(&fs.device, &image, argv[1], 0)) {
+            fprintf(stderr, "error: Unable to open file.\n");
+            return 2;
+        }
     }
 
     if (!fkfs_initialize_file(&fs, FKFS_FILE_LOG, FKFS_FILE_PRIORITY_LOWEST, true, "FK.LOG")) {
@@ -92,7 +121,14 @@ int main(int argc, const char **argv) {
         return 2;
     }
 
-    sd_raw_file_close(&fs.sd);
+    if (direct) {
+        fkfs_device_direct_log_statistics(&fs.device);
+        fkfs_device_direct_close(&fs.device);
+    }
+    else {
+        fkfs_device_fd_log_statistics(&fs.device);
+        fkfs_device_fd_close(&fs.device);
+    }
 
     return 0;
 }
@@ -0,0 +1,383 @@
+#include <cstring>
+
+#include "sd_card.h"
+#include "sd_raw_internal.h"
+
+enum {
+    SD_CARD_STATE_IDLE,
+    SD_CARD_STATE_COMMAND,
+    SD_CARD_STATE_READING,
+    SD_CARD_STATE_WRITE_TOKEN,
+    SD_CARD_STATE_WRITE_MULTIPLE_TOKEN,
+    SD_CARD_STATE_RECEIVING,
+    SD_CARD_STATE_RECEIVING_MULTIPLE,
+};
+
+static uint8_t const SD_CARD_R1_ERASE_SEQUENCE_ERROR = 0x10;
+static uint8_t const SD_CARD_R1_ADDRESS_ERROR = 0x20;
+static uint32_t const SD_CARD_DEFAULT_PROGRAMMING_DELAY = 1;
+static uint32_t const SD_CARD_DEFAULT_ERASE_DELAY = 1;
+static uint8_t const SD_CARD_DEFAULT_AU_SIZE = 9;
+static uint8_t const SD_CARD_SPEED_CLASS_10 = 4;
+static uint8_t const SD_CARD_R2_CARD_ECC_FAILED = 0x10;
+
+static void sd_card_respond(sd_card_t *card, const uint8_t *data, uint16_t size) {
+    memcpy(card->out + card->outLength, data, size);
+    card->outLength += size;
+}
+
+static void sd_card_respond_r1(sd_card_t *card, uint8_t status) {
+    // The card takes a byte (NCR) before answering.
+    uint8_t response[] = { 0xff, (uint8_t)(status | (card->idle ? R1_IDLE_STATE : 0)) };
+    card->outLength = 0;
+    card->outPosition = 0;
+    sd_card_respond(card, response, sizeof(response));
+}
+
+static void sd_card_respond_data(sd_card_t *card, const uint8_t *data, uint16_t size) {
+    uint8_t header[] = { 0xff, DATA_START_BLOCK };
+    uint16_t value = sd_raw_crc16(0, data, size);
+    uint8_t crc[] = { (uint8_t)(value >> 8), (uint8_t)value };
+
+    sd_card_respond(card, header, sizeof(header));
+    sd_card_respond(card, data, size);
+    sd_card_respond(card, crc, sizeof(crc));
+
+    if (card->corrupt) {
+        card->out[card->outLength - size - 2] ^= 0x10;
+        card->corrupt = false;
+    }
+}
+
+static uint8_t sd_card_respond_block(sd_card_t *card) {
+    uint8_t data[SD_RAW_BLOCK_SIZE];
+
+    if (!fkfs_device_read_block(card->dev, card->block, data)) {
+        return false;
+    }
+
+    sd_card_respond_data(card, data, sizeof(data));
+
+    card->statistics.blocksRead++;
+    card->block++;
+
+    return true;
+}
+
+static void sd_card_csd(sd_card_t *card, uint8_t *csd) {
+    uint32_t blocks = fkfs_device_size(card->dev);
+
+    memset(csd, 0, 16);
+    csd[5] = 0x09;         // READ_BL_LEN, 512 bytes
+    csd[10] = 0x40 | 0x3f; // ERASE_BLK_EN, SECTOR_SIZE
+    csd[11] = 0x80;
+    csd[15] = 0x01;
+
+    if (card->highCapacity) {
+        // Version 2, C_SIZE counts 512KB (1024 block) units.
+        uint32_t size = blocks / 1024 - 1;
+        csd[0] = 0x40;
+        csd[7] = (size >> 16) & 0x3f;
+        csd[8] = size >> 8;
+        csd[9] = size;
+    }
+    else {
+        // Version 1, with C_SIZE_MULT of 7 C_SIZE counts 512 block units.
+        uint32_t size = blocks / 512 - 1;
+        uint8_t multiplier = 7;
+        csd[6] = (size >> 10) & 0x03;
+        csd[7] = size >> 2;
+        csd[8] = (size & 0x03) << 6;
+        csd[9] = multiplier >> 1;
+        csd[10] |= (multiplier & 0x01) << 7;
+    }
+}
+
+static uint8_t sd_card_address(sd_card_t *card, uint32_t arg, uint32_t *block) {
+    *block = card->highCapacity ? arg : arg >> 9;
+    if (*block >= fkfs_device_size(card->dev)) {
+        sd_card_respond_r1(card, SD_CARD_R1_ADDRESS_ERROR);
+        card->state = SD_CARD_STATE_IDLE;
+        return false;
+    }
+    return true;
+}
+
+static void sd_card_command(sd_card_t *card) {
+    uint8_t command = card->command[0] & 0x3f;
+    uint32_t arg = ((uint32_t)card->command[1] << 24) | ((uint32_t)card->command[2] << 16) |
+                   ((uint32_t)card->command[3] << 8) | (uint32_t)card->command[4];
+    uint8_t appCommand = card->appCommand;
+
+    card->appCommand = false;
+    card->state = SD_CARD_STATE_IDLE;
+    card->statistics.commands++;
+
+    // CMD0 and CMD8 are always checked.
+    if (card->crc || command == CMD0 || command == CMD8) {
+        if (sd_raw_crc7(card->command, 5) != card->command[5]) {
+            card->statistics.crcErrors++;
+            sd_card_respond_r1(card, R1_COM_CRC_ERROR);
+            return;
+        }
+    }
+
+    if (appCommand && command == ACMD41) {
+        card->idle = false;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        return;
+    }
+
+    if (appCommand && command == ACMD13) {
+        uint8_t r2[] = { 0x00 };
+        uint8_t status[SD_RAW_STATUS_SIZE] = { 0 };
+        status[8] = SD_CARD_SPEED_CLASS_10;
+        status[10] = card->auSize << 4;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        sd_card_respond(card, r2, sizeof(r2));
+        sd_card_respond_data(card, status, sizeof(status));
+        return;
+    }
+
+    if (appCommand && command == ACMD23) {
+        card->statistics.preErases++;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        return;
+    }
+
+    switch (command) {
+    case CMD0: {
+        card->idle = true;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        break;
+    }
+    case CMD8: {
+        uint8_t r7[] = { 0x00, 0x00, 0x01, (uint8_t)arg };
+        sd_card_respond_r1(card, R1_READY_STATE);
+        sd_card_respond(card, r7, sizeof(r7));
+        break;
+    }
+    case CMD55: {
+        card->appCommand = true;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        break;
+    }
+    case CMD58: {
+        // Powered up, and high capacity when we are.
+        uint8_t ocr[] = { (uint8_t)(card->highCapacity ? 0xc0 : 0x80), 0xff, 0x80, 0x00 };
+        sd_card_respond_r1(card, R1_READY_STATE);
+        sd_card_respond(card, ocr, sizeof(ocr));
+        break;
+    }
+    case CMD13: {
+        uint8_t r2[] = { (uint8_t)(card->programmingError ? SD_CARD_R2_CARD_ECC_FAILED : 0x00) };
+        card->programmingError = false;
+        card->statistics.statusChecks++;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        sd_card_respond(card, r2, sizeof(r2));
+        break;
+    }
+    case CMD12: {
+        // Stuff byte, then the response.
+        uint8_t response[] = { 0xff, R1_READY_STATE };
+        card->outLength = 0;
+        card->outPosition = 0;
+        sd_card_respond(card, response, sizeof(response));
+        break;
+    }
+    case CMD59: {
+        card->crc = arg & 0x01;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        break;
+    }
+    case CMD9: {
+        uint8_t csd[16];
+        sd_card_csd(card, csd);
+        sd_card_respond_r1(card, R1_READY_STATE);
+        sd_card_respond_data(card, csd, sizeof(csd));
+        break;
+    }
+    case CMD17:
+    case CMD18: {
+        if (!sd_card_address(card, arg, &card->block)) {
+            break;
+        }
+        sd_card_respond_r1(card, R1_READY_STATE);
+        if (command == CMD18) {
+            card->state = SD_CARD_STATE_READING;
+        }
+        else {
+            sd_card_respond_block(card);
+        }
+        break;
+    }
+    case CMD24:
+    case CMD25: {
+        if (!sd_card_address(card, arg, &card->block)) {
+            break;
+        }
+        sd_card_respond_r1(card, R1_READY_STATE);
+        card->state = command == CMD25 ? SD_CARD_STATE_WRITE_MULTIPLE_TOKEN : SD_CARD_STATE_WRITE_TOKEN;
+        break;
+    }
+    case CMD32: {
+        if (sd_card_address(card, arg, &card->eraseFirst)) {
+            card->eraseLast = UINT32_MAX;
+            sd_card_respond_r1(card, R1_READY_STATE);
+        }
+        break;
+    }
+    case CMD33: {
+        if (sd_card_address(card, arg, &card->eraseLast)) {
+            sd_card_respond_r1(card, R1_READY_STATE);
+        }
+        break;
+    }
+    case CMD38: {
+        if (card->eraseFirst > card->eraseLast || card->eraseLast == UINT32_MAX) {
+            sd_card_respond_r1(card, SD_CARD_R1_ERASE_SEQUENCE_ERROR);
+            break;
+        }
+        if (!fkfs_device_erase(card->dev, card->eraseFirst, card->eraseLast)) {
+            sd_card_respond_r1(card, SD_CARD_R1_ERASE_SEQUENCE_ERROR);
+            break;
+        }
+        card->statistics.blocksErased += card->eraseLast - card->eraseFirst + 1;
+        card->eraseLast = UINT32_MAX;
+        sd_card_respond_r1(card, R1_READY_STATE);
+        card->busy = card->eraseDelay;
+        break;
+    }
+    default: {
+        sd_card_respond_r1(card, R1_ILLEGAL_COMMAND);
+        break;
+    }
+    }
+}
+
+static void sd_card_received(sd_card_t *card) {
+    uint8_t response = DATA_RES_ACCEPTED;
+    uint8_t multiple = card->state == SD_CARD_STATE_RECEIVING_MULTIPLE;
+    uint16_t crc = ((uint16_t)card->in[SD_RAW_BLOCK_SIZE] << 8) | card->in[SD_RAW_BLOCK_SIZE + 1];
+
+    if (card->corrupt) {
+        card->in[0] ^= 0x10;
+        card->corrupt = false;
+    }
+
+    if (card->crc && crc != sd_raw_crc16(0, card->in, SD_RAW_BLOCK_SIZE)) {
+        card->statistics.crcErrors++;
+        response = DATA_RES_CRC_ERROR;
+    }
+    else if (card->block >= fkfs_device_size(card->dev) || !fkfs_device_write_block(card->dev, card->block, card->in)) {
+        // Write error data response.
+        response = 0x0d;
+    }
+    else {
+        if (card->block == card->badBlock) {
+            card->programmingError = true;
+        }
+        card->statistics.blocksWritten++;
+        card->block++;
+    }
+
+    card->outLength = 0;
+    card->outPosition = 0;
+    sd_card_respond(card, &response, sizeof(response));
+    card->state = multiple ? SD_CARD_STATE_WRITE_MULTIPLE_TOKEN : SD_CARD_STATE_IDLE;
+    card->busy = card->programmingDelay;
+}
+
+static uint8_t sd_card_exchange(void *ctx, uint8_t value) {
+    auto card = (sd_card_t *)ctx;
+
+    switch (card->state) {
+    case SD_CARD_STATE_RECEIVING:
+    case SD_CARD_STATE_RECEIVING_MULTIPLE: {
+        card->in[card->received++] = value;
+        if (card->received == sizeof(card->in)) {
+            sd_card_received(card);
+        }
+        return 0xff;
+    }
+    case SD_CARD_STATE_COMMAND: {
+        card->command[card->commandLength++] = value;
+        if (card->commandLength == sizeof(card->command)) {
+            sd_card_command(card);
+        }
+        return 0xff;
+    }
+    }
+
+    // Commands may interrupt anything else, CMD12 ends a multiple block read.
+    // Multiple block writes only end with the stop token.
+    if ((value & 0xc0) == 0x40 && card->state != SD_CARD_STATE_WRITE_MULTIPLE_TOKEN) {
+        card->command[0] = value;
+        card->commandLength = 1;
+        card->state = SD_CARD_STATE_COMMAND;
+        return 0xff;
+    }
+
+    if (card->outPosition < card->outLength) {
+        return card->out[card->outPosition++];
+    }
+
+    // Programming, the card holds the line low.
+    if (card->busy > 0) {
+        card->busy--;
+        card->statistics.busyBytes++;
+        return 0x00;
+    }
+
+    switch (card->state) {
+    case SD_CARD_STATE_WRITE_TOKEN:
+    case SD_CARD_STATE_WRITE_MULTIPLE_TOKEN: {
+        uint8_t multiple = card->state == SD_CARD_STATE_WRITE_MULTIPLE_TOKEN;
+        if (value == (multiple ? WRITE_MULTIPLE_TOKEN : DATA_START_BLOCK)) {
+            card->received = 0;
+            card->state = multiple ? SD_CARD_STATE_RECEIVING_MULTIPLE : SD_CARD_STATE_RECEIVING;
+        }
+        else if (multiple && value == STOP_TRAN_TOKEN) {
+            card->state = SD_CARD_STATE_IDLE;
+            card->busy = card->programmingDelay;
+        }
+        return 0xff;
+    }
+    case SD_CARD_STATE_READING: {
+        card->outLength = 0;
+        card->outPosition = 0;
+        if (card->block >= fkfs_device_size(card->dev) || !sd_card_respond_block(card)) {
+            card->state = SD_CARD_STATE_IDLE;
+            return 0xff;
+        }
+        return card->out[card->outPosition++];
+    }
+    }
+
+    return 0xff;
+}
+
+uint8_t sd_card_open(sd_card_t *card, fkfs_device_t *dev, uint8_t cs) {
+    memset(card, 0, sizeof(sd_card_t));
+    card->dev = dev;
+    card->idle = true;
+    card->highCapacity = true;
+    card->programmingDelay = SD_CARD_DEFAULT_PROGRAMMING_DELAY;
+    card->eraseDelay = SD_CARD_DEFAULT_ERASE_DELAY;
+    card->auSize = SD_CARD_DEFAULT_AU_SIZE;
+    card->badBlock = UINT32_MAX;
+    card->eraseLast = UINT32_MAX;
+    card->state = SD_CARD_STATE_IDLE;
+    card->spi.cs = cs;
+    card->spi.ctx = card;
+    card->spi.exchange = sd_card_exchange;
+
+    return true;
+}
+
+void sd_card_log_statistics(sd_card_t *card) {
+    printf("card: commands=%d read=%d written=%d erased=%d busy=%d crc-errors=%d pre-erases=%d status=%d\n",
+           card->statistics.commands, card->statistics.blocksRead, card->statistics.blocksWritten,
+           card->statistics.blocksErased, card->statistics.busyBytes, card->statistics.crcErrors,
+           card->statistics.preErases, card->statistics.statusChecks);
+}
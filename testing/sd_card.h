@@ -0,0 +1,67 @@
+#pragma once
+
+#include "SPI.h"
+#include "fkfs_device.h"
+
+/**
+ * Emulates an SD card in SPI mode, one byte at a time, on top of a block
+ * device (a RAM disk or an image file) so sd_raw can be run and measured on
+ * the host. Attach spi to the SPI mock with SPI.attach.
+ *
+ * Cards are SDHC unless highCapacity is cleared, then they're version 2
+ * standard capacity cards, addressed in bytes with a version 1 CSD. After a
+ * block is written or a range erased the card holds the line low (busy) for
+ * programmingDelay or eraseDelay bytes. The SD status reports allocation
+ * units of auSize (the AU_SIZE code, 9 is 4MB) and speed class 10.
+ *
+ * Data always goes out with a CRC, commands and incoming data are checked
+ * once the host turns CRCs on with CMD59. Setting corrupt flips a bit in the
+ * next data block to cross the bus, either way, after its CRC. Writes to
+ * badBlock are taken but fail to program, the next status (CMD13) says so.
+ * Multiple block writes go on until the stop token, rejected blocks or not.
+ */
+typedef struct sd_card_statistics_t {
+    uint32_t commands;
+    uint32_t blocksRead;
+    uint32_t blocksWritten;
+    uint32_t blocksErased;
+    uint32_t busyBytes;
+    uint32_t crcErrors;
+    uint32_t preErases;
+    uint32_t statusChecks;
+} sd_card_statistics_t;
+
+// R1 and the byte before it, a gap and the start token, the block and CRC.
+constexpr uint16_t SD_CARD_BUFFER_SIZE = 2 + 2 + SD_RAW_BLOCK_SIZE + 2;
+
+typedef struct sd_card_t {
+    fkfs_device_t *dev;
+    spi_device_t spi;
+    uint8_t highCapacity;
+    uint32_t programmingDelay;
+    uint32_t eraseDelay;
+    uint8_t corrupt;
+    uint8_t crc;
+    uint8_t auSize;
+    uint32_t badBlock;
+    uint8_t programmingError;
+    uint8_t state;
+    uint8_t idle;
+    uint8_t appCommand;
+    uint8_t command[6];
+    uint8_t commandLength;
+    uint32_t block;
+    uint32_t eraseFirst;
+    uint32_t eraseLast;
+    uint32_t busy;
+    uint16_t received;
+    uint16_t outLength;
+    uint16_t outPosition;
+    uint8_t out[SD_CARD_BUFFER_SIZE];
+    uint8_t in[SD_RAW_BLOCK_SIZE + 2];
+    sd_card_statistics_t statistics;
+} sd_card_t;
+
+uint8_t sd_card_open(sd_card_t *card, fkfs_device_t *dev, uint8_t cs);
+
+void sd_card_log_statistics(sd_card_t *card);
@@ -0,0 +1,940 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "sd_raw.h"
+#include "fkfs.h"
+#include "fkfs_device_host.h"
+#include "sd_card.h"
+
+static constexpr uint8_t FKFS_FILE_LOG = 0;
+static constexpr uint8_t FKFS_FILE_PRIORITY_LOWEST = 255;
+
+static constexpr uint8_t SDCARD_CS = 4;
+static constexpr uint32_t SDCARD_NUMBER_OF_BLOCKS = 16384;
+static constexpr uint32_t SDCARD_BLOCKS = 8;
+static constexpr uint8_t SDCARD_AU_SIZE = 6;
+static constexpr uint32_t SDCARD_AU_BLOCKS = 1024;
+// Several write behind queues worth, lost along with their headers.
+static constexpr uint32_t SDCARD_LOST_RECORDS = 60;
+// Blocks past the head fkfs_idle erases ahead over, at most SDCARD_BLOCKS.
+static constexpr uint32_t SDCARD_ERASE_AHEAD_BLOCKS = 6;
+static constexpr uint32_t SDCARD_INLINE_RECORDS = 8;
+static constexpr uint32_t SDCARD_WINDOW_RECORDS = 5;
+static constexpr uint32_t SDCARD_WINDOW_INTERVAL = 1000;
+
+/**
+ * Runs sd_raw through the card emulator, over an image file, checking each
+ * part of the protocol and the SPI bytes it took. Exits non-zero if anything
+ * misbehaves, so driver changes can be checked off the board.
+ */
+typedef struct sdcard_t {
+    sd_raw_t sd;
+    sd_card_t card;
+    fkfs_device_t image;
+    uint8_t buffer[SDCARD_BLOCKS * SD_RAW_BLOCK_SIZE];
+    uint8_t expected[SDCARD_BLOCKS * SD_RAW_BLOCK_SIZE];
+} sdcard_t;
+
+static void sdcard_pattern(uint8_t *buffer, uint32_t size, uint32_t seed) {
+    for (uint32_t i = 0; i < size; ++i) {
+        buffer[i] = (uint8_t)(seed * 31 + i * 7 + (i >> 9));
+    }
+}
+
+// The same CRC fkfs keeps with its entries, for writing blocks as an older
+// fkfs would have.
+static uint16_t sdcard_crc16(uint16_t crc, const uint8_t *p, uint16_t n) {
+    static const uint16_t table[16] = {
+        0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+        0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+    };
+
+    while (n-- > 0) {
+        crc = (crc >> 4) ^ table[crc & 0xF] ^ table[*p & 0xF];
+        crc = (crc >> 4) ^ table[crc & 0xF] ^ table[(*p >> 4) & 0xF];
+        p++;
+    }
+
+    return crc;
+}
+
+static bool sdcard_initialize(sdcard_t *sc) {
+    if (!sd_raw_initialize(&sc->sd, SDCARD_CS)) {
+        return false;
+    }
+    return sc->sd.type == (sc->card.highCapacity ? SD_CARD_TYPE_SDHC : SD_CARD_TYPE_SD2);
+}
+
+static bool sdcard_size(sdcard_t *sc) {
+    if (sd_raw_card_size(&sc->sd) != SDCARD_NUMBER_OF_BLOCKS) {
+        return false;
+    }
+
+    // Again, without the cached value.
+    if (!sd_raw_read_geometry(&sc->sd) || sc->sd.numberOfBlocks != SDCARD_NUMBER_OF_BLOCKS) {
+        return false;
+    }
+    return sc->sd.auBlocks == SDCARD_AU_BLOCKS && sc->sd.speedClass != 0;
+}
+
+static bool sdcard_single(sdcard_t *sc) {
+    for (uint32_t i = 0; i < SDCARD_BLOCKS; ++i) {
+        auto block = SDCARD_NUMBER_OF_BLOCKS - 1 - i;
+        sdcard_pattern(sc->expected, SD_RAW_BLOCK_SIZE, block);
+        if (!sd_raw_write_block(&sc->sd, block, sc->expected)) {
+            return false;
+        }
+        if (!sd_raw_read_block(&sc->sd, block, sc->buffer)) {
+            return false;
+        }
+        if (memcmp(sc->buffer, sc->expected, SD_RAW_BLOCK_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sdcard_multiple(sdcard_t *sc) {
+    sdcard_pattern(sc->expected, sizeof(sc->expected), 100);
+    if (!sd_raw_write_blocks(&sc->sd, 100, SDCARD_BLOCKS, sc->expected)) {
+        return false;
+    }
+    if (!sd_raw_read_blocks(&sc->sd, 100, SDCARD_BLOCKS, sc->buffer)) {
+        return false;
+    }
+    if (memcmp(sc->buffer, sc->expected, sizeof(sc->expected)) != 0) {
+        return false;
+    }
+
+    // Every block should have landed where the single block reads expect.
+    for (uint32_t i = 0; i < SDCARD_BLOCKS; ++i) {
+        if (!sd_raw_read_block(&sc->sd, 100 + i, sc->buffer)) {
+            return false;
+        }
+        if (memcmp(sc->buffer, sc->expected + i * SD_RAW_BLOCK_SIZE, SD_RAW_BLOCK_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sdcard_partial(sdcard_t *sc) {
+    sdcard_pattern(sc->expected, sizeof(sc->expected), 100);
+
+    // Forwards within a block, then backwards, which starts it again.
+    uint16_t offsets[] = { 0, 7, 100, 300, 500, 20 };
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        if (!sd_raw_read_partial(&sc->sd, 101, offsets[i], 12, sc->buffer)) {
+            return false;
+        }
+        if (memcmp(sc->buffer, sc->expected + SD_RAW_BLOCK_SIZE + offsets[i], 12) != 0) {
+            return false;
+        }
+    }
+
+    // Moving to another block ends the open one.
+    if (!sd_raw_read_partial(&sc->sd, 102, 4, 4, sc->buffer)) {
+        return false;
+    }
+    if (memcmp(sc->buffer, sc->expected + 2 * SD_RAW_BLOCK_SIZE + 4, 4) != 0) {
+        return false;
+    }
+    return sd_raw_read_end(&sc->sd) && !sc->sd.inBlock;
+}
+
+static bool sdcard_background(sdcard_t *sc) {
+    sdcard_pattern(sc->expected, sizeof(sc->expected), 200);
+    if (!sd_raw_write_blocks_start(&sc->sd, 200, SDCARD_BLOCKS, sc->expected)) {
+        return false;
+    }
+
+    uint32_t polls = 0;
+    uint8_t status;
+    while ((status = sd_raw_write_poll(&sc->sd)) == SD_RAW_WRITE_BUSY) {
+        polls++;
+    }
+    if (status != SD_RAW_WRITE_READY || polls == 0) {
+        return false;
+    }
+
+    // And a read while a write is programming waits for it.
+    if (!sd_raw_write_block_start(&sc->sd, 199, sc->expected)) {
+        return false;
+    }
+    if (!sd_raw_read_blocks(&sc->sd, 199, 1, sc->buffer)) {
+        return false;
+    }
+    return sc->sd.writeStatus == SD_RAW_WRITE_READY && memcmp(sc->buffer, sc->expected, SD_RAW_BLOCK_SIZE) == 0;
+}
+
+static bool sdcard_erase(sdcard_t *sc) {
+    if (!sd_raw_erase(&sc->sd, 100, 100 + SDCARD_BLOCKS - 1)) {
+        return false;
+    }
+    if (!sd_raw_read_blocks(&sc->sd, 100, SDCARD_BLOCKS, sc->buffer)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < sizeof(sc->buffer); ++i) {
+        if (sc->buffer[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sdcard_errors(sdcard_t *sc) {
+    if (sd_raw_read_block(&sc->sd, SDCARD_NUMBER_OF_BLOCKS, sc->buffer)) {
+        return false;
+    }
+    if (sc->sd.status != SD_CARD_ERROR_CMD17) {
+        return false;
+    }
+    if (sd_raw_write_block(&sc->sd, SDCARD_NUMBER_OF_BLOCKS, sc->buffer)) {
+        return false;
+    }
+    if (sc->sd.status != SD_CARD_ERROR_CMD24) {
+        return false;
+    }
+    // The card should be fine afterwards.
+    return sd_raw_read_block(&sc->sd, 100, sc->buffer);
+}
+
+static bool sdcard_crc(sdcard_t *sc) {
+    if (!sd_raw_set_crc(&sc->sd, true)) {
+        return false;
+    }
+
+    // Everything should still work with CRCs on.
+    if (!sdcard_size(sc) || !sdcard_single(sc) || !sdcard_multiple(sc) || !sdcard_partial(sc)) {
+        return false;
+    }
+
+    // Corrupted data from the card is caught by us, however it's read.
+    sc->card.corrupt = true;
+    if (sd_raw_read_block(&sc->sd, 100, sc->buffer) || sc->sd.status != SD_CARD_ERROR_READ_CRC) {
+        return false;
+    }
+    sc->card.corrupt = true;
+    if (sd_raw_read_blocks(&sc->sd, 100, SDCARD_BLOCKS, sc->buffer) || sc->sd.status != SD_CARD_ERROR_READ_CRC) {
+        return false;
+    }
+    sc->card.corrupt = true;
+    if (!sd_raw_read_partial(&sc->sd, 100, 0, 8, sc->buffer)) {
+        return false;
+    }
+    if (sd_raw_read_end(&sc->sd) || sc->sd.status != SD_CARD_ERROR_READ_CRC) {
+        return false;
+    }
+
+    // And corrupted data from us by the card.
+    sc->card.corrupt = true;
+    if (sd_raw_write_block(&sc->sd, 100, sc->buffer) || sc->sd.status != SD_CARD_ERROR_WRITE) {
+        return false;
+    }
+    // A rejected burst is stopped, or the card's no use for what follows.
+    sc->card.corrupt = true;
+    if (sd_raw_write_blocks(&sc->sd, 100, SDCARD_BLOCKS, sc->buffer) || sc->sd.status != SD_CARD_ERROR_WRITE_MULTIPLE) {
+        return false;
+    }
+
+    if (!sd_raw_set_crc(&sc->sd, false)) {
+        return false;
+    }
+
+    return sdcard_multiple(sc);
+}
+
+static bool sdcard_lazy(sdcard_t *sc) {
+    sdcard_pattern(sc->expected, sizeof(sc->expected), 300);
+    sc->sd.statusInterval = SDCARD_BLOCKS;
+
+    // The status is checked once for the lot.
+    auto checks = sc->card.statistics.statusChecks;
+    for (uint32_t i = 0; i < SDCARD_BLOCKS; ++i) {
+        if (!sd_raw_write_block(&sc->sd, 300 + i, sc->expected + i * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+    if (sc->card.statistics.statusChecks != checks + 1) {
+        return false;
+    }
+
+    // Or before the blocks are read back.
+    if (!sd_raw_write_block(&sc->sd, 300, sc->expected)) {
+        return false;
+    }
+    if (!sd_raw_read_blocks(&sc->sd, 300, SDCARD_BLOCKS, sc->buffer)) {
+        return false;
+    }
+    if (sc->card.statistics.statusChecks != checks + 2 || memcmp(sc->buffer, sc->expected, sizeof(sc->buffer)) != 0) {
+        return false;
+    }
+
+    // A failure found later is still put down to the right blocks.
+    sc->card.badBlock = 305;
+    for (uint32_t i = 0; i < SDCARD_BLOCKS - 1; ++i) {
+        if (!sd_raw_write_block(&sc->sd, 300 + i, sc->expected + i * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+    sc->card.badBlock = UINT32_MAX;
+    if (sd_raw_write_check(&sc->sd) || sc->sd.status != SD_CARD_ERROR_WRITE_PROGRAMMING) {
+        return false;
+    }
+    if (sc->sd.statusFirst != 300 || sc->sd.statusLast != 300 + SDCARD_BLOCKS - 2) {
+        return false;
+    }
+
+    sc->sd.statusInterval = 0;
+
+    // Checking every write, the failure comes back from the write itself.
+    sc->card.badBlock = 301;
+    if (sd_raw_write_block(&sc->sd, 301, sc->expected) || sc->sd.status != SD_CARD_ERROR_WRITE_PROGRAMMING) {
+        return false;
+    }
+    sc->card.badBlock = UINT32_MAX;
+
+    return sd_raw_write_block(&sc->sd, 301, sc->expected + SD_RAW_BLOCK_SIZE);
+}
+
+static bool sdcard_fkfs(sdcard_t *sc) {
+    fkfs_t fs;
+    if (!fkfs_create(&fs)) {
+        return false;
+    }
+
+    if (!fkfs_device_sd_open(&fs.device, &sc->sd)) {
+        return false;
+    }
+
+    if (!fkfs_initialize_file(&fs, FKFS_FILE_LOG, FKFS_FILE_PRIORITY_LOWEST, false, "FK.LOG")) {
+        return false;
+    }
+
+    if (!fkfs_initialize(&fs, true)) {
+        return false;
+    }
+
+    // The data region should be lined up with the allocation units.
+    if (fs.firstBlock % SDCARD_AU_BLOCKS != 0 || fs.endBlock % SDCARD_AU_BLOCKS != 0 || fs.header.block != fs.firstBlock) {
+        return false;
+    }
+
+    uint8_t record[100];
+    sdcard_pattern(record, sizeof(record), 1);
+    for (uint32_t i = 0; i < 200; ++i) {
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+    }
+    if (!fkfs_flush(&fs)) {
+        return false;
+    }
+
+    fkfs_file_iter_t iter = { 0 };
+    fkfs_iterator_config_t config = {
+        .maxBlocks = 0,
+        .maxTime = 0,
+        .manualNext = false,
+        .readAhead = false,
+        .partialReads = false,
+        .buffer = nullptr,
+        .bufferSize = 0,
+    };
+    uint32_t bytes = 0;
+
+    fkfs_file_iterator_create(&fs, FKFS_FILE_LOG, &iter);
+
+    while (fkfs_file_iterate(&fs, &config, &iter)) {
+        if (memcmp(iter.data, record, iter.size) != 0) {
+            return false;
+        }
+        bytes += iter.size;
+    }
+    return bytes == 200 * sizeof(record);
+}
+
+static bool sdcard_mount(sdcard_t *sc, fkfs_t *fs, uint8_t sync) {
+    if (!fkfs_create(fs) || !fkfs_device_sd_open(&fs->device, &sc->sd)) {
+        return false;
+    }
+
+    if (!fkfs_initialize_file(fs, FKFS_FILE_LOG, FKFS_FILE_PRIORITY_LOWEST, sync, "FK.LOG")) {
+        return false;
+    }
+
+    return fkfs_initialize(fs, false);
+}
+
+// Mounts the image the card is emulated over, which knows nothing of
+// allocation units, expecting the region the card was wiped with.
+static bool sdcard_region(sdcard_t *sc) {
+    fkfs_t card;
+    if (!sdcard_mount(sc, &card, false)) {
+        return false;
+    }
+
+    fkfs_t image;
+    if (!fkfs_create(&image)) {
+        return false;
+    }
+
+    image.device = sc->image;
+
+    if (!fkfs_initialize_file(&image, FKFS_FILE_LOG, FKFS_FILE_PRIORITY_LOWEST, false, "FK.LOG")) {
+        return false;
+    }
+
+    if (!fkfs_initialize(&image, false)) {
+        return false;
+    }
+
+    return image.firstBlock == card.firstBlock && image.endBlock == card.endBlock && card.endBlock % SDCARD_AU_BLOCKS == 0 &&
+           image.header.block == card.header.block && image.header.files[FKFS_FILE_LOG].size == card.header.files[FKFS_FILE_LOG].size;
+}
+
+// Commits enough times to go round the header ring twice, mounting part way
+// through each lap to find the newest header.
+static bool sdcard_header_ring(sdcard_t *sc) {
+    uint8_t record[20];
+    sdcard_pattern(record, sizeof(record), 2);
+
+    fkfs_t fs;
+    if (!sdcard_mount(sc, &fs, true)) {
+        return false;
+    }
+
+    // Left by the fkfs check.
+    uint32_t size = fs.header.files[FKFS_FILE_LOG].size;
+    if (size != 200 * 100) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < FKFS_HEADER_BLOCKS * 2 + 7; ++i) {
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+        size += sizeof(record);
+
+        if (i % 29 != 0) {
+            continue;
+        }
+
+        fkfs_t mounted;
+        if (!sdcard_mount(sc, &mounted, true)) {
+            return false;
+        }
+
+        if (mounted.header.generation != fs.header.generation || mounted.header.block != fs.header.block ||
+            mounted.header.offset != fs.header.offset || mounted.header.files[FKFS_FILE_LOG].size != size) {
+            return false;
+        }
+
+        // The first block, a binary search of the ring, then the head and
+        // the block after it looking for entries to roll forward.
+        if (mounted.statistics.blockReads > 9 || mounted.statistics.recoveredEntries != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Appends after putting back the headers from before, as though power went
+// before the header was committed, then mounts expecting the appends back.
+static bool sdcard_roll_forward(sdcard_t *sc) {
+    uint8_t record[100];
+    sdcard_pattern(record, sizeof(record), 3);
+
+    fkfs_t fs;
+    if (!sdcard_mount(sc, &fs, false)) {
+        return false;
+    }
+
+    std::vector<uint8_t> headers((1 + FKFS_HEADER_BLOCKS) * SD_RAW_BLOCK_SIZE);
+    for (uint32_t block = 0; block < 1 + FKFS_HEADER_BLOCKS; ++block) {
+        if (!fkfs_device_read_block(&sc->image, block, headers.data() + block * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+
+    auto size = fs.header.files[FKFS_FILE_LOG].size;
+
+    for (uint32_t i = 0; i < SDCARD_LOST_RECORDS; ++i) {
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+    }
+    if (!fkfs_flush(&fs)) {
+        return false;
+    }
+
+    for (uint32_t block = 0; block < 1 + FKFS_HEADER_BLOCKS; ++block) {
+        if (!fkfs_device_write_block(&sc->image, block, headers.data() + block * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+
+    fkfs_t mounted;
+    if (!sdcard_mount(sc, &mounted, false)) {
+        return false;
+    }
+
+    if (mounted.statistics.recoveredEntries != SDCARD_LOST_RECORDS || mounted.header.files[FKFS_FILE_LOG].size != size + SDCARD_LOST_RECORDS * sizeof(record)) {
+        return false;
+    }
+
+    return mounted.header.block == fs.header.block && mounted.header.offset == fs.header.offset;
+}
+
+// Puts a block from before stamps just past the head, with an entry running
+// into the trailer, then appends past it and mounts from the header before.
+// The block is left as it was and the stamped ones after it still count.
+static bool sdcard_legacy_block(sdcard_t *sc) {
+    uint8_t record[100];
+    sdcard_pattern(record, sizeof(record), 5);
+
+    fkfs_t fs;
+    if (!sdcard_mount(sc, &fs, false)) {
+        return false;
+    }
+
+    auto legacy = fs.header.block + 1;
+    auto entry = (fkfs_entry_t *)sc->expected;
+    entry->file = FKFS_FILE_LOG;
+    entry->size = SD_RAW_BLOCK_SIZE - sizeof(fkfs_entry_t);
+    entry->available = entry->size;
+    sdcard_pattern(sc->expected + sizeof(fkfs_entry_t), entry->size, 6);
+    entry->crc = sdcard_crc16(fs.header.files[FKFS_FILE_LOG].version, sc->expected, FKFS_ENTRY_SIZE_MINUS_CRC);
+    entry->crc = sdcard_crc16(entry->crc, sc->expected + sizeof(fkfs_entry_t), entry->size);
+
+    if (!fkfs_device_write_block(&sc->image, legacy, sc->expected)) {
+        return false;
+    }
+
+    if (!sdcard_mount(sc, &fs, false)) {
+        return false;
+    }
+
+    std::vector<uint8_t> headers((1 + FKFS_HEADER_BLOCKS) * SD_RAW_BLOCK_SIZE);
+    for (uint32_t block = 0; block < 1 + FKFS_HEADER_BLOCKS; ++block) {
+        if (!fkfs_device_read_block(&sc->image, block, headers.data() + block * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+
+    auto size = fs.header.files[FKFS_FILE_LOG].size;
+
+    for (uint32_t i = 0; i < SDCARD_LOST_RECORDS; ++i) {
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+    }
+    if (!fkfs_flush(&fs)) {
+        return false;
+    }
+
+    if (!fkfs_device_read_block(&sc->image, legacy, sc->buffer) || memcmp(sc->buffer, sc->expected, SD_RAW_BLOCK_SIZE) != 0) {
+        return false;
+    }
+
+    for (uint32_t block = 0; block < 1 + FKFS_HEADER_BLOCKS; ++block) {
+        if (!fkfs_device_write_block(&sc->image, block, headers.data() + block * SD_RAW_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+
+    fkfs_t mounted;
+    if (!sdcard_mount(sc, &mounted, false)) {
+        return false;
+    }
+
+    // The old entry was never committed either, so it comes back with them.
+    if (mounted.statistics.recoveredEntries != fs.statistics.recoveredEntries + SDCARD_LOST_RECORDS + 1 ||
+        mounted.header.files[FKFS_FILE_LOG].size != size + SDCARD_LOST_RECORDS * sizeof(record) + entry->size) {
+        return false;
+    }
+
+    return mounted.header.block == fs.header.block && mounted.header.offset == fs.header.offset;
+}
+
+// Reads the log from the start while appending to it, so the reader and the
+// head take turns in the cache, then mounts expecting every append. With one
+// cached block the reader has the head's appends queued to be written.
+static bool sdcard_read_appending(sdcard_t *sc) {
+    uint8_t record[100];
+    sdcard_pattern(record, sizeof(record), 8);
+
+    fkfs_t fs;
+    if (!sdcard_mount(sc, &fs, false)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < SDCARD_LOST_RECORDS; ++i) {
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+    }
+
+    fkfs_file_iter_t iter = { 0 };
+    fkfs_iterator_config_t config = {
+        .maxBlocks = 0,
+        .maxTime = 0,
+        .manualNext = false,
+        .readAhead = false,
+        .partialReads = false,
+        .buffer = nullptr,
+        .bufferSize = 0,
+    };
+    uint32_t bytes = 0;
+    uint32_t appended = SDCARD_LOST_RECORDS;
+
+    fkfs_file_iterator_create(&fs, FKFS_FILE_LOG, &iter);
+
+    auto size = fs.header.files[FKFS_FILE_LOG].size;
+
+    while (fkfs_file_iterate(&fs, &config, &iter)) {
+        bytes += iter.size;
+
+        // The appends made before the iterator are the last it reads.
+        if (bytes > size - SDCARD_LOST_RECORDS * sizeof(record) &&
+            (iter.size != sizeof(record) || memcmp(iter.data, record, sizeof(record)) != 0)) {
+            return false;
+        }
+
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+        appended++;
+    }
+
+    if (bytes != size || !fkfs_flush(&fs)) {
+        return false;
+    }
+
+    fkfs_t mounted;
+    if (!sdcard_mount(sc, &mounted, false)) {
+        return false;
+    }
+
+    return mounted.statistics.recoveredEntries == 0 &&
+           mounted.header.files[FKFS_FILE_LOG].size == size + (appended - SDCARD_LOST_RECORDS) * sizeof(record);
+}
+
+// Fills the blocks ahead of the head with live entries, garbage and entries
+// too large for their block, then lets fkfs_idle erase ahead over them. Only
+// blocks the allocator would write over are erased.
+static bool sdcard_erase_ahead(sdcard_t *sc) {
+    fkfs_t fs;
+    if (!sdcard_mount(sc, &fs, false)) {
+        return false;
+    }
+
+    auto first = fs.header.block + 1;
+    uint8_t live[SDCARD_ERASE_AHEAD_BLOCKS] = { 0 };
+
+    for (uint32_t i = 0; i < SDCARD_ERASE_AHEAD_BLOCKS; ++i) {
+        auto block = sc->expected + i * SD_RAW_BLOCK_SIZE;
+        auto entry = (fkfs_entry_t *)block;
+
+        memset(block, 0, SD_RAW_BLOCK_SIZE);
+
+        switch (i % 3) {
+        case 0:
+            entry->file = FKFS_FILE_LOG;
+            entry->size = 100;
+            entry->available = entry->size;
+            sdcard_pattern(block + sizeof(fkfs_entry_t), entry->size, 7 + i);
+            entry->crc = sdcard_crc16(fs.header.files[FKFS_FILE_LOG].version, block, FKFS_ENTRY_SIZE_MINUS_CRC);
+            entry->crc = sdcard_crc16(entry->crc, block + sizeof(fkfs_entry_t), entry->size);
+            live[i] = true;
+            break;
+        case 1:
+            sdcard_pattern(block, SD_RAW_BLOCK_SIZE, 7 + i);
+            break;
+        case 2:
+            entry->file = FKFS_FILE_LOG;
+            entry->size = SD_RAW_BLOCK_SIZE - 1;
+            entry->available = 1;
+            break;
+        }
+
+        if (!fkfs_device_write_block(&sc->image, first + i, block)) {
+            return false;
+        }
+    }
+
+    if (!sdcard_mount(sc, &fs, false)) {
+        return false;
+    }
+
+    fs.eraseAhead = SDCARD_ERASE_AHEAD_BLOCKS;
+
+    if (!fkfs_idle(&fs)) {
+        return false;
+    }
+
+    auto preserved = 0;
+    for (uint32_t i = 0; i < SDCARD_ERASE_AHEAD_BLOCKS; ++i) {
+        if (!fkfs_device_read_block(&sc->image, first + i, sc->buffer)) {
+            return false;
+        }
+
+        if (live[i]) {
+            if (memcmp(sc->buffer, sc->expected + i * SD_RAW_BLOCK_SIZE, SD_RAW_BLOCK_SIZE) != 0) {
+                return false;
+            }
+            preserved++;
+        }
+        else {
+            for (uint32_t j = 0; j < SD_RAW_BLOCK_SIZE; ++j) {
+                if (sc->buffer[j] != 0) {
+                    return false;
+                }
+            }
+        }
+
+        // Nothing is left behind for the checks after this one.
+        memset(sc->buffer, 0, SD_RAW_BLOCK_SIZE);
+        if (!fkfs_device_write_block(&sc->image, first + i, sc->buffer)) {
+            return false;
+        }
+    }
+
+    return fs.statistics.preservedBlocks == preserved && fs.statistics.erasedBlocks == SDCARD_ERASE_AHEAD_BLOCKS - preserved;
+}
+
+// Sync appends of small records with inlineSync, mounting without a flush so
+// the newest of them are only in the header's block. Mounts put them back in
+// the head without writing to the card, until one of them is flushed.
+static bool sdcard_inline_sync(sdcard_t *sc) {
+    uint8_t record[20];
+    sdcard_pattern(record, sizeof(record), 4);
+
+    fkfs_t fs;
+    if (!sdcard_mount(sc, &fs, true)) {
+        return false;
+    }
+
+    fs.inlineSync = true;
+
+    auto size = fs.header.files[FKFS_FILE_LOG].size;
+    auto writes = fs.statistics.blockWrites;
+
+    for (uint32_t i = 0; i < SDCARD_INLINE_RECORDS; ++i) {
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+    }
+    size += SDCARD_INLINE_RECORDS * sizeof(record);
+
+    if (fkfs_durable(&fs) != fkfs_sequence(&fs) || fs.statistics.inlineCommits == 0 ||
+        fs.statistics.blockWrites - writes >= 2 * SDCARD_INLINE_RECORDS) {
+        return false;
+    }
+
+    for (bool flush : { false, true, false }) {
+        fkfs_t mounted;
+        if (!sdcard_mount(sc, &mounted, false)) {
+            return false;
+        }
+
+        if (mounted.statistics.blockWrites != 0 || mounted.statistics.recoveredEntries != 0 ||
+            mounted.header.files[FKFS_FILE_LOG].size != size) {
+            return false;
+        }
+
+        fkfs_file_iter_t iter = { 0 };
+        fkfs_iterator_config_t config = {
+            .maxBlocks = 0,
+            .maxTime = 0,
+            .manualNext = false,
+            .readAhead = false,
+            .partialReads = false,
+            .buffer = nullptr,
+            .bufferSize = 0,
+        };
+        uint32_t bytes = 0;
+
+        fkfs_file_iterator_create(&mounted, FKFS_FILE_LOG, &iter);
+
+        while (fkfs_file_iterate(&mounted, &config, &iter)) {
+            bytes += iter.size;
+        }
+
+        if (bytes != size || iter.size != sizeof(record) || memcmp(iter.data, record, sizeof(record)) != 0) {
+            return false;
+        }
+
+        if (flush && (!fkfs_flush(&mounted) || mounted.statistics.blockWrites == 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Waits out an asynchronous commit, returning how it went.
+static uint8_t sdcard_commit_wait(fkfs_t *fs) {
+    uint8_t status;
+    while ((status = fkfs_poll(fs)) == FKFS_PENDING) {
+    }
+    return status;
+}
+
+// Asynchronous sync appends under a window of SDCARD_WINDOW_RECORDS records,
+// and then SDCARD_WINDOW_INTERVAL on the virtual clock. Nothing's durable
+// until the window closes, and a commit that fails leaves it open so the next
+// fkfs_idle tries again.
+static bool sdcard_sync_windows(sdcard_t *sc) {
+    uint8_t record[100];
+    sdcard_pattern(record, sizeof(record), 9);
+
+    fkfs_t fs;
+    if (!sdcard_mount(sc, &fs, true)) {
+        return false;
+    }
+
+    fs.asynchronous = true;
+
+    if (!fkfs_file_sync_policy(&fs, FKFS_FILE_LOG, SDCARD_WINDOW_RECORDS * sizeof(record), 0)) {
+        return false;
+    }
+
+    auto durable = fkfs_durable(&fs);
+    for (uint32_t i = 0; i < SDCARD_WINDOW_RECORDS - 1; ++i) {
+        if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record)) {
+            return false;
+        }
+    }
+    if (!sdcard_commit_wait(&fs) || fkfs_durable(&fs) != durable) {
+        return false;
+    }
+    if (!fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record) || !sdcard_commit_wait(&fs)) {
+        return false;
+    }
+    if (fkfs_durable(&fs) != fkfs_sequence(&fs) || fs.files[FKFS_FILE_LOG].unsynced != 0) {
+        return false;
+    }
+
+    // The head fails to program, which the data's poll finds, whether that's
+    // waiting here or in an append.
+    sc->card.badBlock = fs.header.block;
+    durable = fkfs_durable(&fs);
+    for (uint32_t i = 0; i < SDCARD_WINDOW_RECORDS; ++i) {
+        fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record);
+    }
+    auto failed = !sdcard_commit_wait(&fs);
+    sc->card.badBlock = UINT32_MAX;
+    if (!failed || fkfs_durable(&fs) != durable ||
+        fs.files[FKFS_FILE_LOG].unsynced != SDCARD_WINDOW_RECORDS * sizeof(record)) {
+        return false;
+    }
+    if (!fkfs_idle(&fs) || !sdcard_commit_wait(&fs) || fkfs_durable(&fs) != fkfs_sequence(&fs)) {
+        return false;
+    }
+
+    if (!fkfs_file_sync_policy(&fs, FKFS_FILE_LOG, 0, SDCARD_WINDOW_INTERVAL)) {
+        return false;
+    }
+
+    hal_clock_virtual(true);
+
+    durable = fkfs_durable(&fs);
+    auto success = fkfs_file_append(&fs, FKFS_FILE_LOG, sizeof(record), record);
+
+    hal_clock_advance((SDCARD_WINDOW_INTERVAL - 1) * 1000);
+    success = success && fkfs_idle(&fs) && sdcard_commit_wait(&fs) && fkfs_durable(&fs) == durable;
+
+    hal_clock_advance(1000);
+    success = success && fkfs_idle(&fs) && sdcard_commit_wait(&fs) && fkfs_durable(&fs) == fkfs_sequence(&fs);
+
+    hal_clock_virtual(false);
+
+    return success;
+}
+
+typedef struct sdcard_check_t {
+    const char *name;
+    bool (*check)(sdcard_t *sc);
+} sdcard_check_t;
+
+static const sdcard_check_t sdcard_checks[] = {
+    { "initialize", sdcard_initialize },
+    { "card size", sdcard_size },
+    { "single block", sdcard_single },
+    { "multiple block", sdcard_multiple },
+    { "partial read", sdcard_partial },
+    { "background write", sdcard_background },
+    { "erase", sdcard_erase },
+    { "errors", sdcard_errors },
+    { "crc", sdcard_crc },
+    { "lazy status", sdcard_lazy },
+    { "fkfs", sdcard_fkfs },
+    { "region", sdcard_region },
+    { "header ring", sdcard_header_ring },
+    { "roll forward", sdcard_roll_forward },
+    { "legacy block", sdcard_legacy_block },
+    { "erase ahead", sdcard_erase_ahead },
+    { "read appending", sdcard_read_appending },
+    { "inline sync", sdcard_inline_sync },
+    { "sync windows", sdcard_sync_windows },
+};
+
+static bool sdcard_run(sdcard_t *sc, uint8_t highCapacity) {
+    sd_card_open(&sc->card, &sc->image, SDCARD_CS);
+    sc->card.highCapacity = highCapacity;
+    sc->card.programmingDelay = 200;
+    sc->card.eraseDelay = 1000;
+    sc->card.auSize = SDCARD_AU_SIZE;
+    SPI.attach(&sc->card.spi);
+
+    auto success = true;
+
+    for (auto &c : sdcard_checks) {
+        auto before = SPI.statistics.bytes;
+        auto passed = c.check(sc);
+        printf("%-5s %-16s %-4s (%llu spi bytes)\n", highCapacity ? "sdhc" : "sd2", c.name, passed ? "ok" : "FAIL",
+               (unsigned long long)(SPI.statistics.bytes - before));
+        if (!passed) {
+            fprintf(stderr, "error: %s failed (status %d)\n", c.name, sc->sd.status);
+            success = false;
+            break;
+        }
+    }
+
+    sd_card_log_statistics(&sc->card);
+    SPI.attach(nullptr);
+
+    return success;
+}
+
+int main(int argc, const char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <image>\n", argv[0]);
+        return 2;
+    }
+
+    auto sc = new sdcard_t();
+
+    remove(argv[1]);
+
+    fkfs_device_fd_t fd;
+    if (!fkfs_device_fd_open(&sc->image, &fd, argv[1], SDCARD_NUMBER_OF_BLOCKS)) {
+        fprintf(stderr, "error: Unable to open file.\n");
+        return 2;
+    }
+
+    auto success = sdcard_run(sc, true) && sdcard_run(sc, false);
+
+    fkfs_device_fd_log_statistics(&sc->image);
+    fkfs_device_fd_close(&sc->image);
+    delete sc;
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include <cstring>
+
+#include "SPI.h"
+
+SPIClass SPI;
+
+void SPIClass::begin() {
+}
+
+void SPIClass::end() {
+}
+
+void SPIClass::setClockDivider(uint8_t divider) {
+}
+
+uint8_t SPIClass::transfer(uint8_t value) {
+    statistics.byteCalls++;
+    statistics.bytes++;
+    if (device == nullptr || !selected) {
+        return 0xff;
+    }
+    return device->exchange(device->ctx, value);
+}
+
+void SPIClass::transfer(void *buffer, size_t size) {
+    auto ptr = (uint8_t *)buffer;
+    statistics.bufferCalls++;
+    statistics.bytes += size;
+    if (device == nullptr || !selected) {
+        memset(ptr, 0xff, size);
+        return;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        ptr[i] = device->exchange(device->ctx, ptr[i]);
+    }
+}
+
+void SPIClass::attach(spi_device_t *device) {
+    this->device = device;
+    this->selected = false;
+}
+
+void SPIClass::chipSelect(uint8_t pin, uint8_t level) {
+    if (device != nullptr && device->cs == pin) {
+        selected = level == LOW;
+    }
+}
@@ -7,11 +7,14 @@
 #include "Arduino.h"
 #include "sd_raw.h"
 #include "fkfs.h"
+#include "fkfs_device_host.h"
 
 static constexpr uint8_t FKFS_FILE_LOG = 0;
 static constexpr uint8_t FKFS_FILE_DATA = 1;
 static constexpr uint8_t FKFS_FILE_PRIORITY_LOWEST = 255;
 static constexpr uint8_t FKFS_FILE_PRIORITY_HIGHEST = 0;
+// New images are made this large, fkfs needs room for its data region.
+static constexpr uint32_t TEST_NUMBER_OF_BLOCKS = 32768;
 
 int main(int argc, const char **argv) {
     if (argc != 2) {
@@ -24,11 +27,20 @@ int main(int argc, const char **argv) {
         return 2;
     }
 
-    if (!sd_raw_file_initialize(&fs.sd, argv[1])) {
+    fkfs_device_fd_t image;
+    if (!fkfs_device_fd_open(&fs.device, &image, argv[1], 0)) {
         fprintf(stderr, "error: Unable to open file.\n");
         return 2;
     }
 
+    // Images that are already there keep their size.
+    if (fkfs_device_size(&fs.device) == 0) {
+        if (!fkfs_device_fd_close(&fs.device) || !fkfs_device_fd_open(&fs.device, &image, argv[1], TEST_NUMBER_OF_BLOCKS)) {
+            fprintf(stderr, "error: Unable to open file.\n");
+            return 2;
+        }
+    }
+
     if (!fkfs_initialize_file(&fs, FKFS_FILE_LOG, FKFS_FILE_PRIORITY_LOWEST, true, "FK.LOG")) {
         fprintf(stderr, "error: Unable to initialize file.\n");
         return 2;
@@ -54,7 +66,9 @@ int main(int argc, const char **argv) {
 
     fkfs_flush(&fs);
 
-    sd_raw_file_close(&fs.sd);
+    fkfs_device_fd_log_statistics(&fs.device);
+
+    fkfs_device_fd_close(&fs.device);
 
     return 0;
 }